@@ -38,6 +38,9 @@
 #include "Loader.h"
 #include "GLTFLoader.h"
 #include "Renderer.h"
+#include "CpuRenderer.h"
+#include "BvhTraversal.h"
+#include "MemoryUsage.h"
 #include "boyTestScene.h"
 #include "ajaxTestScene.h"
 #include "cornellTestScene.h"
@@ -52,6 +55,7 @@ using namespace GLSLPT;
 
 Scene* scene = nullptr;
 Renderer* renderer = nullptr;
+BvhTraversal* picker = nullptr; // Built on the first click after loading a scene or moving instances
 
 std::vector<string> sceneFiles;
 std::vector<string> envMaps;
@@ -62,8 +66,31 @@ int sampleSceneIdx = 0;
 int selectedInstance = 0;
 double lastTime = SDL_GetTicks();
 int envMapIdx = 0;
+int benchmarkSpp = 0;
+int benchmarkReferenceSpp = 0;
+int cpuSpp = 0;
+int sampleOffset = 0;
+std::vector<std::string> mergeFiles;
+bool rayBenchmark = false;
+bool selfTest = false;
+bool resumeRender = false;
 bool done = false;
 
+std::string checkpointFile = "./render.checkpoint";
+double lastCheckpointTime = SDL_GetTicks();
+
+ImVec2 clickPos;
+bool clickInView = false;
+bool drawingROI = false;
+RayHit pickHit = { 0.0f, 0.0f, 0.0f, -1, -1, -1 };
+Vec3 pickPoint;
+double pickMilliseconds = 0.0;
+bool scrollToSelected = false;
+
+ImGuiTextFilter instanceFilter;
+std::vector<int> filteredInstances;
+bool filterDirty = true;
+
 std::string shadersDir = "../src/shaders/";
 std::string assetsDir = "../assets/";
 std::string envMapDir = "../assets/HDR/";
@@ -76,6 +103,24 @@ struct LoopData
     SDL_GLContext mGLContext = nullptr;
 };
 
+// Render option sets that are compared against each other when running with --benchmark
+struct BenchmarkVariant
+{
+    std::string name;
+    void (*apply)(RenderOptions& options);
+};
+
+std::vector<BenchmarkVariant> benchmarkVariants =
+{
+    { "stack",      [](RenderOptions& options) { options.enableStacklessBVH = false; } },
+    { "stackless",  [](RenderOptions& options) { options.enableStacklessBVH = true; } },
+    { "treelet",    [](RenderOptions& options) { options.enableStacklessBVH = false; options.enableBVHTreeletLayout = true; } },
+    { "tribuffer",  [](RenderOptions& options) { options.enableStacklessBVH = false; options.enableTriangleBuffer = true; } },
+    { "signedaabb", [](RenderOptions& options) { options.enableStacklessBVH = false; options.enableSignedAABB = true; } },
+    { "lightbvh",   [](RenderOptions& options) { options.enableStacklessBVH = false; options.enableLightBVH = true; } },
+    { "sobol",      [](RenderOptions& options) { options.enableStacklessBVH = false; options.enableSobolSampler = true; } },
+};
+
 void GetSceneFiles()
 {
     tinydir_dir dir;
@@ -142,6 +187,11 @@ void LoadScene(std::string sceneName)
 
     //loadCornellTestScene(scene, renderOptions);
     selectedInstance = 0;
+    pickHit.triID = -1;
+    filterDirty = true;
+
+    delete picker;
+    picker = nullptr;
 
     // Add a default HDR if there are no lights in the scene
     if (!scene->envMap && !envMaps.empty())
@@ -158,6 +208,10 @@ bool InitRenderer()
 {
     delete renderer;
     renderer = new Renderer(scene, shadersDir);
+
+    size_t resident, peak;
+    GetMemoryUsage(resident, peak);
+    printf("Memory after upload: %.1f MB resident, %.1f MB peak\n", resident / (1024.0 * 1024.0), peak / (1024.0 * 1024.0));
     return true;
 }
 
@@ -172,6 +226,324 @@ void SaveFrame(const std::string filename)
     delete[] data;
 }
 
+// Renders the loaded scene on the CPU without opening a window and writes the image and a checkpoint. The samples are
+// added to those of the checkpoint with --resume and of the --merge checkpoints, e.g. from other machines
+void RenderOnCpu(int spp)
+{
+    CpuRenderer cpuRenderer(scene);
+    cpuRenderer.SetSampleOffset(sampleOffset);
+
+    if (resumeRender && !cpuRenderer.AddCheckpoint(checkpointFile))
+        return;
+    for (const std::string& mergeFile : mergeFiles)
+    {
+        if (!cpuRenderer.AddCheckpoint(mergeFile))
+            return;
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < spp; i++)
+    {
+        cpuRenderer.Render();
+        printf("\rSamples: %d/%d", i + 1, spp);
+        fflush(stdout);
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    printf("\nRendered %d spp in %.2f s\n", spp, seconds);
+
+    unsigned char* data = nullptr;
+    int w, h;
+    cpuRenderer.GetOutputBuffer(&data, w, h);
+    stbi_flip_vertically_on_write(true);
+    std::string filename = "./cpu_" + to_string(cpuRenderer.GetSampleCount()) + ".png";
+    stbi_write_png(filename.c_str(), w, h, 4, data, w * 4);
+    printf("Frame saved: %s\n", filename.c_str());
+    delete[] data;
+
+    if (cpuRenderer.SaveCheckpoint(checkpointFile))
+        printf("Checkpoint saved: %s\n", checkpointFile.c_str());
+}
+
+// Times each kind of ray query over the same rays and prints the rate in millions of rays per second
+void TimeRayQueries(const std::string& sceneFile, const char* rayType, const BvhTraversal& traversal, const std::vector<Vec3>& origins, const std::vector<Vec3>& directions)
+{
+    int numRays = (int)origins.size() / 8 * 8;
+    double seconds[4];
+    int hits = 0;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < numRays; i++)
+    {
+        RayHit hit;
+        hits += traversal.ClosestHit(origins[i], directions[i], FLT_MAX, hit) ? 1 : 0;
+    }
+    seconds[0] = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    int occluded = 0;
+    start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < numRays; i++)
+        occluded += traversal.AnyHit(origins[i], directions[i], FLT_MAX) ? 1 : 0;
+    seconds[1] = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    // Packets are filled from consecutive rays, so camera rays of neighbouring pixels go together
+    for (int anyHit = 0; anyHit < 2; anyHit++)
+    {
+        start = SDL_GetPerformanceCounter();
+        for (int i = 0; i < numRays; i += 8)
+        {
+            RayPacket8 packet;
+            for (int j = 0; j < 8; j++)
+            {
+                packet.ox[j] = origins[i + j].x; packet.oy[j] = origins[i + j].y; packet.oz[j] = origins[i + j].z;
+                packet.dx[j] = directions[i + j].x; packet.dy[j] = directions[i + j].y; packet.dz[j] = directions[i + j].z;
+                packet.tMax[j] = FLT_MAX;
+            }
+
+            RayHit packetHits[8];
+            bool packetOccluded[8];
+            if (anyHit)
+                traversal.AnyHit8(packet, packetOccluded);
+            else
+                traversal.ClosestHit8(packet, packetHits);
+        }
+        seconds[2 + anyHit] = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    }
+
+    if (occluded != hits)
+        printf("Closest and any hit queries disagree on %d rays\n", abs(occluded - hits));
+
+    printf("%-48s %-8s %8.1f %12.2f %12.2f %12.2f %12.2f\n", sceneFile.c_str(), rayType, 100.0 * hits / std::max(numRays, 1),
+        numRays / seconds[0] * 1e-6, numRays / seconds[1] * 1e-6, numRays / seconds[2] * 1e-6, numRays / seconds[3] * 1e-6);
+}
+
+// Measures the CPU ray queries on camera rays, and on diffuse bounces from where they hit which are far less coherent
+void RunRayBenchmark()
+{
+    printf("Ray queries using %s. Rates are in Mrays/s\n", BvhTraversal::GetSimdName());
+    printf("%-48s %-8s %8s %12s %12s %12s %12s\n", "Scene", "Rays", "Hit (%)", "Closest", "Any", "Closest x8", "Any x8");
+
+    for (int i = 0; i < sceneFiles.size(); i++)
+    {
+        LoadScene(sceneFiles[i]);
+        scene->ProcessScene();
+        BvhTraversal traversal(scene);
+
+        const Camera* camera = scene->camera;
+        iVec2 res = renderOptions.renderResolution;
+        float scale = tanf(camera->fov * 0.5f);
+
+        std::vector<Vec3> origins;
+        std::vector<Vec3> directions;
+        for (int y = 0; y < res.y; y++)
+        {
+            for (int x = 0; x < res.x; x++)
+            {
+                float dx = ((x + 0.5f) / res.x * 2.0f - 1.0f) * scale;
+                float dy = ((y + 0.5f) / res.y * 2.0f - 1.0f) * scale * res.y / res.x;
+                origins.push_back(camera->position);
+                directions.push_back(Vec3::Normalize(camera->right * dx + camera->up * dy + camera->forward));
+            }
+        }
+        TimeRayQueries(sceneFiles[i], "Camera", traversal, origins, directions);
+
+        // Bounce off every hit in a random direction on the side the camera ray came from
+        std::vector<Vec3> bounceOrigins;
+        std::vector<Vec3> bounceDirections;
+        for (int j = 0; j < origins.size(); j++)
+        {
+            RayHit hit;
+            if (!traversal.ClosestHit(origins[j], directions[j], FLT_MAX, hit))
+                continue;
+
+            float z = 1.0f - 2.0f * rand() / (float)RAND_MAX;
+            float phi = 2.0f * PI * rand() / (float)RAND_MAX;
+            float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+            Vec3 bounce(r * cosf(phi), r * sinf(phi), z);
+            if (Vec3::Dot(bounce, directions[j]) > 0.0f)
+                bounce = bounce * -1.0f;
+
+            bounceOrigins.push_back(origins[j] + directions[j] * (hit.t * 0.999f));
+            bounceDirections.push_back(bounce);
+        }
+        TimeRayQueries(sceneFiles[i], "Diffuse", traversal, bounceOrigins, bounceDirections);
+    }
+}
+
+// Probability that an alias table picks each of its entries: kept by its own slot or taken from the slots that alias it
+void AliasProbabilities(const AliasEntry* table, int count, std::vector<double>& probs)
+{
+    probs.assign(count, 0.0);
+    for (int i = 0; i < count; i++)
+    {
+        probs[i] += table[i].threshold / (double)count;
+        probs[table[i].alias] += (1.0 - table[i].threshold) / count;
+    }
+}
+
+// Builds the alias tables of a small synthetic environment map and checks that every cell is picked in proportion to
+// its weight and that the pdfs stored next to the entries agree with that. Returns the number of failed checks
+int RunSelfTest()
+{
+    int numChecks = 0;
+    int numFailures = 0;
+    auto check = [&numChecks, &numFailures](const char* what, int index, double expected, double actual) {
+        numChecks++;
+        if (fabs(expected - actual) <= 1e-6 + 1e-4 * fabs(expected))
+            return;
+        if (numFailures++ < 10)
+            printf("%s %d: expected %g, got %g\n", what, index, expected, actual);
+    };
+
+    // A smooth gradient with a bright spot, a black row and a black column, so there are zero weights, a row that
+    // is never picked and entries far above the average
+    EnvironmentMap envMap;
+    envMap.name = "selftest";
+    envMap.width = 64;
+    envMap.height = 32;
+    envMap.img = (float*)malloc(sizeof(float) * 3 * envMap.width * envMap.height);
+    for (int y = 0; y < envMap.height; y++)
+    {
+        for (int x = 0; x < envMap.width; x++)
+        {
+            float* pixel = &envMap.img[(y * envMap.width + x) * 3];
+            float value = (x == 40 || y == 5) ? 0.0f : 0.1f + 0.01f * x + 0.02f * y;
+            if (abs(x - 12) < 3 && abs(y - 20) < 2)
+                value = 500.0f;
+            pixel[0] = value;
+            pixel[1] = value * 0.5f;
+            pixel[2] = value * 0.25f;
+        }
+    }
+    envMap.BuildDistributions();
+
+    // The importance map matches the image here, so the weight of a cell is the luminance of its pixel times sin(theta)
+    int w = envMap.importanceWidth;
+    int h = envMap.importanceHeight;
+    std::vector<double> weights(w * h);
+    std::vector<double> rowSums(h, 0.0);
+    double sum = 0.0;
+    for (int v = 0; v < h; v++)
+    {
+        for (int u = 0; u < w; u++)
+        {
+            const float* pixel = &envMap.img[(v * w + u) * 3];
+            float lum = 0.212671f * pixel[0] + 0.715160f * pixel[1] + 0.072169f * pixel[2];
+            weights[v * w + u] = lum * sin(PI * (v + 0.5) / h);
+            rowSums[v] += weights[v * w + u];
+        }
+        sum += rowSums[v];
+    }
+
+    const AliasEntry* marginal = &envMap.aliasTable[w * h];
+    std::vector<double> rowProbs;
+    AliasProbabilities(marginal, h, rowProbs);
+    for (int v = 0; v < h; v++)
+    {
+        check("Row probability", v, rowSums[v] / sum, rowProbs[v]);
+        check("Row pdf", v, rowSums[v] / sum, marginal[v].pdf);
+        check("Row alias pdf", v, rowSums[marginal[v].alias] / sum, marginal[v].aliasPdf);
+    }
+
+    // Rows without weight fall back to picking every cell equally, which doesn't matter as they are never picked
+    std::vector<double> cellProbs;
+    for (int v = 0; v < h; v++)
+    {
+        const AliasEntry* row = &envMap.aliasTable[v * w];
+        AliasProbabilities(row, w, cellProbs);
+        for (int u = 0; u < w; u++)
+        {
+            int i = v * w + u;
+            check("Cell probability", i, rowSums[v] > 0.0 ? weights[i] / rowSums[v] : 1.0 / w, cellProbs[u]);
+            check("Cell pdf", i, weights[i] / sum * w * h, row[u].pdf);
+            check("Cell alias pdf", i, weights[v * w + row[u].alias] / sum * w * h, row[u].aliasPdf);
+            check("Cell joint pdf", i, cellProbs[u] * rowProbs[v] * w * h, row[u].pdf);
+        }
+    }
+
+    if (numFailures > 0)
+        printf("Self test failed: %d of %d checks\n", numFailures, numChecks);
+    else
+        printf("Self test passed: %d checks\n", numChecks);
+    return numFailures;
+}
+
+// Renders the scene with a benchmark variant applied until spp samples are accumulated. Returns the time taken for them
+double RenderBenchmarkVariant(const std::string& sceneFile, const BenchmarkVariant& variant, int spp, std::vector<unsigned char>& output)
+{
+    LoadScene(sceneFile);
+    variant.apply(renderOptions);
+    renderOptions.maxSpp = -1;
+    scene->renderOptions = renderOptions;
+    InitRenderer();
+
+    // Textures stream in while rendering, so wait for all of them to keep the timed frames identical between variants
+    scene->WaitForTextures();
+
+    // The first frame only renders the low res preview and compiles shaders, so it is not timed
+    renderer->Update(0.0f);
+    renderer->Render();
+    glFinish();
+
+    // Update moves on to the next pass and shows the finished one when the last tile of a pass is done, so stopping
+    // there times exactly spp passes without a tile of the next one
+    Uint64 start = SDL_GetPerformanceCounter();
+    while (true)
+    {
+        SDL_PumpEvents();
+        renderer->Update(0.0f);
+        if (renderer->GetSampleCount() > spp)
+            break;
+        renderer->Render();
+    }
+    glFinish();
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    unsigned char* data = nullptr;
+    int w, h;
+    renderer->GetOutputBuffer(&data, w, h);
+    output.assign(data, data + w * h * 4);
+    delete[] data;
+
+    return seconds;
+}
+
+void RunBenchmark()
+{
+    printf("%-48s %-12s %10s %12s %10s %10s %10s\n", "Scene", "Variant", "Time (s)", "Msamples/s", "RMSE", "RSS (MB)", "Peak (MB)");
+
+    for (size_t i = 0; i < sceneFiles.size(); i++)
+    {
+        // Variants are compared against the output of the first one so changes to the image are caught.
+        // With --reference the first variant is rendered to that many samples instead, so the error of each variant at equal spp can be compared
+        std::vector<unsigned char> reference;
+        if (benchmarkReferenceSpp > 0)
+            RenderBenchmarkVariant(sceneFiles[i], benchmarkVariants[0], benchmarkReferenceSpp, reference);
+
+        for (size_t j = 0; j < benchmarkVariants.size(); j++)
+        {
+            std::vector<unsigned char> output;
+            double seconds = RenderBenchmarkVariant(sceneFiles[i], benchmarkVariants[j], benchmarkSpp, output);
+            if (reference.empty())
+                reference = output;
+
+            double sqError = 0.0;
+            for (size_t k = 0; k < output.size(); k++)
+            {
+                double diff = (double)output[k] - reference[k];
+                sqError += diff * diff;
+            }
+
+            // Resident memory once loading has settled. The peak covers every variant run so far
+            size_t resident, peak;
+            GetMemoryUsage(resident, peak);
+
+            double samples = (double)renderOptions.renderResolution.x * renderOptions.renderResolution.y * benchmarkSpp;
+            printf("%-48s %-12s %10.3f %12.3f %10.4f %10.1f %10.1f\n", sceneFiles[i].c_str(), benchmarkVariants[j].name.c_str(), seconds, samples / seconds * 1e-6, sqrt(sqError / output.size()),
+                resident / (1024.0 * 1024.0), peak / (1024.0 * 1024.0));
+        }
+    }
+}
+
 void Render()
 {
     renderer->Render();
@@ -182,11 +554,88 @@ void Render()
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+// Selects the instance under the mouse by casting a camera ray on the CPU
+void PickInstance(float mouseX, float mouseY)
+{
+    if (!picker)
+    {
+        // Mesh data may have been freed after upload. The traversal keeps its own copy of the triangles
+        bool reloaded = scene->vertIndices.empty();
+        if (reloaded && !scene->LoadMeshData())
+            return;
+
+        picker = new BvhTraversal(scene);
+
+        if (reloaded)
+            scene->ReleaseCPUData();
+    }
+
+    // The image is stretched over the window, so the ray is placed relative to the window and shaped by the render size
+    ImGuiIO& io = ImGui::GetIO();
+    const Camera* camera = scene->camera;
+    float scale = tanf(camera->fov * 0.5f);
+    float dx = (mouseX / io.DisplaySize.x * 2.0f - 1.0f) * scale;
+    float dy = (1.0f - mouseY / io.DisplaySize.y * 2.0f) * scale * renderOptions.renderResolution.y / renderOptions.renderResolution.x;
+    Vec3 direction = Vec3::Normalize(camera->right * dx + camera->up * dy + camera->forward);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (picker->ClosestHit(camera->position, direction, FLT_MAX, pickHit))
+    {
+        pickPoint = camera->position + direction * pickHit.t;
+        selectedInstance = pickHit.instanceID;
+        scrollToSelected = true;
+    }
+
+    pickMilliseconds = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
 void Update(float secondsElapsed)
 {
     keyPressed = false;
 
-    if (!ImGui::IsWindowFocused(ImGuiFocusedFlags_AnyWindow) && ImGui::IsAnyMouseDown() && !ImGuizmo::IsOver())
+    // A click that doesn't drag the camera around picks an instance. With SHIFT held a drag draws the region of interest
+    ImGuiIO& io = ImGui::GetIO();
+    if (ImGui::IsMouseClicked(0))
+    {
+        bool inView = !io.WantCaptureMouse && !ImGuizmo::IsOver();
+        clickPos = io.MousePos;
+        clickInView = inView && !io.KeyShift;
+        drawingROI = inView && io.KeyShift;
+    }
+
+    // The region is kept in [0, 1] so it doesn't depend on the window size
+    ImVec2 displaySize = io.DisplaySize;
+    if (drawingROI)
+    {
+        renderOptions.enableROI = true;
+        renderOptions.roi.x = Math::Clamp(std::min(clickPos.x, io.MousePos.x) / displaySize.x, 0.0f, 1.0f);
+        renderOptions.roi.y = Math::Clamp(std::min(clickPos.y, io.MousePos.y) / displaySize.y, 0.0f, 1.0f);
+        renderOptions.roi.z = Math::Clamp(std::max(clickPos.x, io.MousePos.x) / displaySize.x, 0.0f, 1.0f);
+        renderOptions.roi.w = Math::Clamp(std::max(clickPos.y, io.MousePos.y) / displaySize.y, 0.0f, 1.0f);
+
+        if (!ImGui::IsMouseDown(0))
+            drawingROI = false;
+    }
+    else if (renderOptions.enableROI && renderOptions.roiFollowMouse && !io.WantCaptureMouse)
+    {
+        // Center the region on the mouse and keep its size
+        float halfWidth = (renderOptions.roi.z - renderOptions.roi.x) * 0.5f;
+        float halfHeight = (renderOptions.roi.w - renderOptions.roi.y) * 0.5f;
+        float centerX = Math::Clamp(io.MousePos.x / displaySize.x, halfWidth, 1.0f - halfWidth);
+        float centerY = Math::Clamp(io.MousePos.y / displaySize.y, halfHeight, 1.0f - halfHeight);
+        renderOptions.roi = Vec4(centerX - halfWidth, centerY - halfHeight, centerX + halfWidth, centerY + halfHeight);
+    }
+
+    if (ImGui::IsMouseReleased(0) && clickInView)
+    {
+        float dx = io.MousePos.x - clickPos.x;
+        float dy = io.MousePos.y - clickPos.y;
+        if (dx * dx + dy * dy < 9.0f)
+            PickInstance(io.MousePos.x, io.MousePos.y);
+        clickInView = false;
+    }
+
+    if (!ImGui::IsWindowFocused(ImGuiFocusedFlags_AnyWindow) && ImGui::IsAnyMouseDown() && !ImGuizmo::IsOver() && !drawingROI)
     {
         if (ImGui::IsMouseDown(0))
         {
@@ -303,7 +752,12 @@ void MainLoop(void* arg)
 
         ImGui::Text("Samples: %d ", renderer->GetSampleCount());
 
+        size_t residentMemory, peakMemory;
+        GetMemoryUsage(residentMemory, peakMemory);
+        ImGui::Text("Memory: %.0f MB (peak %.0f MB)", residentMemory / (1024.0 * 1024.0), peakMemory / (1024.0 * 1024.0));
+
         ImGui::BulletText("LMB + drag to rotate");
+        ImGui::BulletText("LMB click to select an object");
         ImGui::BulletText("MMB + drag to pan");
         ImGui::BulletText("RMB + drag to zoom in/out");
         ImGui::BulletText("CTRL + click on a slider to edit its value");
@@ -345,12 +799,19 @@ void MainLoop(void* arg)
         {
             optionsChanged |= ImGui::SliderInt("Max Spp", &renderOptions.maxSpp, -1, 256);
             optionsChanged |= ImGui::SliderInt("Max Depth", &renderOptions.maxDepth, 1, 10);
+            optionsChanged |= ImGui::SliderInt("Preview Max Depth", &renderOptions.previewMaxDepth, 1, 10);
 
             reloadShaders |= ImGui::Checkbox("Enable Russian Roulette", &renderOptions.enableRR);
             reloadShaders |= ImGui::SliderInt("Russian Roulette Depth", &renderOptions.RRDepth, 1, 10);
             reloadShaders |= ImGui::Checkbox("Enable Roughness Mollification", &renderOptions.enableRoughnessMollification);
             optionsChanged |= ImGui::SliderFloat("Roughness Mollification Amount", &renderOptions.roughnessMollificationAmt, 0, 1);
             reloadShaders |= ImGui::Checkbox("Enable Volume MIS", &renderOptions.enableVolumeMIS);
+            reloadShaders |= ImGui::Checkbox("Enable Stackless BVH", &renderOptions.enableStacklessBVH);
+            reloadShaders |= ImGui::Checkbox("Enable Signed AABB Test", &renderOptions.enableSignedAABB);
+            reloadShaders |= ImGui::Checkbox("Enable Sobol Sampler", &renderOptions.enableSobolSampler);
+            reloadShaders |= ImGui::Checkbox("Enable Blue Noise", &renderOptions.enableBlueNoise);
+            reloadShaders |= ImGui::Checkbox("Enable Temporal Reprojection", &renderOptions.enableTemporalReprojection);
+            ImGui::SliderInt("Checkpoint Interval (s)", &renderOptions.checkpointInterval, 0, 600);
         }
 
         if (ImGui::CollapsingHeader("Environment"))
@@ -389,6 +850,24 @@ void MainLoop(void* arg)
             ImGui::SliderInt("Number of Frames to skip", &renderOptions.denoiserFrameCnt, 5, 50);
         }
 
+        if (ImGui::CollapsingHeader("Region of Interest"))
+        {
+            // The accumulation carries on when the region changes, so these don't restart the render
+            ImGui::Checkbox("Enable ROI", &renderOptions.enableROI);
+            ImGui::SliderInt("Region Passes Per Outside Pass", &renderOptions.roiSampleRatio, 0, 16);
+            ImGui::Checkbox("Follow Mouse", &renderOptions.roiFollowMouse);
+            ImGui::BulletText("SHIFT + LMB drag to draw the region");
+            ImGui::BulletText("0 passes freezes the tiles outside the region");
+        }
+
+        if (renderOptions.enableROI)
+        {
+            ImVec2 displaySize = ImGui::GetIO().DisplaySize;
+            ImVec2 roiMin(renderOptions.roi.x * displaySize.x, renderOptions.roi.y * displaySize.y);
+            ImVec2 roiMax(renderOptions.roi.z * displaySize.x, renderOptions.roi.w * displaySize.y);
+            ImGui::GetOverlayDrawList()->AddRect(roiMin, roiMax, IM_COL32(255, 200, 0, 255));
+        }
+
         if (ImGui::CollapsingHeader("Camera"))
         {
             float fov = Math::Degrees(scene->camera->fov);
@@ -401,27 +880,59 @@ void MainLoop(void* arg)
             ImGui::Text("Pos: %.2f, %.2f, %.2f", scene->camera->position.x, scene->camera->position.y, scene->camera->position.z);
         }
 
+        if (scrollToSelected)
+            ImGui::SetNextTreeNodeOpen(true);
+
         if (ImGui::CollapsingHeader("Objects"))
         {
             bool objectPropChanged = false;
 
-            std::vector<std::string> listboxItems;
-            for (int i = 0; i < scene->meshInstances.size(); i++)
+            // Object Selection. The filtered list is only rebuilt when the filter changes and only the visible rows
+            // are submitted, so large scenes don't slow down the UI
+            filterDirty |= instanceFilter.Draw("Filter");
+            if (filterDirty)
             {
-                listboxItems.push_back(scene->meshInstances[i].name);
+                filteredInstances.clear();
+                for (int i = 0; i < scene->meshInstances.size(); i++)
+                {
+                    if (instanceFilter.PassFilter(scene->meshInstances[i].name.c_str()))
+                        filteredInstances.push_back(i);
+                }
+                filterDirty = false;
             }
 
-            // Object Selection
-            ImGui::ListBoxHeader("Instances");
-            for (int i = 0; i < scene->meshInstances.size(); i++)
+            if (ImGui::ListBoxHeader("Instances"))
             {
-                bool is_selected = selectedInstance == i;
-                if (ImGui::Selectable(listboxItems[i].c_str(), is_selected))
+                float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+                ImGuiListClipper clipper(filteredInstances.size(), rowHeight);
+                while (clipper.Step())
+                {
+                    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+                    {
+                        int instance = filteredInstances[i];
+                        ImGui::PushID(instance);
+                        if (ImGui::Selectable(scene->meshInstances[instance].name.c_str(), selectedInstance == instance))
+                        {
+                            selectedInstance = instance;
+                        }
+                        ImGui::PopID();
+                    }
+                }
+
+                if (scrollToSelected)
                 {
-                    selectedInstance = i;
+                    auto row = std::lower_bound(filteredInstances.begin(), filteredInstances.end(), selectedInstance);
+                    if (row != filteredInstances.end() && *row == selectedInstance)
+                        ImGui::SetScrollY((row - filteredInstances.begin()) * rowHeight);
+                    scrollToSelected = false;
                 }
+
+                ImGui::ListBoxFooter();
             }
-            ImGui::ListBoxFooter();
+
+            ImGui::Text("%d of %d instances", (int)filteredInstances.size(), (int)scene->meshInstances.size());
+            if (pickHit.triID >= 0)
+                ImGui::Text("Picked triangle %d at (%.2f, %.2f, %.2f) in %.3f ms", pickHit.triID, pickPoint.x, pickPoint.y, pickPoint.z, pickMilliseconds);
 
             ImGui::Separator();
             ImGui::Text("Materials");
@@ -498,7 +1009,11 @@ void MainLoop(void* arg)
             }
 
             if (objectPropChanged)
+            {
                 scene->RebuildInstances();
+                delete picker;
+                picker = nullptr;
+            }
         }
 
         scene->renderOptions = renderOptions;
@@ -525,6 +1040,13 @@ void MainLoop(void* arg)
     glDisable(GL_DEPTH_TEST);
     Render();
     SDL_GL_SwapWindow(loopdata.mWindow);
+
+    // Long renders are saved every so often so they can be continued with --resume
+    if (renderOptions.checkpointInterval > 0 && presentTime - lastCheckpointTime >= renderOptions.checkpointInterval * 1000.0)
+    {
+        if (renderer->SaveCheckpoint(checkpointFile))
+            lastCheckpointTime = presentTime;
+    }
 }
 
 int main(int argc, char** argv)
@@ -540,6 +1062,42 @@ int main(int argc, char** argv)
         {
             sceneFile = argv[++i];
         }
+        else if (arg == "-b" || arg == "--benchmark")
+        {
+            benchmarkSpp = atoi(argv[++i]);
+        }
+        else if (arg == "-r" || arg == "--reference")
+        {
+            benchmarkReferenceSpp = atoi(argv[++i]);
+        }
+        else if (arg == "-c" || arg == "--cpu")
+        {
+            cpuSpp = atoi(argv[++i]);
+        }
+        else if (arg == "--sampleoffset")
+        {
+            sampleOffset = atoi(argv[++i]);
+        }
+        else if (arg == "--merge")
+        {
+            mergeFiles.push_back(argv[++i]);
+        }
+        else if (arg == "--raybench")
+        {
+            rayBenchmark = true;
+        }
+        else if (arg == "--selftest")
+        {
+            selfTest = true;
+        }
+        else if (arg == "--checkpoint")
+        {
+            checkpointFile = argv[++i];
+        }
+        else if (arg == "--resume")
+        {
+            resumeRender = true;
+        }
         else if (arg[0] == '-')
         {
             printf("Unknown option %s \n'", arg.c_str());
@@ -547,11 +1105,15 @@ int main(int argc, char** argv)
         }
     }
 
+    if (selfTest)
+        return RunSelfTest() > 0 ? 1 : 0;
+
     if (!sceneFile.empty())
     {
         scene = new Scene();
         GetEnvMaps();
         LoadScene(sceneFile);
+        sceneFiles.push_back(sceneFile);
     }
     else
     {
@@ -560,6 +1122,20 @@ int main(int argc, char** argv)
         LoadScene(sceneFiles[sampleSceneIdx]);
     }
 
+    if (rayBenchmark)
+    {
+        RunRayBenchmark();
+        delete scene;
+        return 0;
+    }
+
+    if (cpuSpp > 0 || !mergeFiles.empty())
+    {
+        RenderOnCpu(cpuSpp);
+        delete scene;
+        return 0;
+    }
+
     // Setup SDL
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) != 0)
     {
@@ -633,11 +1209,24 @@ int main(int argc, char** argv)
     if (!InitRenderer())
         return 1;
 
-    while (!done)
+    if (benchmarkSpp > 0)
+        RunBenchmark();
+    else
     {
-        MainLoop(&loopdata);
+        if (resumeRender)
+            renderer->LoadCheckpoint(checkpointFile);
+
+        while (!done)
+        {
+            MainLoop(&loopdata);
+        }
+
+        // Keep the samples rendered since the last checkpoint
+        if (renderOptions.checkpointInterval > 0)
+            renderer->SaveCheckpoint(checkpointFile);
     }
 
+    delete picker;
     delete renderer;
     delete scene;
 
@@ -0,0 +1,75 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <vector>
+#include "AliasTable.h"
+
+namespace GLSLPT
+{
+    // Vose's alias method. Every entry gets one slot holding an equal share of the total weight,
+    // slots with less than their share are topped up by an entry with more
+    void BuildAliasTable(const double* weights, int count, AliasEntry* table)
+    {
+        double sum = 0.0;
+        for (int i = 0; i < count; i++)
+            sum += weights[i];
+
+        // Scale weights so the average is one
+        std::vector<double> scaled(count);
+        for (int i = 0; i < count; i++)
+            scaled[i] = sum > 0.0 ? weights[i] * count / sum : 1.0;
+
+        std::vector<int> small, large;
+        for (int i = 0; i < count; i++)
+        {
+            if (scaled[i] < 1.0)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+
+        while (!small.empty() && !large.empty())
+        {
+            int s = small.back();
+            int l = large.back();
+            small.pop_back();
+
+            table[s].threshold = (float)scaled[s];
+            table[s].alias = l;
+
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        // Whatever is left is within rounding error of one
+        for (int i : large)
+            table[i] = { 1.0f, i, 0.0f, 0.0f };
+        for (int i : small)
+            table[i] = { 1.0f, i, 0.0f, 0.0f };
+    }
+}
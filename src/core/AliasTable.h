@@ -0,0 +1,43 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+namespace GLSLPT
+{
+    // Alias table entry. The entry is kept with probability threshold, otherwise alias is used.
+    // pdf and aliasPdf are filled in by the owner of the table, so the shader gets the probability of the
+    // chosen entry from the same fetch
+    struct AliasEntry
+    {
+        float threshold;
+        int alias;
+        float pdf;
+        float aliasPdf;
+    };
+
+    // Builds an alias table for sampling count entries in proportion to weights.
+    // If all weights are zero every entry is equally likely
+    void BuildAliasTable(const double* weights, int count, AliasEntry* table);
+}
@@ -0,0 +1,142 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "BlueNoise.h"
+
+namespace GLSLPT
+{
+    // Binary pattern with a gaussian energy field that wraps around the edges of the mask.
+    // Clusters are the set texels with the most energy, voids the empty texels with the least
+    struct VoidAndCluster
+    {
+        int size;
+        std::vector<float> kernel; // Energy a set texel adds at each wrapped offset
+        std::vector<float> energy;
+        std::vector<bool> pattern;
+
+        VoidAndCluster(int size)
+            : size(size), kernel(size * size), energy(size * size, 0.0f), pattern(size * size, false)
+        {
+            const float sigma = 1.5f;
+            for (int y = 0; y < size; y++)
+            {
+                for (int x = 0; x < size; x++)
+                {
+                    int dx = std::min(x, size - x);
+                    int dy = std::min(y, size - y);
+                    kernel[y * size + x] = expf(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+                }
+            }
+        }
+
+        void Set(int index, bool value)
+        {
+            pattern[index] = value;
+            float sign = value ? 1.0f : -1.0f;
+            int px = index % size, py = index / size;
+            for (int y = 0; y < size; y++)
+            {
+                int ky = ((y - py) & (size - 1)) * size;
+                for (int x = 0; x < size; x++)
+                    energy[y * size + x] += sign * kernel[ky + ((x - px) & (size - 1))];
+            }
+        }
+
+        int TightestCluster() const
+        {
+            int best = -1;
+            for (int i = 0; i < size * size; i++)
+                if (pattern[i] && (best < 0 || energy[i] > energy[best]))
+                    best = i;
+            return best;
+        }
+
+        int LargestVoid() const
+        {
+            int best = -1;
+            for (int i = 0; i < size * size; i++)
+                if (!pattern[i] && (best < 0 || energy[i] < energy[best]))
+                    best = i;
+            return best;
+        }
+    };
+
+    void BuildBlueNoise(int size, std::vector<float>& mask)
+    {
+        int count = size * size;
+        std::vector<int> rank(count);
+
+        // Initial pattern of randomly placed texels from a fixed seed, so the mask is the same on every run
+        VoidAndCluster initial(size);
+        uint32_t state = 1;
+        int ones = count / 10;
+        for (int placed = 0; placed < ones;)
+        {
+            state = state * 1664525u + 1013904223u;
+            int index = (state >> 8) % count;
+            if (!initial.pattern[index])
+            {
+                initial.Set(index, true);
+                placed++;
+            }
+        }
+
+        // Move texels from the tightest cluster to the largest void until that leaves the pattern unchanged
+        while (true)
+        {
+            int cluster = initial.TightestCluster();
+            initial.Set(cluster, false);
+            int hole = initial.LargestVoid();
+            initial.Set(hole, true);
+            if (hole == cluster)
+                break;
+        }
+
+        // Rank the initial texels by removing the tightest cluster one at a time
+        VoidAndCluster vc = initial;
+        for (int i = ones - 1; i >= 0; i--)
+        {
+            int cluster = vc.TightestCluster();
+            vc.Set(cluster, false);
+            rank[cluster] = i;
+        }
+
+        // Rank the rest by filling the largest void one at a time
+        vc = initial;
+        for (int i = ones; i < count; i++)
+        {
+            int hole = vc.LargestVoid();
+            vc.Set(hole, true);
+            rank[hole] = i;
+        }
+
+        mask.resize(count);
+        for (int i = 0; i < count; i++)
+            mask[i] = (rank[i] + 0.5f) / count;
+    }
+}
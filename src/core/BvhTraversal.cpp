@@ -0,0 +1,757 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cfloat>
+#include "BvhTraversal.h"
+#include "Scene.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BVH_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVH_SSE2
+#endif
+
+namespace GLSLPT
+{
+    // Each level of the tree pushes at most seven more entries than it pops, and the binary trees are no deeper than 64
+    const int TRAVERSAL_STACK_SIZE = 512;
+
+    // Subtrees with this many triangles or fewer become a leaf
+    const int MAX_LEAF_TRIANGLES = 4;
+
+    struct BvhTraversal::TraversalRay
+    {
+        Vec3 origin;
+        Vec3 direction;
+        Vec3 invDirection;
+        bool negX, negY, negZ;
+    };
+
+#ifdef BVH_AVX2
+    struct BvhTraversal::TraversalPacket
+    {
+        __m256 ox, oy, oz;
+        __m256 dx, dy, dz;
+        __m256 ix, iy, iz;
+    };
+#endif
+
+    namespace
+    {
+        struct StackEntry
+        {
+            int child;
+            int type;
+            float t;
+        };
+
+        // Inserts an entry among the ones pushed since first, keeping them sorted far to near so the nearest is popped next
+        inline void PushSorted(StackEntry* stack, int first, int& ptr, const StackEntry& entry)
+        {
+            int i = ptr++;
+            while (i > first && stack[i - 1].t < entry.t)
+            {
+                stack[i] = stack[i - 1];
+                i--;
+            }
+            stack[i] = entry;
+        }
+    }
+
+    BvhTraversal::BvhTraversal(const Scene* scene) : scene(scene), root(-1)
+    {
+        Build();
+    }
+
+    const char* BvhTraversal::GetSimdName()
+    {
+#if defined(BVH_AVX2)
+        return "AVX2";
+#elif defined(BVH_SSE2)
+        return "SSE2";
+#else
+        return "Scalar";
+#endif
+    }
+
+    void BvhTraversal::Build()
+    {
+        const std::vector<RadeonRays::BvhTranslator::Node>& binaryNodes = scene->bvhTranslator.nodes;
+
+        nodes.clear();
+        triangleGroups.clear();
+        instances.assign(scene->transforms.size(), Instance{ -1, 0 });
+
+        invTransforms.clear();
+        for (const Mat4& transform : scene->transforms)
+            invTransforms.push_back(Mat4::Inverse(transform));
+
+        triangleCounts.assign(binaryNodes.size(), -1);
+        blasRoots.assign(binaryNodes.size(), -1);
+
+        root = binaryNodes.empty() ? -1 : CollapseNode(scene->bvhTranslator.topLevelIndex, true);
+
+        std::vector<int>().swap(triangleCounts);
+        std::vector<int>().swap(blasRoots);
+    }
+
+    int BvhTraversal::CountTriangles(int binaryNode)
+    {
+        if (triangleCounts[binaryNode] == -1)
+        {
+            const RadeonRays::BvhTranslator::Node& node = scene->bvhTranslator.nodes[binaryNode];
+            if ((int)node.LRLeaf.z > 0)
+                triangleCounts[binaryNode] = (int)node.LRLeaf.y;
+            else
+                triangleCounts[binaryNode] = CountTriangles((int)node.LRLeaf.x) + CountTriangles((int)node.LRLeaf.y);
+        }
+        return triangleCounts[binaryNode];
+    }
+
+    void BvhTraversal::GatherTriangles(int binaryNode, std::vector<int>& triangles)
+    {
+        const RadeonRays::BvhTranslator::Node& node = scene->bvhTranslator.nodes[binaryNode];
+        if ((int)node.LRLeaf.z > 0)
+        {
+            for (int i = 0; i < (int)node.LRLeaf.y; i++)
+                triangles.push_back((int)node.LRLeaf.x + i);
+        }
+        else
+        {
+            GatherTriangles((int)node.LRLeaf.x, triangles);
+            GatherTriangles((int)node.LRLeaf.y, triangles);
+        }
+    }
+
+    int BvhTraversal::AddTriangleGroup(int binaryNode)
+    {
+        std::vector<int> triangles;
+        GatherTriangles(binaryNode, triangles);
+
+        TriangleGroup group;
+        for (int i = 0; i < 4; i++)
+        {
+            int triID = triangles[std::min(i, (int)triangles.size() - 1)];
+            const Indices& tri = scene->vertIndices[triID];
+            Vec3 v0 = Vec3(scene->verticesUVX[tri.x]);
+            Vec3 e0 = Vec3(scene->verticesUVX[tri.y]) - v0;
+            Vec3 e1 = Vec3(scene->verticesUVX[tri.z]) - v0;
+
+            group.v0x[i] = v0.x; group.v0y[i] = v0.y; group.v0z[i] = v0.z;
+            group.e0x[i] = e0.x; group.e0y[i] = e0.y; group.e0z[i] = e0.z;
+            group.e1x[i] = e1.x; group.e1y[i] = e1.y; group.e1z[i] = e1.z;
+            group.triID[i] = triID;
+        }
+
+        triangleGroups.push_back(group);
+        return (int)triangleGroups.size() - 1;
+    }
+
+    int BvhTraversal::CollapseNode(int binaryNode, bool topLevel)
+    {
+        const std::vector<RadeonRays::BvhTranslator::Node>& binaryNodes = scene->bvhTranslator.nodes;
+
+        // Interior nodes are opened up unless the triangles below them fit in a leaf
+        auto isOpenable = [&](int n)
+        {
+            return (int)binaryNodes[n].LRLeaf.z == 0 && (topLevel || CountTriangles(n) > MAX_LEAF_TRIANGLES);
+        };
+
+        int children[8];
+        int numChildren = 0;
+        children[numChildren++] = binaryNode;
+
+        // Open up the child with the largest surface area until every slot is used, as it's the one most likely to be hit
+        while (numChildren < 8)
+        {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < numChildren; i++)
+            {
+                if (!isOpenable(children[i]))
+                    continue;
+
+                Vec3 extent = binaryNodes[children[i]].bboxmax - binaryNodes[children[i]].bboxmin;
+                float area = extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+                if (area > bestArea)
+                {
+                    best = i;
+                    bestArea = area;
+                }
+            }
+
+            if (best == -1)
+                break;
+
+            const RadeonRays::BvhTranslator::Node& opened = binaryNodes[children[best]];
+            children[best] = (int)opened.LRLeaf.x;
+            children[numChildren++] = (int)opened.LRLeaf.y;
+        }
+
+        Node node;
+        for (int i = 0; i < 8; i++)
+        {
+            // Empty slots have inverted bounds that no ray hits
+            node.minX[i] = node.minY[i] = node.minZ[i] = FLT_MAX;
+            node.maxX[i] = node.maxY[i] = node.maxZ[i] = -FLT_MAX;
+            node.child[i] = -1;
+            node.type[i] = ChildEmpty;
+        }
+
+        int numUsed = 0;
+        for (int i = 0; i < numChildren; i++)
+        {
+            const RadeonRays::BvhTranslator::Node& child = binaryNodes[children[i]];
+            int leaf = (int)child.LRLeaf.z;
+            int slot = numUsed;
+
+            if (leaf < 0)
+            {
+                int instanceID = -leaf - 1;
+                int blas = (int)child.LRLeaf.x;
+                if (blasRoots[blas] == -1)
+                    blasRoots[blas] = CollapseNode(blas, false);
+
+                instances[instanceID].root = blasRoots[blas];
+                instances[instanceID].matID = (int)child.LRLeaf.y;
+                node.child[slot] = instanceID;
+                node.type[slot] = ChildInstance;
+            }
+            else if (isOpenable(children[i]))
+            {
+                node.child[slot] = CollapseNode(children[i], topLevel);
+                node.type[slot] = ChildNode;
+            }
+            else if (topLevel || CountTriangles(children[i]) == 0)
+            {
+                continue;
+            }
+            else
+            {
+                node.child[slot] = AddTriangleGroup(children[i]);
+                node.type[slot] = ChildTriangles;
+            }
+
+            node.minX[slot] = child.bboxmin.x; node.minY[slot] = child.bboxmin.y; node.minZ[slot] = child.bboxmin.z;
+            node.maxX[slot] = child.bboxmax.x; node.maxY[slot] = child.bboxmax.y; node.maxZ[slot] = child.bboxmax.z;
+            numUsed++;
+        }
+
+        nodes.push_back(node);
+        return (int)nodes.size() - 1;
+    }
+
+    BvhTraversal::TraversalRay BvhTraversal::MakeRay(const Vec3& origin, const Vec3& direction)
+    {
+        TraversalRay ray;
+        ray.origin = origin;
+        ray.direction = direction;
+        ray.invDirection = Vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        ray.negX = ray.invDirection.x < 0.0f;
+        ray.negY = ray.invDirection.y < 0.0f;
+        ray.negZ = ray.invDirection.z < 0.0f;
+        return ray;
+    }
+
+    // Slab test of all eight children. The near and far planes are picked by the sign of the direction, so empty slots
+    // with inverted bounds always miss
+    int BvhTraversal::IntersectChildren(const Node& node, const TraversalRay& ray, float tMax, float tNear[8])
+    {
+        const float* nearX = ray.negX ? node.maxX : node.minX;
+        const float* nearY = ray.negY ? node.maxY : node.minY;
+        const float* nearZ = ray.negZ ? node.maxZ : node.minZ;
+        const float* farX = ray.negX ? node.minX : node.maxX;
+        const float* farY = ray.negY ? node.minY : node.maxY;
+        const float* farZ = ray.negZ ? node.minZ : node.maxZ;
+
+#if defined(BVH_AVX2)
+        __m256 ox = _mm256_set1_ps(ray.origin.x);
+        __m256 oy = _mm256_set1_ps(ray.origin.y);
+        __m256 oz = _mm256_set1_ps(ray.origin.z);
+        __m256 ix = _mm256_set1_ps(ray.invDirection.x);
+        __m256 iy = _mm256_set1_ps(ray.invDirection.y);
+        __m256 iz = _mm256_set1_ps(ray.invDirection.z);
+
+        __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearX), ox), ix);
+        __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearY), oy), iy);
+        __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearZ), oz), iz);
+        __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farX), ox), ix);
+        __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farY), oy), iy);
+        __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farZ), oz), iz);
+
+        __m256 t0 = _mm256_max_ps(_mm256_max_ps(t0x, t0y), _mm256_max_ps(t0z, _mm256_setzero_ps()));
+        __m256 t1 = _mm256_min_ps(_mm256_min_ps(t1x, t1y), _mm256_min_ps(t1z, _mm256_set1_ps(tMax)));
+
+        _mm256_storeu_ps(tNear, t0);
+        return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+#elif defined(BVH_SSE2)
+        __m128 ox = _mm_set1_ps(ray.origin.x);
+        __m128 oy = _mm_set1_ps(ray.origin.y);
+        __m128 oz = _mm_set1_ps(ray.origin.z);
+        __m128 ix = _mm_set1_ps(ray.invDirection.x);
+        __m128 iy = _mm_set1_ps(ray.invDirection.y);
+        __m128 iz = _mm_set1_ps(ray.invDirection.z);
+        __m128 zero = _mm_setzero_ps();
+        __m128 tMaxV = _mm_set1_ps(tMax);
+
+        int mask = 0;
+        for (int i = 0; i < 8; i += 4)
+        {
+            __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearX + i), ox), ix);
+            __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearY + i), oy), iy);
+            __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearZ + i), oz), iz);
+            __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farX + i), ox), ix);
+            __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farY + i), oy), iy);
+            __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farZ + i), oz), iz);
+
+            __m128 t0 = _mm_max_ps(_mm_max_ps(t0x, t0y), _mm_max_ps(t0z, zero));
+            __m128 t1 = _mm_min_ps(_mm_min_ps(t1x, t1y), _mm_min_ps(t1z, tMaxV));
+
+            _mm_storeu_ps(tNear + i, t0);
+            mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << i;
+        }
+        return mask;
+#else
+        int mask = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            float t0 = std::max(std::max((nearX[i] - ray.origin.x) * ray.invDirection.x, (nearY[i] - ray.origin.y) * ray.invDirection.y),
+                                std::max((nearZ[i] - ray.origin.z) * ray.invDirection.z, 0.0f));
+            float t1 = std::min(std::min((farX[i] - ray.origin.x) * ray.invDirection.x, (farY[i] - ray.origin.y) * ray.invDirection.y),
+                                std::min((farZ[i] - ray.origin.z) * ray.invDirection.z, tMax));
+            tNear[i] = t0;
+            if (t0 <= t1)
+                mask |= 1 << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Same test as in the shaders, for the four triangles of a leaf at once
+    template <bool anyHit>
+    bool BvhTraversal::IntersectTriangles(const TriangleGroup& group, const TraversalRay& ray, float& tMax, RayHit& hit, int instanceID, int matID, const HitFilter& filter) const
+    {
+        float u[4], v[4], t[4];
+        int mask = 0;
+
+#if defined(BVH_SSE2)
+        __m128 dx = _mm_set1_ps(ray.direction.x);
+        __m128 dy = _mm_set1_ps(ray.direction.y);
+        __m128 dz = _mm_set1_ps(ray.direction.z);
+
+        __m128 e0x = _mm_loadu_ps(group.e0x);
+        __m128 e0y = _mm_loadu_ps(group.e0y);
+        __m128 e0z = _mm_loadu_ps(group.e0z);
+        __m128 e1x = _mm_loadu_ps(group.e1x);
+        __m128 e1y = _mm_loadu_ps(group.e1y);
+        __m128 e1z = _mm_loadu_ps(group.e1z);
+
+        __m128 pvx = _mm_sub_ps(_mm_mul_ps(dy, e1z), _mm_mul_ps(dz, e1y));
+        __m128 pvy = _mm_sub_ps(_mm_mul_ps(dz, e1x), _mm_mul_ps(dx, e1z));
+        __m128 pvz = _mm_sub_ps(_mm_mul_ps(dx, e1y), _mm_mul_ps(dy, e1x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0x, pvx), _mm_mul_ps(e0y, pvy)), _mm_mul_ps(e0z, pvz));
+
+        __m128 tvx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_loadu_ps(group.v0x));
+        __m128 tvy = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_loadu_ps(group.v0y));
+        __m128 tvz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_loadu_ps(group.v0z));
+
+        __m128 qvx = _mm_sub_ps(_mm_mul_ps(tvy, e0z), _mm_mul_ps(tvz, e0y));
+        __m128 qvy = _mm_sub_ps(_mm_mul_ps(tvz, e0x), _mm_mul_ps(tvx, e0z));
+        __m128 qvz = _mm_sub_ps(_mm_mul_ps(tvx, e0y), _mm_mul_ps(tvy, e0x));
+
+        __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+        __m128 uv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tvx, pvx), _mm_mul_ps(tvy, pvy)), _mm_mul_ps(tvz, pvz)), invDet);
+        __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qvx), _mm_mul_ps(dy, qvy)), _mm_mul_ps(dz, qvz)), invDet);
+        __m128 tv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, qvx), _mm_mul_ps(e1y, qvy)), _mm_mul_ps(e1z, qvz)), invDet);
+        __m128 wv = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.0f), uv), vv);
+
+        __m128 zero = _mm_setzero_ps();
+        __m128 hitMask = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(uv, zero), _mm_cmpge_ps(vv, zero)),
+                                    _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(wv, zero), _mm_cmpge_ps(tv, zero)), _mm_cmplt_ps(tv, _mm_set1_ps(tMax))));
+        mask = _mm_movemask_ps(hitMask);
+        if (mask == 0)
+            return false;
+
+        _mm_storeu_ps(u, uv);
+        _mm_storeu_ps(v, vv);
+        _mm_storeu_ps(t, tv);
+#else
+        for (int i = 0; i < 4; i++)
+        {
+            Vec3 e0(group.e0x[i], group.e0y[i], group.e0z[i]);
+            Vec3 e1(group.e1x[i], group.e1y[i], group.e1z[i]);
+            Vec3 pv = Vec3::Cross(ray.direction, e1);
+            float det = Vec3::Dot(e0, pv);
+            Vec3 tvec = ray.origin - Vec3(group.v0x[i], group.v0y[i], group.v0z[i]);
+            Vec3 qv = Vec3::Cross(tvec, e0);
+
+            float invDet = 1.0f / det;
+            u[i] = Vec3::Dot(tvec, pv) * invDet;
+            v[i] = Vec3::Dot(ray.direction, qv) * invDet;
+            t[i] = Vec3::Dot(e1, qv) * invDet;
+            if (u[i] >= 0.0f && v[i] >= 0.0f && 1.0f - u[i] - v[i] >= 0.0f && t[i] >= 0.0f && t[i] < tMax)
+                mask |= 1 << i;
+        }
+        if (mask == 0)
+            return false;
+#endif
+
+        bool found = false;
+        for (int i = 0; i < 4; i++)
+        {
+            if (!(mask & (1 << i)) || t[i] >= tMax)
+                continue;
+
+            RayHit candidate = { t[i], u[i], v[i], group.triID[i], instanceID, matID };
+            if (anyHit)
+            {
+                if (!filter || filter(candidate))
+                {
+                    hit = candidate;
+                    return true;
+                }
+            }
+            else
+            {
+                hit = candidate;
+                tMax = t[i];
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    template <bool anyHit>
+    bool BvhTraversal::Traverse(int start, const TraversalRay& ray, float& tMax, RayHit& hit, int instanceID, int matID, const HitFilter& filter) const
+    {
+        StackEntry stack[TRAVERSAL_STACK_SIZE];
+        int ptr = 0;
+        stack[ptr++] = StackEntry{ start, ChildNode, 0.0f };
+
+        bool found = false;
+
+        while (ptr > 0)
+        {
+            StackEntry entry = stack[--ptr];
+
+            // A closer hit may have been found since the entry was pushed
+            if (entry.t >= tMax)
+                continue;
+
+            if (entry.type == ChildTriangles)
+            {
+                if (IntersectTriangles<anyHit>(triangleGroups[entry.child], ray, tMax, hit, instanceID, matID, filter))
+                {
+                    found = true;
+                    if (anyHit)
+                        return true;
+                }
+                continue;
+            }
+
+            if (entry.type == ChildInstance)
+            {
+                // The direction isn't normalized in object space, so distances along the ray stay the same
+                const Instance& instance = instances[entry.child];
+                const Mat4& inv = invTransforms[entry.child];
+                TraversalRay objectRay = MakeRay(inv.TransformPoint(ray.origin), inv.TransformVector(ray.direction));
+
+                if (Traverse<anyHit>(instance.root, objectRay, tMax, hit, entry.child, instance.matID, filter))
+                {
+                    found = true;
+                    if (anyHit)
+                        return true;
+                }
+                continue;
+            }
+
+            const Node& node = nodes[entry.child];
+            float tNear[8];
+            int mask = IntersectChildren(node, ray, tMax, tNear);
+
+            int first = ptr;
+            for (int i = 0; i < 8; i++)
+            {
+                if (mask & (1 << i))
+                    PushSorted(stack, first, ptr, StackEntry{ node.child[i], node.type[i], tNear[i] });
+            }
+        }
+
+        return found;
+    }
+
+    bool BvhTraversal::ClosestHit(const Vec3& origin, const Vec3& direction, float tMax, RayHit& hit) const
+    {
+        hit.t = tMax;
+        hit.triID = -1;
+        if (root == -1)
+            return false;
+
+        return Traverse<false>(root, MakeRay(origin, direction), tMax, hit, -1, 0, nullptr);
+    }
+
+    bool BvhTraversal::AnyHit(const Vec3& origin, const Vec3& direction, float tMax, const HitFilter& filter) const
+    {
+        if (root == -1)
+            return false;
+
+        RayHit hit;
+        return Traverse<true>(root, MakeRay(origin, direction), tMax, hit, -1, 0, filter);
+    }
+
+#ifdef BVH_AVX2
+    // Packets are traversed together through every node that any of their rays hits. Children are tested one after
+    // the other against all eight rays, and triangles of a leaf likewise
+    template <bool anyHit>
+    void BvhTraversal::TraversePacket(int start, const TraversalPacket& packet, float tMax[8], RayHit hits[8], int instanceID, int matID, int& active) const
+    {
+        StackEntry stack[TRAVERSAL_STACK_SIZE];
+        int ptr = 0;
+        stack[ptr++] = StackEntry{ start, ChildNode, 0.0f };
+
+        __m256 zero = _mm256_setzero_ps();
+        __m256 one = _mm256_set1_ps(1.0f);
+
+        while (ptr > 0 && active != 0)
+        {
+            StackEntry entry = stack[--ptr];
+
+            float furthest = 0.0f;
+            for (int i = 0; i < 8; i++)
+            {
+                if (active & (1 << i))
+                    furthest = std::max(furthest, tMax[i]);
+            }
+            if (entry.t >= furthest)
+                continue;
+
+            __m256 tMaxV = _mm256_loadu_ps(tMax);
+
+            if (entry.type == ChildTriangles)
+            {
+                const TriangleGroup& group = triangleGroups[entry.child];
+                for (int k = 0; k < 4; k++)
+                {
+                    // Unused slots repeat the last triangle
+                    if (k > 0 && group.triID[k] == group.triID[k - 1])
+                        break;
+
+                    __m256 e0x = _mm256_set1_ps(group.e0x[k]);
+                    __m256 e0y = _mm256_set1_ps(group.e0y[k]);
+                    __m256 e0z = _mm256_set1_ps(group.e0z[k]);
+                    __m256 e1x = _mm256_set1_ps(group.e1x[k]);
+                    __m256 e1y = _mm256_set1_ps(group.e1y[k]);
+                    __m256 e1z = _mm256_set1_ps(group.e1z[k]);
+
+                    __m256 pvx = _mm256_sub_ps(_mm256_mul_ps(packet.dy, e1z), _mm256_mul_ps(packet.dz, e1y));
+                    __m256 pvy = _mm256_sub_ps(_mm256_mul_ps(packet.dz, e1x), _mm256_mul_ps(packet.dx, e1z));
+                    __m256 pvz = _mm256_sub_ps(_mm256_mul_ps(packet.dx, e1y), _mm256_mul_ps(packet.dy, e1x));
+                    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e0x, pvx), _mm256_mul_ps(e0y, pvy)), _mm256_mul_ps(e0z, pvz));
+
+                    __m256 tvx = _mm256_sub_ps(packet.ox, _mm256_set1_ps(group.v0x[k]));
+                    __m256 tvy = _mm256_sub_ps(packet.oy, _mm256_set1_ps(group.v0y[k]));
+                    __m256 tvz = _mm256_sub_ps(packet.oz, _mm256_set1_ps(group.v0z[k]));
+
+                    __m256 qvx = _mm256_sub_ps(_mm256_mul_ps(tvy, e0z), _mm256_mul_ps(tvz, e0y));
+                    __m256 qvy = _mm256_sub_ps(_mm256_mul_ps(tvz, e0x), _mm256_mul_ps(tvx, e0z));
+                    __m256 qvz = _mm256_sub_ps(_mm256_mul_ps(tvx, e0y), _mm256_mul_ps(tvy, e0x));
+
+                    __m256 invDet = _mm256_div_ps(one, det);
+                    __m256 uv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tvx, pvx), _mm256_mul_ps(tvy, pvy)), _mm256_mul_ps(tvz, pvz)), invDet);
+                    __m256 vv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(packet.dx, qvx), _mm256_mul_ps(packet.dy, qvy)), _mm256_mul_ps(packet.dz, qvz)), invDet);
+                    __m256 tv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, qvx), _mm256_mul_ps(e1y, qvy)), _mm256_mul_ps(e1z, qvz)), invDet);
+                    __m256 wv = _mm256_sub_ps(_mm256_sub_ps(one, uv), vv);
+
+                    __m256 hitMask = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(uv, zero, _CMP_GE_OQ), _mm256_cmp_ps(vv, zero, _CMP_GE_OQ)),
+                                                   _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(wv, zero, _CMP_GE_OQ), _mm256_cmp_ps(tv, zero, _CMP_GE_OQ)),
+                                                                 _mm256_cmp_ps(tv, tMaxV, _CMP_LT_OQ)));
+                    int mask = _mm256_movemask_ps(hitMask) & active;
+                    if (mask == 0)
+                        continue;
+
+                    float u[8], v[8], t[8];
+                    _mm256_storeu_ps(u, uv);
+                    _mm256_storeu_ps(v, vv);
+                    _mm256_storeu_ps(t, tv);
+
+                    for (int i = 0; i < 8; i++)
+                    {
+                        if (!(mask & (1 << i)))
+                            continue;
+
+                        hits[i] = RayHit{ t[i], u[i], v[i], group.triID[k], instanceID, matID };
+                        if (anyHit)
+                            active &= ~(1 << i);
+                        else
+                            tMax[i] = t[i];
+                    }
+                    tMaxV = _mm256_loadu_ps(tMax);
+                }
+                continue;
+            }
+
+            if (entry.type == ChildInstance)
+            {
+                const Instance& instance = instances[entry.child];
+                const Mat4& m = invTransforms[entry.child];
+
+                TraversalPacket objectPacket;
+                __m256 m00 = _mm256_set1_ps(m.data[0][0]), m01 = _mm256_set1_ps(m.data[0][1]), m02 = _mm256_set1_ps(m.data[0][2]);
+                __m256 m10 = _mm256_set1_ps(m.data[1][0]), m11 = _mm256_set1_ps(m.data[1][1]), m12 = _mm256_set1_ps(m.data[1][2]);
+                __m256 m20 = _mm256_set1_ps(m.data[2][0]), m21 = _mm256_set1_ps(m.data[2][1]), m22 = _mm256_set1_ps(m.data[2][2]);
+
+                objectPacket.ox = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(packet.ox, m00), _mm256_mul_ps(packet.oy, m10)), _mm256_add_ps(_mm256_mul_ps(packet.oz, m20), _mm256_set1_ps(m.data[3][0])));
+                objectPacket.oy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(packet.ox, m01), _mm256_mul_ps(packet.oy, m11)), _mm256_add_ps(_mm256_mul_ps(packet.oz, m21), _mm256_set1_ps(m.data[3][1])));
+                objectPacket.oz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(packet.ox, m02), _mm256_mul_ps(packet.oy, m12)), _mm256_add_ps(_mm256_mul_ps(packet.oz, m22), _mm256_set1_ps(m.data[3][2])));
+                objectPacket.dx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(packet.dx, m00), _mm256_mul_ps(packet.dy, m10)), _mm256_mul_ps(packet.dz, m20));
+                objectPacket.dy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(packet.dx, m01), _mm256_mul_ps(packet.dy, m11)), _mm256_mul_ps(packet.dz, m21));
+                objectPacket.dz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(packet.dx, m02), _mm256_mul_ps(packet.dy, m12)), _mm256_mul_ps(packet.dz, m22));
+                objectPacket.ix = _mm256_div_ps(one, objectPacket.dx);
+                objectPacket.iy = _mm256_div_ps(one, objectPacket.dy);
+                objectPacket.iz = _mm256_div_ps(one, objectPacket.dz);
+
+                TraversePacket<anyHit>(instance.root, objectPacket, tMax, hits, entry.child, instance.matID, active);
+                continue;
+            }
+
+            const Node& node = nodes[entry.child];
+            int first = ptr;
+            for (int c = 0; c < 8 && node.type[c] != ChildEmpty; c++)
+            {
+                // Rays of a packet can point in different directions, so the planes are ordered per ray
+                __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.minX[c]), packet.ox), packet.ix);
+                __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.minY[c]), packet.oy), packet.iy);
+                __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.minZ[c]), packet.oz), packet.iz);
+                __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.maxX[c]), packet.ox), packet.ix);
+                __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.maxY[c]), packet.oy), packet.iy);
+                __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.maxZ[c]), packet.oz), packet.iz);
+
+                __m256 tNearV = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_max_ps(_mm256_min_ps(t0z, t1z), zero));
+                __m256 tFarV = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_min_ps(_mm256_max_ps(t0z, t1z), tMaxV));
+
+                int mask = _mm256_movemask_ps(_mm256_cmp_ps(tNearV, tFarV, _CMP_LE_OQ)) & active;
+                if (mask == 0)
+                    continue;
+
+                float tNear[8];
+                _mm256_storeu_ps(tNear, tNearV);
+                float closest = FLT_MAX;
+                for (int i = 0; i < 8; i++)
+                {
+                    if (mask & (1 << i))
+                        closest = std::min(closest, tNear[i]);
+                }
+
+                PushSorted(stack, first, ptr, StackEntry{ node.child[c], node.type[c], closest });
+            }
+        }
+    }
+#endif
+
+    void BvhTraversal::ClosestHit8(const RayPacket8& packet, RayHit hits[8]) const
+    {
+        float tMax[8];
+        int active = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            hits[i].t = packet.tMax[i];
+            hits[i].triID = -1;
+            tMax[i] = packet.tMax[i];
+            if (tMax[i] > 0.0f)
+                active |= 1 << i;
+        }
+
+        if (root == -1 || active == 0)
+            return;
+
+#ifdef BVH_AVX2
+        TraversalPacket p;
+        p.ox = _mm256_loadu_ps(packet.ox);
+        p.oy = _mm256_loadu_ps(packet.oy);
+        p.oz = _mm256_loadu_ps(packet.oz);
+        p.dx = _mm256_loadu_ps(packet.dx);
+        p.dy = _mm256_loadu_ps(packet.dy);
+        p.dz = _mm256_loadu_ps(packet.dz);
+        p.ix = _mm256_div_ps(_mm256_set1_ps(1.0f), p.dx);
+        p.iy = _mm256_div_ps(_mm256_set1_ps(1.0f), p.dy);
+        p.iz = _mm256_div_ps(_mm256_set1_ps(1.0f), p.dz);
+        TraversePacket<false>(root, p, tMax, hits, -1, 0, active);
+#else
+        // Without 8-wide registers each ray is traced on its own
+        for (int i = 0; i < 8; i++)
+        {
+            if (active & (1 << i))
+                ClosestHit(Vec3(packet.ox[i], packet.oy[i], packet.oz[i]), Vec3(packet.dx[i], packet.dy[i], packet.dz[i]), tMax[i], hits[i]);
+        }
+#endif
+    }
+
+    void BvhTraversal::AnyHit8(const RayPacket8& packet, bool occluded[8]) const
+    {
+        int active = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            occluded[i] = false;
+            if (packet.tMax[i] > 0.0f)
+                active |= 1 << i;
+        }
+
+        if (root == -1 || active == 0)
+            return;
+
+#ifdef BVH_AVX2
+        TraversalPacket p;
+        p.ox = _mm256_loadu_ps(packet.ox);
+        p.oy = _mm256_loadu_ps(packet.oy);
+        p.oz = _mm256_loadu_ps(packet.oz);
+        p.dx = _mm256_loadu_ps(packet.dx);
+        p.dy = _mm256_loadu_ps(packet.dy);
+        p.dz = _mm256_loadu_ps(packet.dz);
+        p.ix = _mm256_div_ps(_mm256_set1_ps(1.0f), p.dx);
+        p.iy = _mm256_div_ps(_mm256_set1_ps(1.0f), p.dy);
+        p.iz = _mm256_div_ps(_mm256_set1_ps(1.0f), p.dz);
+
+        float tMax[8];
+        RayHit hits[8];
+        for (int i = 0; i < 8; i++)
+            tMax[i] = packet.tMax[i];
+
+        int remaining = active;
+        TraversePacket<true>(root, p, tMax, hits, -1, 0, remaining);
+        for (int i = 0; i < 8; i++)
+            occluded[i] = (active & ~remaining & (1 << i)) != 0;
+#else
+        for (int i = 0; i < 8; i++)
+        {
+            if (active & (1 << i))
+                occluded[i] = AnyHit(Vec3(packet.ox[i], packet.oy[i], packet.oz[i]), Vec3(packet.dx[i], packet.dy[i], packet.dz[i]), packet.tMax[i]);
+        }
+#endif
+    }
+}
@@ -0,0 +1,147 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <functional>
+#include "Mat4.h"
+#include "Vec3.h"
+
+namespace GLSLPT
+{
+    class Scene;
+
+    struct RayHit
+    {
+        float t;
+        float u, v;     // Barycentric coordinates of the second and third vertex
+        int triID;      // Index into Scene::vertIndices. -1 if nothing was hit
+        int instanceID;
+        int matID;
+    };
+
+    // Eight rays traced together. Lanes with a tMax of 0 are inactive
+    struct RayPacket8
+    {
+        float ox[8], oy[8], oz[8];
+        float dx[8], dy[8], dz[8];
+        float tMax[8];
+    };
+
+    // Called for each hit found by AnyHit. Returning false ignores the hit, for alpha testing
+    typedef std::function<bool(const RayHit& hit)> HitFilter;
+
+    // Ray queries on the CPU against the two level BVH of a processed scene. The binary nodes of the BvhTranslator
+    // are collapsed into 8-wide nodes so one SIMD test covers every child, and leaves hold up to four triangles that
+    // are tested together. Uses AVX2 when built with it (ENABLE_AVX2 in CMake), SSE2 otherwise
+    class BvhTraversal
+    {
+    public:
+        BvhTraversal(const Scene* scene);
+
+        // Rebuilds the nodes, e.g. after instance transforms were changed and the TLAS was updated
+        void Build();
+
+        // Finds the closest hit before tMax
+        bool ClosestHit(const Vec3& origin, const Vec3& direction, float tMax, RayHit& hit) const;
+
+        // Finds any hit before tMax. Hits aren't visited in order of distance
+        bool AnyHit(const Vec3& origin, const Vec3& direction, float tMax, const HitFilter& filter = nullptr) const;
+
+        // Packet versions. Rays of a packet should start close to each other and point in similar directions, like
+        // camera rays of neighbouring pixels. Missed rays are given a triID of -1
+        void ClosestHit8(const RayPacket8& packet, RayHit hits[8]) const;
+        void AnyHit8(const RayPacket8& packet, bool occluded[8]) const;
+
+        const Mat4& GetInverseTransform(int instanceID) const { return invTransforms[instanceID]; }
+
+        // Instruction set the kernels were compiled for
+        static const char* GetSimdName();
+
+    private:
+        enum ChildType
+        {
+            ChildNode,
+            ChildTriangles,
+            ChildInstance,
+            ChildEmpty
+        };
+
+        // Bounds of the children are stored per axis so they can be loaded straight into SIMD registers
+        struct Node
+        {
+            float minX[8], minY[8], minZ[8];
+            float maxX[8], maxY[8], maxZ[8];
+            int child[8]; // Index of the node, triangle group or instance
+            int type[8];
+        };
+
+        // Unused slots repeat the last triangle
+        struct TriangleGroup
+        {
+            float v0x[4], v0y[4], v0z[4];
+            float e0x[4], e0y[4], e0z[4];
+            float e1x[4], e1y[4], e1z[4];
+            int triID[4];
+        };
+
+        struct Instance
+        {
+            int root;
+            int matID;
+        };
+
+        struct TraversalRay;
+        struct TraversalPacket;
+
+        static TraversalRay MakeRay(const Vec3& origin, const Vec3& direction);
+        static int IntersectChildren(const Node& node, const TraversalRay& ray, float tMax, float tNear[8]);
+
+        int CollapseNode(int binaryNode, bool topLevel);
+        int CountTriangles(int binaryNode);
+        void GatherTriangles(int binaryNode, std::vector<int>& triangles);
+        int AddTriangleGroup(int binaryNode);
+
+        template <bool anyHit>
+        bool Traverse(int root, const TraversalRay& ray, float& tMax, RayHit& hit, int instanceID, int matID, const HitFilter& filter) const;
+
+        template <bool anyHit>
+        bool IntersectTriangles(const TriangleGroup& group, const TraversalRay& ray, float& tMax, RayHit& hit, int instanceID, int matID, const HitFilter& filter) const;
+
+        template <bool anyHit>
+        void TraversePacket(int root, const TraversalPacket& packet, float tMax[8], RayHit hits[8], int instanceID, int matID, int& active) const;
+
+        const Scene* scene;
+        std::vector<Node> nodes;
+        std::vector<TriangleGroup> triangleGroups;
+        std::vector<Instance> instances;
+        std::vector<Mat4> invTransforms;
+        int root;
+
+        // Per binary node during Build
+        std::vector<int> triangleCounts;
+        std::vector<int> blasRoots;
+    };
+}
@@ -0,0 +1,139 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include "Checkpoint.h"
+
+namespace GLSLPT
+{
+    // Bumped whenever the layout of checkpoint files changes
+    static const char CHECKPOINT_MAGIC[4] = { 'G', 'P', 'T', 'C' };
+    static const int CHECKPOINT_VERSION = 1;
+
+    bool WriteCheckpoint(const Checkpoint& checkpoint, const std::string& filename)
+    {
+        // Written next to the last checkpoint and moved over it, so a crash while writing keeps the last one intact
+        std::string tempFilename = filename + ".tmp";
+        FILE* file = fopen(tempFilename.c_str(), "wb");
+        if (!file)
+        {
+            printf("Unable to write %s\n", tempFilename.c_str());
+            return false;
+        }
+
+        int header[7] = { CHECKPOINT_VERSION, checkpoint.renderSize.x, checkpoint.renderSize.y, checkpoint.numTiles.x, checkpoint.numTiles.y,
+                          checkpoint.sampleCounter, checkpoint.frameCounter };
+        size_t numTiles = checkpoint.tileSamples.size();
+        bool success = fwrite(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC), 1, file) == 1 &&
+                       fwrite(header, sizeof(header), 1, file) == 1 &&
+                       fwrite(&checkpoint.sceneHash, sizeof(uint64_t), 1, file) == 1 &&
+                       fwrite(&checkpoint.tileSamples[0], sizeof(int), numTiles, file) == numTiles &&
+                       fwrite(&checkpoint.tileLastPasses[0], sizeof(int), numTiles, file) == numTiles &&
+                       fwrite(&checkpoint.accum[0], sizeof(Vec4), checkpoint.accum.size(), file) == checkpoint.accum.size();
+        success = fclose(file) == 0 && success;
+
+        // rename doesn't replace existing files everywhere
+        if (success)
+        {
+            remove(filename.c_str());
+            success = rename(tempFilename.c_str(), filename.c_str()) == 0;
+        }
+
+        if (!success)
+            printf("Unable to write %s\n", filename.c_str());
+        return success;
+    }
+
+    bool ReadCheckpoint(const std::string& filename, Checkpoint& checkpoint)
+    {
+        FILE* file = fopen(filename.c_str(), "rb");
+        if (!file)
+        {
+            printf("Unable to open %s\n", filename.c_str());
+            return false;
+        }
+
+        char magic[4];
+        int header[7];
+        bool valid = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0 &&
+                     fread(header, sizeof(header), 1, file) == 1 && header[0] == CHECKPOINT_VERSION &&
+                     header[1] > 0 && header[2] > 0 && header[3] > 0 && header[4] > 0 &&
+                     fread(&checkpoint.sceneHash, sizeof(uint64_t), 1, file) == 1;
+
+        if (valid)
+        {
+            checkpoint.renderSize = iVec2(header[1], header[2]);
+            checkpoint.numTiles = iVec2(header[3], header[4]);
+            checkpoint.sampleCounter = header[5];
+            checkpoint.frameCounter = header[6];
+
+            size_t numTiles = checkpoint.numTiles.x * checkpoint.numTiles.y;
+            checkpoint.tileSamples.resize(numTiles);
+            checkpoint.tileLastPasses.resize(numTiles);
+            checkpoint.accum.resize(checkpoint.renderSize.x * checkpoint.renderSize.y);
+            valid = fread(&checkpoint.tileSamples[0], sizeof(int), numTiles, file) == numTiles &&
+                    fread(&checkpoint.tileLastPasses[0], sizeof(int), numTiles, file) == numTiles &&
+                    fread(&checkpoint.accum[0], sizeof(Vec4), checkpoint.accum.size(), file) == checkpoint.accum.size() &&
+                    fgetc(file) == EOF;
+        }
+        fclose(file);
+
+        if (!valid)
+            printf("Invalid checkpoint %s\n", filename.c_str());
+        return valid;
+    }
+
+
+    bool MergeCheckpoint(Checkpoint& checkpoint, const Checkpoint& other)
+    {
+        if (other.sceneHash != checkpoint.sceneHash || other.renderSize.x != checkpoint.renderSize.x || other.renderSize.y != checkpoint.renderSize.y ||
+            other.numTiles.x != checkpoint.numTiles.x || other.numTiles.y != checkpoint.numTiles.y)
+        {
+            printf("Checkpoints of a different scene or settings can't be merged\n");
+            return false;
+        }
+
+        for (size_t i = 0; i < checkpoint.accum.size(); i++)
+        {
+            const Vec4& a = checkpoint.accum[i];
+            const Vec4& b = other.accum[i];
+            checkpoint.accum[i] = Vec4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w);
+        }
+
+        for (size_t i = 0; i < checkpoint.tileSamples.size(); i++)
+        {
+            checkpoint.tileSamples[i] += other.tileSamples[i];
+            checkpoint.tileLastPasses[i] = std::max(checkpoint.tileLastPasses[i], other.tileLastPasses[i]);
+        }
+
+        // The random numbers carry on after the furthest of the two, though renders that started from the same
+        // seed still share their first samples
+        checkpoint.sampleCounter = std::max(checkpoint.sampleCounter, other.sampleCounter);
+        checkpoint.frameCounter = std::max(checkpoint.frameCounter, other.frameCounter);
+
+        return true;
+    }
+}
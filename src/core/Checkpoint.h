@@ -0,0 +1,54 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Vec2.h"
+#include "Vec4.h"
+
+namespace GLSLPT
+{
+    // Accumulated samples of a render and what is needed to carry on adding to them. Written by the GPU and the CPU
+    // renderer alike, so renders of the same scene from several machines can be added up
+    struct Checkpoint
+    {
+        uint64_t sceneHash;
+        iVec2 renderSize;
+        iVec2 numTiles;
+        int sampleCounter;                // Pass the tile scheduler is in
+        int frameCounter;                 // Seeds the random numbers of the next sample
+        std::vector<int> tileSamples;     // Bottom row first, like the accumulation
+        std::vector<int> tileLastPasses;
+        std::vector<Vec4> accum;          // Sum of the samples, bottom row first
+    };
+
+    bool WriteCheckpoint(const Checkpoint& checkpoint, const std::string& filename);
+    bool ReadCheckpoint(const std::string& filename, Checkpoint& checkpoint);
+
+    // Adds the samples of other to checkpoint. Both must come from the same scene and tiles
+    bool MergeCheckpoint(Checkpoint& checkpoint, const Checkpoint& other);
+}
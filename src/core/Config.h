@@ -26,6 +26,14 @@
 
 #include "GL/gl3w.h"
 
+// S3TC is an extension and its formats are missing from the core profile header
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
 #if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN 1
 #include <Windows.h>
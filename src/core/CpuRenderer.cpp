@@ -0,0 +1,1811 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+#include "CpuRenderer.h"
+#include "BvhTraversal.h"
+#include "Scene.h"
+#include "Checkpoint.h"
+
+// Functions below are ports of the ones with the same name in the shaders. See the shaders for the references
+namespace GLSLPT
+{
+    namespace
+    {
+        const float INV_PI = 0.31830988618379067f;
+        const float TWO_PI = 6.28318530717958648f;
+        const float INV_TWO_PI = 0.15915494309189533f;
+        const float INV_4_PI = 0.07957747154594766f;
+        const float EPS = 0.0001f;
+        const float INF = 1000000.0f;
+
+        struct Ray
+        {
+            Vec3 origin;
+            Vec3 direction;
+        };
+
+        struct Medium
+        {
+            int type = MediumType::None;
+            float density = 0.0f;
+            Vec3 color;
+            float anisotropy = 0.0f;
+        };
+
+        // Material with textures applied, as the shaders see it
+        struct ShadingMaterial
+        {
+            Vec3 baseColor;
+            float opacity = 1.0f;
+            int alphaMode = AlphaMode::Opaque;
+            float alphaCutoff = 0.0f;
+            Vec3 emission;
+            float metallic = 0.0f;
+            float roughness = 0.5f;
+            float subsurface = 0.0f;
+            float specularTint = 0.0f;
+            float sheen = 0.0f;
+            float sheenTint = 0.0f;
+            float clearcoat = 0.0f;
+            float clearcoatRoughness = 0.0f;
+            float specTrans = 0.0f;
+            float ior = 1.5f;
+            Medium medium;
+        };
+
+        struct State
+        {
+            int depth = 0;
+            float eta = 1.0f;
+            float hitDist = 0.0f;
+            Vec3 fhp;
+            Vec3 normal;
+            Vec3 ffnormal;
+            Vec3 tangent;
+            Vec3 bitangent;
+            bool isEmitter = false;
+            Vec2 texCoord;
+            int matID = 0;
+            ShadingMaterial mat;
+            Medium medium;
+        };
+
+        struct ScatterSampleRec
+        {
+            Vec3 L;
+            Vec3 f;
+            float pdf = 0.0f;
+        };
+
+        struct LightSampleRec
+        {
+            Vec3 normal;
+            Vec3 emission;
+            Vec3 direction;
+            float dist = 0.0f;
+            float pdf = 0.0f;
+        };
+
+        // pcg4d, seeded from the pixel and sample like InitRNG
+        struct Sampler
+        {
+            uint32_t v[4];
+
+            Sampler(int x, int y, int frame)
+            {
+                v[0] = (uint32_t)x;
+                v[1] = (uint32_t)y;
+                v[2] = (uint32_t)frame;
+                v[3] = (uint32_t)(x + y);
+            }
+
+            float Next()
+            {
+                for (int i = 0; i < 4; i++)
+                    v[i] = v[i] * 1664525u + 1013904223u;
+                v[0] += v[1] * v[3]; v[1] += v[2] * v[0]; v[2] += v[0] * v[1]; v[3] += v[1] * v[2];
+                for (int i = 0; i < 4; i++)
+                    v[i] ^= v[i] >> 16u;
+                v[0] += v[1] * v[3]; v[1] += v[2] * v[0]; v[2] += v[0] * v[1]; v[3] += v[1] * v[2];
+                return (float)v[0] / (float)0xffffffffu;
+            }
+        };
+
+        inline float Mix(float a, float b, float t)
+        {
+            return a + (b - a) * t;
+        }
+
+        inline Vec3 Mix(const Vec3& a, const Vec3& b, float t)
+        {
+            return a + (b - a) * t;
+        }
+
+        inline Vec3 Exp(const Vec3& a)
+        {
+            return Vec3(expf(a.x), expf(a.y), expf(a.z));
+        }
+
+        inline float Luminance(const Vec3& c)
+        {
+            return 0.212671f * c.x + 0.715160f * c.y + 0.072169f * c.z;
+        }
+
+        Vec3 RRTAndODTFit(const Vec3& v)
+        {
+            Vec3 a = v * (v + Vec3(0.0245786f, 0.0245786f, 0.0245786f)) - Vec3(0.000090537f, 0.000090537f, 0.000090537f);
+            Vec3 b = v * (v * 0.983729f + Vec3(0.4329510f, 0.4329510f, 0.4329510f)) + Vec3(0.238081f, 0.238081f, 0.238081f);
+            return Vec3(a.x / b.x, a.y / b.y, a.z / b.z);
+        }
+
+        Vec3 ACESFitted(Vec3 color)
+        {
+            color = Vec3(Vec3::Dot(color, Vec3(0.59719f, 0.35458f, 0.04823f)),
+                         Vec3::Dot(color, Vec3(0.07600f, 0.90834f, 0.01566f)),
+                         Vec3::Dot(color, Vec3(0.02840f, 0.13383f, 0.83777f)));
+
+            color = RRTAndODTFit(color);
+
+            color = Vec3(Vec3::Dot(color, Vec3(1.60475f, -0.53108f, -0.07367f)),
+                         Vec3::Dot(color, Vec3(-0.10208f, 1.10813f, -0.00605f)),
+                         Vec3::Dot(color, Vec3(-0.00327f, -0.07276f, 1.07602f)));
+
+            return Vec3::Clamp(color, Vec3(0.0f, 0.0f, 0.0f), Vec3(1.0f, 1.0f, 1.0f));
+        }
+
+        Vec3 ACES(const Vec3& c)
+        {
+            Vec3 num = c * (c * 2.51f + Vec3(0.03f, 0.03f, 0.03f));
+            Vec3 den = c * (c * 2.43f + Vec3(0.59f, 0.59f, 0.59f)) + Vec3(0.14f, 0.14f, 0.14f);
+            return Vec3::Clamp(Vec3(num.x / den.x, num.y / den.y, num.z / den.z), Vec3(0.0f, 0.0f, 0.0f), Vec3(1.0f, 1.0f, 1.0f));
+        }
+
+        inline Vec3 Reflect(const Vec3& I, const Vec3& N)
+        {
+            return I - N * (2.0f * Vec3::Dot(N, I));
+        }
+
+        inline Vec3 Refract(const Vec3& I, const Vec3& N, float eta)
+        {
+            float NDotI = Vec3::Dot(N, I);
+            float k = 1.0f - eta * eta * (1.0f - NDotI * NDotI);
+            if (k < 0.0f)
+                return Vec3(0.0f, 0.0f, 0.0f);
+            return I * eta - N * (eta * NDotI + sqrtf(k));
+        }
+
+        inline Vec3 FaceForward(const Vec3& a, const Vec3& b)
+        {
+            return Vec3::Dot(a, b) < 0.0f ? -b : b;
+        }
+
+        // Normals transform by the inverse transpose, so they are multiplied by the inverse from the other side
+        inline Vec3 TransformNormal(const Mat4& inv, const Vec3& n)
+        {
+            return Vec3(Vec3::Dot(Vec3(inv.data[0][0], inv.data[0][1], inv.data[0][2]), n),
+                        Vec3::Dot(Vec3(inv.data[1][0], inv.data[1][1], inv.data[1][2]), n),
+                        Vec3::Dot(Vec3(inv.data[2][0], inv.data[2][1], inv.data[2][2]), n));
+        }
+
+        float SphereIntersect(float rad, const Vec3& pos, const Ray& r)
+        {
+            Vec3 op = pos - r.origin;
+            float eps = 0.001f;
+            float b = Vec3::Dot(op, r.direction);
+            float det = b * b - Vec3::Dot(op, op) + rad * rad;
+            if (det < 0.0f)
+                return INF;
+
+            det = sqrtf(det);
+            float t1 = b - det;
+            if (t1 > eps)
+                return t1;
+
+            float t2 = b + det;
+            if (t2 > eps)
+                return t2;
+
+            return INF;
+        }
+
+        float RectIntersect(const Vec3& pos, const Vec3& u, const Vec3& v, const Vec3& n, float planeDist, const Ray& r)
+        {
+            float dt = Vec3::Dot(r.direction, n);
+            float t = (planeDist - Vec3::Dot(n, r.origin)) / dt;
+
+            if (t > EPS)
+            {
+                Vec3 vi = r.origin + r.direction * t - pos;
+                float a1 = Vec3::Dot(u, vi);
+                if (a1 >= 0.0f && a1 <= 1.0f)
+                {
+                    float a2 = Vec3::Dot(v, vi);
+                    if (a2 >= 0.0f && a2 <= 1.0f)
+                        return t;
+                }
+            }
+
+            return INF;
+        }
+
+        // Sampling
+
+        float GTR1(float NDotH, float a)
+        {
+            if (a >= 1.0f)
+                return INV_PI;
+            float a2 = a * a;
+            float t = 1.0f + (a2 - 1.0f) * NDotH * NDotH;
+            return (a2 - 1.0f) / (PI * logf(a2) * t);
+        }
+
+        Vec3 SampleGTR1(float rgh, float r1, float r2)
+        {
+            float a = std::max(0.001f, rgh);
+            float a2 = a * a;
+
+            float phi = r1 * TWO_PI;
+
+            float cosTheta = sqrtf((1.0f - powf(a2, 1.0f - r1)) / (1.0f - a2));
+            float sinTheta = Math::Clamp(sqrtf(1.0f - (cosTheta * cosTheta)), 0.0f, 1.0f);
+
+            return Vec3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+        }
+
+        float GTR2(float NDotH, float a)
+        {
+            float a2 = a * a;
+            float t = 1.0f + (a2 - 1.0f) * NDotH * NDotH;
+            return a2 / (PI * t * t);
+        }
+
+        Vec3 SampleGGXVNDF(const Vec3& V, float rgh, float r1, float r2)
+        {
+            Vec3 Vh = Vec3::Normalize(Vec3(rgh * V.x, rgh * V.y, V.z));
+
+            float lensq = Vh.x * Vh.x + Vh.y * Vh.y;
+            Vec3 T1 = lensq > 0.0f ? Vec3(-Vh.y, Vh.x, 0.0f) * (1.0f / sqrtf(lensq)) : Vec3(1.0f, 0.0f, 0.0f);
+            Vec3 T2 = Vec3::Cross(Vh, T1);
+
+            float r = sqrtf(r1);
+            float phi = 2.0f * PI * r2;
+            float t1 = r * cosf(phi);
+            float t2 = r * sinf(phi);
+            float s = 0.5f * (1.0f + Vh.z);
+            t2 = (1.0f - s) * sqrtf(1.0f - t1 * t1) + s * t2;
+
+            Vec3 Nh = T1 * t1 + T2 * t2 + Vh * sqrtf(std::max(0.0f, 1.0f - t1 * t1 - t2 * t2));
+
+            return Vec3::Normalize(Vec3(rgh * Nh.x, rgh * Nh.y, std::max(0.0f, Nh.z)));
+        }
+
+        float SmithG(float NDotV, float alphaG)
+        {
+            float a = alphaG * alphaG;
+            float b = NDotV * NDotV;
+            return (2.0f * NDotV) / (NDotV + sqrtf(a + b - a * b));
+        }
+
+        float SchlickFresnel(float u)
+        {
+            float m = Math::Clamp(1.0f - u, 0.0f, 1.0f);
+            float m2 = m * m;
+            return m2 * m2 * m;
+        }
+
+        float DielectricFresnel(float cosThetaI, float eta)
+        {
+            float sinThetaTSq = eta * eta * (1.0f - cosThetaI * cosThetaI);
+
+            // Total internal reflection
+            if (sinThetaTSq > 1.0f)
+                return 1.0f;
+
+            float cosThetaT = sqrtf(std::max(1.0f - sinThetaTSq, 0.0f));
+
+            float rs = (eta * cosThetaT - cosThetaI) / (eta * cosThetaT + cosThetaI);
+            float rp = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+
+            return 0.5f * (rs * rs + rp * rp);
+        }
+
+        Vec3 CosineSampleHemisphere(float r1, float r2)
+        {
+            float r = sqrtf(r1);
+            float phi = TWO_PI * r2;
+            float x = r * cosf(phi);
+            float y = r * sinf(phi);
+            return Vec3(x, y, sqrtf(std::max(0.0f, 1.0f - x * x - y * y)));
+        }
+
+        Vec3 UniformSampleHemisphere(float r1, float r2)
+        {
+            float r = sqrtf(std::max(0.0f, 1.0f - r1 * r1));
+            float phi = TWO_PI * r2;
+            return Vec3(r * cosf(phi), r * sinf(phi), r1);
+        }
+
+        float PowerHeuristic(float a, float b)
+        {
+            float t = a * a;
+            return t / (b * b + t);
+        }
+
+        void Onb(const Vec3& N, Vec3& T, Vec3& B)
+        {
+            Vec3 up = fabsf(N.z) < 0.999f ? Vec3(0.0f, 0.0f, 1.0f) : Vec3(1.0f, 0.0f, 0.0f);
+            T = Vec3::Normalize(Vec3::Cross(up, N));
+            B = Vec3::Cross(N, T);
+        }
+
+        Vec3 SampleHG(const Vec3& V, float g, float r1, float r2)
+        {
+            float cosTheta;
+
+            if (fabsf(g) < 0.001f)
+                cosTheta = 1.0f - 2.0f * r2;
+            else
+            {
+                float sqrTerm = (1.0f - g * g) / (1.0f + g - 2.0f * g * r2);
+                cosTheta = -(1.0f + g * g - sqrTerm * sqrTerm) / (2.0f * g);
+            }
+
+            float phi = r1 * TWO_PI;
+            float sinTheta = Math::Clamp(sqrtf(1.0f - (cosTheta * cosTheta)), 0.0f, 1.0f);
+
+            Vec3 v1, v2;
+            Onb(V, v1, v2);
+
+            return v1 * (sinTheta * cosf(phi)) + v2 * (sinTheta * sinf(phi)) + V * cosTheta;
+        }
+
+        float PhaseHG(float cosTheta, float g)
+        {
+            float denom = 1.0f + g * g + 2.0f * g * cosTheta;
+            return INV_4_PI * (1.0f - g * g) / (denom * sqrtf(denom));
+        }
+
+        // Disney BSDF
+
+        Vec3 ToWorld(const Vec3& X, const Vec3& Y, const Vec3& Z, const Vec3& V)
+        {
+            return X * V.x + Y * V.y + Z * V.z;
+        }
+
+        Vec3 ToLocal(const Vec3& X, const Vec3& Y, const Vec3& Z, const Vec3& V)
+        {
+            return Vec3(Vec3::Dot(V, X), Vec3::Dot(V, Y), Vec3::Dot(V, Z));
+        }
+
+        float DisneyFresnel(const ShadingMaterial& mat, float eta, float LDotH, float VDotH)
+        {
+            float metallicFresnel = SchlickFresnel(LDotH);
+            float dielectricFresnel = DielectricFresnel(fabsf(VDotH), eta);
+            return Mix(dielectricFresnel, metallicFresnel, mat.metallic);
+        }
+
+        Vec3 EvalDiffuse(const ShadingMaterial& mat, const Vec3& Csheen, const Vec3& V, const Vec3& L, const Vec3& H, float& pdf)
+        {
+            pdf = 0.0f;
+            if (L.z <= 0.0f)
+                return Vec3(0.0f, 0.0f, 0.0f);
+
+            float LDotH = Vec3::Dot(L, H);
+
+            // Diffuse
+            float FL = SchlickFresnel(L.z);
+            float FV = SchlickFresnel(V.z);
+            float FH = SchlickFresnel(LDotH);
+            float Fd90 = 0.5f + 2.0f * LDotH * LDotH * mat.roughness;
+            float Fd = Mix(1.0f, Fd90, FL) * Mix(1.0f, Fd90, FV);
+
+            // Fake Subsurface
+            float Fss90 = LDotH * LDotH * mat.roughness;
+            float Fss = Mix(1.0f, Fss90, FL) * Mix(1.0f, Fss90, FV);
+            float ss = 1.25f * (Fss * (1.0f / (L.z + V.z) - 0.5f) + 0.5f);
+
+            // Sheen
+            Vec3 Fsheen = Csheen * (FH * mat.sheen);
+
+            pdf = L.z * INV_PI;
+            return (mat.baseColor * (INV_PI * Mix(Fd, ss, mat.subsurface)) + Fsheen) * ((1.0f - mat.metallic) * (1.0f - mat.specTrans));
+        }
+
+        Vec3 EvalSpecReflection(const ShadingMaterial& mat, float eta, const Vec3& specCol, const Vec3& V, const Vec3& L, const Vec3& H, float& pdf)
+        {
+            pdf = 0.0f;
+            if (L.z <= 0.0f)
+                return Vec3(0.0f, 0.0f, 0.0f);
+
+            float FM = DisneyFresnel(mat, eta, Vec3::Dot(L, H), Vec3::Dot(V, H));
+            Vec3 F = Mix(specCol, Vec3(1.0f, 1.0f, 1.0f), FM);
+            float D = GTR2(H.z, mat.roughness);
+            float G1 = SmithG(fabsf(V.z), mat.roughness);
+            float G2 = G1 * SmithG(fabsf(L.z), mat.roughness);
+
+            pdf = G1 * D / (4.0f * V.z);
+            return F * (D * G2 / (4.0f * L.z * V.z));
+        }
+
+        Vec3 EvalSpecRefraction(const ShadingMaterial& mat, float eta, const Vec3& V, const Vec3& L, const Vec3& H, float& pdf)
+        {
+            pdf = 0.0f;
+            if (L.z >= 0.0f)
+                return Vec3(0.0f, 0.0f, 0.0f);
+
+            float VDotH = Vec3::Dot(V, H);
+            float LDotH = Vec3::Dot(L, H);
+            float F = DielectricFresnel(fabsf(VDotH), eta);
+            float D = GTR2(H.z, mat.roughness);
+            float denom = LDotH + VDotH * eta;
+            denom *= denom;
+            float G1 = SmithG(fabsf(V.z), mat.roughness);
+            float G2 = G1 * SmithG(fabsf(L.z), mat.roughness);
+            float eta2 = eta * eta;
+            float jacobian = fabsf(LDotH) / denom;
+
+            pdf = G1 * std::max(0.0f, VDotH) * D * jacobian / V.z;
+
+            return Vec3::Pow(mat.baseColor, 0.5f) * ((1.0f - mat.metallic) * mat.specTrans * (1.0f - F) * D * G2 * fabsf(VDotH) * jacobian * eta2 / fabsf(L.z * V.z));
+        }
+
+        Vec3 EvalClearcoat(const ShadingMaterial& mat, const Vec3& V, const Vec3& L, const Vec3& H, float& pdf)
+        {
+            pdf = 0.0f;
+            if (L.z <= 0.0f)
+                return Vec3(0.0f, 0.0f, 0.0f);
+
+            float VDotH = Vec3::Dot(V, H);
+            float FH = DielectricFresnel(VDotH, 1.0f / 1.5f);
+            float F = Mix(0.04f, 1.0f, FH);
+            float D = GTR1(H.z, mat.clearcoatRoughness);
+            float G = SmithG(L.z, 0.25f) * SmithG(V.z, 0.25f);
+            float jacobian = 1.0f / (4.0f * VDotH);
+
+            pdf = D * H.z * jacobian;
+            float f = 0.25f * mat.clearcoat * F * D * G / (4.0f * L.z * V.z);
+            return Vec3(f, f, f);
+        }
+
+        void GetSpecColor(const ShadingMaterial& mat, float eta, Vec3& specCol, Vec3& sheenCol)
+        {
+            float lum = Luminance(mat.baseColor);
+            Vec3 ctint = lum > 0.0f ? mat.baseColor / lum : Vec3(1.0f, 1.0f, 1.0f);
+            float F0 = (1.0f - eta) / (1.0f + eta);
+            specCol = Mix(Mix(Vec3(1.0f, 1.0f, 1.0f), ctint, mat.specularTint) * (F0 * F0), mat.baseColor, mat.metallic);
+            sheenCol = Mix(Vec3(1.0f, 1.0f, 1.0f), ctint, mat.sheenTint);
+        }
+
+        void GetLobeProbabilities(const ShadingMaterial& mat, const Vec3& specCol, float approxFresnel, float& diffuseWt, float& specReflectWt, float& specRefractWt, float& clearcoatWt)
+        {
+            diffuseWt = Luminance(mat.baseColor) * (1.0f - mat.metallic) * (1.0f - mat.specTrans);
+            specReflectWt = Luminance(Mix(specCol, Vec3(1.0f, 1.0f, 1.0f), approxFresnel));
+            specRefractWt = (1.0f - approxFresnel) * (1.0f - mat.metallic) * mat.specTrans * Luminance(mat.baseColor);
+            clearcoatWt = 0.25f * mat.clearcoat * (1.0f - mat.metallic);
+            float totalWt = diffuseWt + specReflectWt + specRefractWt + clearcoatWt;
+
+            diffuseWt /= totalWt;
+            specReflectWt /= totalWt;
+            specRefractWt /= totalWt;
+            clearcoatWt /= totalWt;
+        }
+
+        Vec3 DisneyEval(const State& state, Vec3 V, const Vec3& N, Vec3 L, float& bsdfPdf)
+        {
+            bsdfPdf = 0.0f;
+            Vec3 f;
+
+            Vec3 T, B;
+            Onb(N, T, B);
+            V = ToLocal(T, B, N, V);
+            L = ToLocal(T, B, N, L);
+
+            Vec3 H;
+            if (L.z > 0.0f)
+                H = Vec3::Normalize(L + V);
+            else
+                H = Vec3::Normalize(L + V * state.eta);
+
+            if (H.z < 0.0f)
+                H = -H;
+
+            Vec3 specCol, sheenCol;
+            GetSpecColor(state.mat, state.eta, specCol, sheenCol);
+
+            float diffuseWt, specReflectWt, specRefractWt, clearcoatWt;
+            float fresnel = DisneyFresnel(state.mat, state.eta, Vec3::Dot(L, H), Vec3::Dot(V, H));
+            GetLobeProbabilities(state.mat, specCol, fresnel, diffuseWt, specReflectWt, specRefractWt, clearcoatWt);
+
+            float pdf;
+
+            if (diffuseWt > 0.0f && L.z > 0.0f)
+            {
+                f += EvalDiffuse(state.mat, sheenCol, V, L, H, pdf);
+                bsdfPdf += pdf * diffuseWt;
+            }
+
+            if (specReflectWt > 0.0f && L.z > 0.0f && V.z > 0.0f)
+            {
+                f += EvalSpecReflection(state.mat, state.eta, specCol, V, L, H, pdf);
+                bsdfPdf += pdf * specReflectWt;
+            }
+
+            if (specRefractWt > 0.0f && L.z < 0.0f)
+            {
+                f += EvalSpecRefraction(state.mat, state.eta, V, L, H, pdf);
+                bsdfPdf += pdf * specRefractWt;
+            }
+
+            if (clearcoatWt > 0.0f && L.z > 0.0f && V.z > 0.0f)
+            {
+                f += EvalClearcoat(state.mat, V, L, H, pdf);
+                bsdfPdf += pdf * clearcoatWt;
+            }
+
+            return f * fabsf(L.z);
+        }
+    }
+
+    // State of one sample while it is traced. Holds the random number sequence of its pixel
+    struct CpuPathTracer
+    {
+        CpuPathTracer(const CpuRenderer& renderer, int x, int y, int sampleIndex)
+            : renderer(renderer), scene(*renderer.scene), options(renderer.scene->renderOptions), sampler(x, y, sampleIndex + 1) {}
+
+        const CpuRenderer& renderer;
+        const Scene& scene;
+        const RenderOptions& options;
+        Sampler sampler;
+
+        float Rand() { return sampler.Next(); }
+
+        Vec4 SampleTexture(int texID, const Vec2& texCoord) const;
+        void IntersectLight(int lightIndex, const Ray& r, float& t, int& hitLight, State& state, LightSampleRec& lightSample) const;
+        bool AnyHitLight(int lightIndex, const Ray& r, float maxDist) const;
+        bool ClosestHit(const Ray& r, State& state, LightSampleRec& lightSample) const;
+        bool AnyHit(const Ray& r, float maxDist);
+        int SampleLight(float& pmf);
+        float LightPmf(int lightIndex) const;
+        float MeshLightPdf(int matID) const;
+        void SampleOneLight(const Light& light, const Vec3& scatterPos, LightSampleRec& lightSample);
+        void SampleMeshLight(const Vec3& scatterPos, LightSampleRec& lightSample);
+        int SampleAliasTable(int offset, int count, float& pdf);
+        Vec3 EvalEnvMap(const Ray& r, float& pdf) const;
+        Vec3 SampleEnvMap(Vec3& color, float& pdf);
+        Vec3 EnvMapColor(float u, float v) const;
+        void GetMaterial(State& state, const Ray& r) const;
+        Vec3 DisneySample(const State& state, Vec3 V, const Vec3& N, Vec3& L, float& pdf);
+        Vec3 EvalTransmittance(Ray r, float maxDist);
+        Vec3 DirectLight(const Ray& r, const State& state, bool isSurface);
+        Vec4 PathTrace(Ray r);
+    };
+
+    // Bilinear lookup of the full resolution image with repeat wrapping, like the texture arrays at their base level
+    Vec4 CpuPathTracer::SampleTexture(int texID, const Vec2& texCoord) const
+    {
+        const Texture* texture = scene.textures[texID];
+        if (texture->texData.empty())
+            return Vec4(1.0f, 1.0f, 1.0f, 1.0f);
+
+        int w = texture->width;
+        int h = texture->height;
+        float x = texCoord.x * w - 0.5f;
+        float y = texCoord.y * h - 0.5f;
+        float x0f = floorf(x);
+        float y0f = floorf(y);
+        float fx = x - x0f;
+        float fy = y - y0f;
+
+        int x0 = ((int)x0f % w + w) % w;
+        int y0 = ((int)y0f % h + h) % h;
+        int x1 = (x0 + 1) % w;
+        int y1 = (y0 + 1) % h;
+
+        const unsigned char* data = &texture->texData[0];
+        const unsigned char* p00 = data + (y0 * w + x0) * 4;
+        const unsigned char* p10 = data + (y0 * w + x1) * 4;
+        const unsigned char* p01 = data + (y1 * w + x0) * 4;
+        const unsigned char* p11 = data + (y1 * w + x1) * 4;
+
+        float c[4];
+        for (int i = 0; i < 4; i++)
+        {
+            float top = p00[i] + (p10[i] - p00[i]) * fx;
+            float bottom = p01[i] + (p11[i] - p01[i]) * fx;
+            c[i] = (top + (bottom - top) * fy) * (1.0f / 255.0f);
+        }
+
+        return Vec4(c[0], c[1], c[2], c[3]);
+    }
+
+    void CpuPathTracer::IntersectLight(int lightIndex, const Ray& r, float& t, int& hitLight, State& state, LightSampleRec& lightSample) const
+    {
+        const Light& light = scene.lights[lightIndex];
+        int type = (int)light.type;
+
+        if (type == RectLight)
+        {
+            Vec3 normal = Vec3::Normalize(Vec3::Cross(light.u, light.v));
+            if (Vec3::Dot(normal, r.direction) > 0.0f) // Hide backfacing quad light
+                return;
+            Vec3 u = light.u * (1.0f / Vec3::Dot(light.u, light.u));
+            Vec3 v = light.v * (1.0f / Vec3::Dot(light.v, light.v));
+
+            float d = RectIntersect(light.position, u, v, normal, Vec3::Dot(normal, light.position), r);
+            if (d < 0.0f)
+                d = INF;
+            if (d < t)
+            {
+                t = d;
+                hitLight = lightIndex;
+                float cosTheta = Vec3::Dot(-r.direction, normal);
+                lightSample.pdf = (t * t) / (light.area * cosTheta);
+                lightSample.emission = light.emission;
+                state.isEmitter = true;
+            }
+        }
+
+        if (type == SphereLight)
+        {
+            float d = SphereIntersect(light.radius, light.position, r);
+            if (d < 0.0f)
+                d = INF;
+            if (d < t)
+            {
+                t = d;
+                hitLight = lightIndex;
+                Vec3 hitPt = r.origin + r.direction * t;
+                float cosTheta = Vec3::Dot(-r.direction, Vec3::Normalize(hitPt - light.position));
+                lightSample.pdf = (t * t) / (light.area * cosTheta * 0.5f);
+                lightSample.emission = light.emission;
+                state.isEmitter = true;
+            }
+        }
+    }
+
+    bool CpuPathTracer::AnyHitLight(int lightIndex, const Ray& r, float maxDist) const
+    {
+        const Light& light = scene.lights[lightIndex];
+        int type = (int)light.type;
+
+        if (type == RectLight)
+        {
+            Vec3 normal = Vec3::Normalize(Vec3::Cross(light.u, light.v));
+            Vec3 u = light.u * (1.0f / Vec3::Dot(light.u, light.u));
+            Vec3 v = light.v * (1.0f / Vec3::Dot(light.v, light.v));
+            float d = RectIntersect(light.position, u, v, normal, Vec3::Dot(normal, light.position), r);
+            if (d > 0.0f && d < maxDist)
+                return true;
+        }
+
+        if (type == SphereLight)
+        {
+            float d = SphereIntersect(light.radius, light.position, r);
+            if (d > 0.0f && d < maxDist)
+                return true;
+        }
+
+        return false;
+    }
+
+    bool CpuPathTracer::ClosestHit(const Ray& r, State& state, LightSampleRec& lightSample) const
+    {
+        float t = INF;
+
+        // Intersect emitters
+        int hitLight = -1;
+        if (!(options.hideEmitters && state.depth == 0))
+        {
+            for (int i = 0; i < (int)scene.lights.size(); i++)
+                IntersectLight(i, r, t, hitLight, state, lightSample);
+        }
+
+        // Include the probability of picking the light for next event estimation, for MIS
+        if (hitLight != -1 && state.depth > 0)
+            lightSample.pdf *= LightPmf(hitLight);
+
+        RayHit hit;
+        int hitTri = -1;
+        int hitInstance = -1;
+        Vec3 bary;
+
+        if (renderer.bvhTraversal->ClosestHit(r.origin, r.direction, t, hit))
+        {
+            t = hit.t;
+            hitTri = hit.triID;
+            hitInstance = hit.instanceID;
+            state.matID = hit.matID;
+            bary = Vec3(1.0f - hit.u - hit.v, hit.u, hit.v);
+        }
+
+        // No intersections
+        if (t == INF)
+            return false;
+
+        state.hitDist = t;
+        state.fhp = r.origin + r.direction * t;
+
+        // Ray hit a triangle and not a light source
+        if (hitTri != -1)
+        {
+            state.isEmitter = false;
+
+            const Indices& tri = scene.vertIndices[hitTri];
+            const Vec4& vert0 = scene.verticesUVX[tri.x];
+            const Vec4& vert1 = scene.verticesUVX[tri.y];
+            const Vec4& vert2 = scene.verticesUVX[tri.z];
+            const Vec4& n0 = scene.normalsUVY[tri.x];
+            const Vec4& n1 = scene.normalsUVY[tri.y];
+            const Vec4& n2 = scene.normalsUVY[tri.z];
+
+            // Texture coordinates are in the w of vertices and normals
+            Vec2 t0(vert0.w, n0.w);
+            Vec2 t1(vert1.w, n1.w);
+            Vec2 t2(vert2.w, n2.w);
+
+            state.texCoord = Vec2(t0.x * bary.x + t1.x * bary.y + t2.x * bary.z, t0.y * bary.x + t1.y * bary.y + t2.y * bary.z);
+            Vec3 normal = Vec3::Normalize(Vec3(n0) * bary.x + Vec3(n1) * bary.y + Vec3(n2) * bary.z);
+
+            const Mat4& transform = scene.transforms[hitInstance];
+            state.normal = Vec3::Normalize(TransformNormal(renderer.bvhTraversal->GetInverseTransform(hitInstance), normal));
+            state.ffnormal = Vec3::Dot(state.normal, r.direction) <= 0.0f ? state.normal : -state.normal;
+
+            // Calculate tangent and bitangent
+            Vec3 deltaPos1 = Vec3(vert1) - Vec3(vert0);
+            Vec3 deltaPos2 = Vec3(vert2) - Vec3(vert0);
+
+            Vec2 deltaUV1(t1.x - t0.x, t1.y - t0.y);
+            Vec2 deltaUV2(t2.x - t0.x, t2.y - t0.y);
+
+            float invdet = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
+
+            state.tangent = Vec3::Normalize(transform.TransformVector((deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * invdet));
+            state.bitangent = Vec3::Normalize(transform.TransformVector((deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * invdet));
+
+            if (!scene.meshLights.empty())
+            {
+                // Solid angle pdf of sampling the hit point as part of an emissive mesh, for MIS
+                Vec3 worldNormal = Vec3::Cross(transform.TransformVector(deltaPos1), transform.TransformVector(deltaPos2));
+                float worldArea = Vec3::Length(worldNormal);
+                float cosTheta = fabsf(Vec3::Dot(worldNormal, r.direction)) / std::max(worldArea, 1e-12f);
+                lightSample.pdf = cosTheta > 0.0f ? MeshLightPdf(state.matID) * t * t / cosTheta : 0.0f;
+            }
+        }
+
+        return true;
+    }
+
+    bool CpuPathTracer::AnyHit(const Ray& r, float maxDist)
+    {
+        for (int i = 0; i < (int)scene.lights.size(); i++)
+        {
+            if (AnyHitLight(i, r, maxDist))
+                return true;
+        }
+
+        // Shadow rays only pass through alpha tested surfaces when there are no media, like in the shaders
+        if (!renderer.enableAlphaTest || renderer.enableMedium)
+            return renderer.bvhTraversal->AnyHit(r.origin, r.direction, maxDist);
+
+        // Ignore intersection and continue ray based on alpha test
+        auto alphaTest = [this](const RayHit& hit)
+        {
+            const Material& mat = scene.materials[hit.matID];
+            if ((int)mat.alphaMode == AlphaMode::Opaque)
+                return true;
+
+            float opacity = mat.opacity;
+            if (mat.baseColorTexId >= 0.0f)
+            {
+                const Indices& tri = scene.vertIndices[hit.triID];
+                float w = 1.0f - hit.u - hit.v;
+                Vec2 texCoord(scene.verticesUVX[tri.x].w * w + scene.verticesUVX[tri.y].w * hit.u + scene.verticesUVX[tri.z].w * hit.v,
+                              scene.normalsUVY[tri.x].w * w + scene.normalsUVY[tri.y].w * hit.u + scene.normalsUVY[tri.z].w * hit.v);
+                opacity *= SampleTexture((int)mat.baseColorTexId, texCoord).w;
+            }
+
+            return !(((int)mat.alphaMode == AlphaMode::Mask && opacity < mat.alphaCutoff) ||
+                     ((int)mat.alphaMode == AlphaMode::Blend && Rand() > opacity));
+        };
+
+        return renderer.bvhTraversal->AnyHit(r.origin, r.direction, maxDist, alphaTest);
+    }
+
+    // Lights are picked by power from the alias table. The table isn't built with the light BVH,
+    // which can't be walked here, so lights are picked uniformly then
+    int CpuPathTracer::SampleLight(float& pmf)
+    {
+        int numLights = (int)scene.lights.size();
+        int i = std::min((int)(Rand() * numLights), numLights - 1);
+
+        if (scene.lightAliasTable.empty())
+        {
+            pmf = 1.0f / numLights;
+            return i;
+        }
+
+        const AliasEntry& entry = scene.lightAliasTable[i];
+        if (Rand() < entry.threshold)
+        {
+            pmf = entry.pdf;
+            return i;
+        }
+        pmf = entry.aliasPdf;
+        return entry.alias;
+    }
+
+    float CpuPathTracer::LightPmf(int lightIndex) const
+    {
+        if (scene.lightAliasTable.empty())
+            return 1.0f / scene.lights.size();
+        return scene.lightAliasTable[lightIndex].pdf;
+    }
+
+    float CpuPathTracer::MeshLightPdf(int matID) const
+    {
+        if (scene.meshLightsPower <= 0.0f)
+            return 0.0f;
+
+        const Material& mat = scene.materials[matID];
+        float density = mat.emissionmapTexID >= 0.0f ? 1.0f : Luminance(mat.emission);
+        return density / scene.meshLightsPower;
+    }
+
+    void CpuPathTracer::SampleOneLight(const Light& light, const Vec3& scatterPos, LightSampleRec& lightSample)
+    {
+        int type = (int)light.type;
+
+        if (type == RectLight)
+        {
+            float r1 = Rand();
+            float r2 = Rand();
+
+            Vec3 lightSurfacePos = light.position + light.u * r1 + light.v * r2;
+            lightSample.direction = lightSurfacePos - scatterPos;
+            lightSample.dist = Vec3::Length(lightSample.direction);
+            float distSq = lightSample.dist * lightSample.dist;
+            lightSample.direction = lightSample.direction / lightSample.dist;
+            lightSample.normal = Vec3::Normalize(Vec3::Cross(light.u, light.v));
+            lightSample.emission = light.emission;
+            lightSample.pdf = distSq / (light.area * fabsf(Vec3::Dot(lightSample.normal, lightSample.direction)));
+        }
+        else if (type == SphereLight)
+        {
+            float r1 = Rand();
+            float r2 = Rand();
+
+            Vec3 sphereCentertoSurface = scatterPos - light.position;
+            float distToSphereCenter = Vec3::Length(sphereCentertoSurface);
+
+            // Currently assumes the light will be hit only from the outside
+            sphereCentertoSurface = sphereCentertoSurface / distToSphereCenter;
+            Vec3 sampledDir = UniformSampleHemisphere(r1, r2);
+            Vec3 T, B;
+            Onb(sphereCentertoSurface, T, B);
+            sampledDir = T * sampledDir.x + B * sampledDir.y + sphereCentertoSurface * sampledDir.z;
+
+            Vec3 lightSurfacePos = light.position + sampledDir * light.radius;
+
+            lightSample.direction = lightSurfacePos - scatterPos;
+            lightSample.dist = Vec3::Length(lightSample.direction);
+            float distSq = lightSample.dist * lightSample.dist;
+
+            lightSample.direction = lightSample.direction / lightSample.dist;
+            lightSample.normal = Vec3::Normalize(lightSurfacePos - light.position);
+            lightSample.emission = light.emission;
+            lightSample.pdf = distSq / (light.area * 0.5f * fabsf(Vec3::Dot(lightSample.normal, lightSample.direction)));
+        }
+        else
+        {
+            lightSample.direction = Vec3::Normalize(light.position);
+            lightSample.normal = Vec3::Normalize(scatterPos - light.position);
+            lightSample.emission = light.emission;
+            lightSample.dist = INF;
+            lightSample.pdf = 1.0f;
+        }
+    }
+
+    void CpuPathTracer::SampleMeshLight(const Vec3& scatterPos, LightSampleRec& lightSample)
+    {
+        int numMeshLights = (int)scene.meshLights.size();
+        int i = std::min((int)(Rand() * numMeshLights), numMeshLights - 1);
+
+        const AliasEntry& entry = scene.meshLights[i].entry;
+        float areaPdf = entry.pdf;
+        if (Rand() >= entry.threshold)
+        {
+            i = entry.alias;
+            areaPdf = entry.aliasPdf;
+        }
+
+        const MeshLight& meshLight = scene.meshLights[i];
+
+        // Uniform point on the triangle
+        float r1 = sqrtf(Rand());
+        float r2 = Rand();
+        Vec3 bary(1.0f - r1, r1 * (1.0f - r2), r1 * r2);
+        Vec3 lightSurfacePos = meshLight.v0 + meshLight.e1 * bary.y + meshLight.e2 * bary.z;
+
+        lightSample.direction = lightSurfacePos - scatterPos;
+        lightSample.dist = Vec3::Length(lightSample.direction);
+        lightSample.direction = lightSample.direction / lightSample.dist;
+
+        // Meshes emit from both sides
+        Vec3 normal = Vec3::Normalize(Vec3::Cross(meshLight.e1, meshLight.e2));
+        float cosTheta = fabsf(Vec3::Dot(lightSample.direction, normal));
+        lightSample.normal = FaceForward(-lightSample.direction, normal);
+        lightSample.pdf = cosTheta > 0.0f ? areaPdf * lightSample.dist * lightSample.dist / cosTheta : 0.0f;
+
+        const Material& mat = scene.materials[meshLight.matID];
+        if (mat.emissionmapTexID >= 0.0f)
+        {
+            int v = meshLight.firstVertex;
+            Vec2 texCoord(scene.verticesUVX[v].w * bary.x + scene.verticesUVX[v + 1].w * bary.y + scene.verticesUVX[v + 2].w * bary.z,
+                          scene.normalsUVY[v].w * bary.x + scene.normalsUVY[v + 1].w * bary.y + scene.normalsUVY[v + 2].w * bary.z);
+            lightSample.emission = Vec3::Pow(Vec3(SampleTexture((int)mat.emissionmapTexID, texCoord)), 2.2f);
+        }
+        else
+            lightSample.emission = mat.emission;
+    }
+
+    int CpuPathTracer::SampleAliasTable(int offset, int count, float& pdf)
+    {
+        int index = std::min((int)(Rand() * count), count - 1);
+        const AliasEntry& entry = scene.envMap->aliasTable[offset + index];
+        if (Rand() < entry.threshold)
+        {
+            pdf = entry.pdf;
+            return index;
+        }
+        pdf = entry.aliasPdf;
+        return entry.alias;
+    }
+
+    // Bilinear lookup of the environment map with repeat wrapping
+    Vec3 CpuPathTracer::EnvMapColor(float u, float v) const
+    {
+        const EnvironmentMap* envMap = scene.envMap;
+        int w = envMap->width;
+        int h = envMap->height;
+        float x = u * w - 0.5f;
+        float y = v * h - 0.5f;
+        float x0f = floorf(x);
+        float y0f = floorf(y);
+        float fx = x - x0f;
+        float fy = y - y0f;
+
+        int x0 = ((int)x0f % w + w) % w;
+        int y0 = ((int)y0f % h + h) % h;
+        int x1 = (x0 + 1) % w;
+        int y1 = (y0 + 1) % h;
+
+        const float* img = envMap->img;
+        const float* p00 = img + (y0 * w + x0) * 3;
+        const float* p10 = img + (y0 * w + x1) * 3;
+        const float* p01 = img + (y1 * w + x0) * 3;
+        const float* p11 = img + (y1 * w + x1) * 3;
+
+        Vec3 top = Mix(Vec3(p00[0], p00[1], p00[2]), Vec3(p10[0], p10[1], p10[2]), fx);
+        Vec3 bottom = Mix(Vec3(p01[0], p01[1], p01[2]), Vec3(p11[0], p11[1], p11[2]), fx);
+        return Mix(top, bottom, fy);
+    }
+
+    Vec3 CpuPathTracer::EvalEnvMap(const Ray& r, float& pdf) const
+    {
+        const EnvironmentMap* envMap = scene.envMap;
+        float theta = acosf(Math::Clamp(r.direction.y, -1.0f, 1.0f));
+        float u = (PI + atan2f(r.direction.z, r.direction.x)) * INV_TWO_PI + options.envMapRot;
+        float v = theta * INV_PI;
+
+        int cellX = std::min((int)((u - floorf(u)) * envMap->importanceWidth), envMap->importanceWidth - 1);
+        int cellY = std::min((int)(v * envMap->importanceHeight), envMap->importanceHeight - 1);
+        float uvPdf = envMap->aliasTable[cellY * envMap->importanceWidth + cellX].pdf;
+
+        float sinTheta = sinf(theta);
+        pdf = sinTheta == 0.0f ? 0.0f : uvPdf / (TWO_PI * PI * sinTheta);
+        return EnvMapColor(u, v);
+    }
+
+    Vec3 CpuPathTracer::SampleEnvMap(Vec3& color, float& pdf)
+    {
+        // Pick a row from the marginal distribution, then a cell from the row's conditional distribution
+        const EnvironmentMap* envMap = scene.envMap;
+        int w = envMap->importanceWidth;
+        int h = envMap->importanceHeight;
+
+        float rowPdf, uvPdf;
+        int y = SampleAliasTable(w * h, h, rowPdf);
+        int x = SampleAliasTable(y * w, w, uvPdf);
+
+        float u = (x + Rand()) / w;
+        float v = (y + Rand()) / h;
+        color = EnvMapColor(u, v);
+        u -= options.envMapRot;
+
+        float phi = u * TWO_PI;
+        float theta = v * PI;
+        float sinTheta = sinf(theta);
+        pdf = sinTheta == 0.0f ? 0.0f : uvPdf / (TWO_PI * PI * sinTheta);
+        return Vec3(-sinTheta * cosf(phi), cosf(theta), -sinTheta * sinf(phi));
+    }
+
+    void CpuPathTracer::GetMaterial(State& state, const Ray& r) const
+    {
+        const Material& src = scene.materials[state.matID];
+        ShadingMaterial mat;
+
+        mat.baseColor = src.baseColor;
+        mat.emission = src.emission;
+        mat.metallic = src.metallic;
+        mat.roughness = std::max(src.roughness, 0.001f);
+        mat.subsurface = src.subsurface;
+        mat.specularTint = src.specularTint;
+        mat.sheen = src.sheen;
+        mat.sheenTint = src.sheenTint;
+        mat.clearcoat = src.clearcoat;
+        mat.clearcoatRoughness = Mix(0.1f, 0.001f, src.clearcoatGloss); // Remapping from gloss to roughness
+        mat.specTrans = src.specTrans;
+        mat.ior = src.ior;
+        mat.medium.type = (int)src.mediumType;
+        mat.medium.density = src.mediumDensity;
+        mat.medium.color = src.mediumColor;
+        mat.medium.anisotropy = Math::Clamp(src.mediumAnisotropy, -0.9f, 0.9f);
+        mat.opacity = src.opacity;
+        mat.alphaMode = (int)src.alphaMode;
+        mat.alphaCutoff = src.alphaCutoff;
+
+        // Base Color Map
+        if (src.baseColorTexId >= 0.0f)
+        {
+            Vec4 col = SampleTexture((int)src.baseColorTexId, state.texCoord);
+            mat.baseColor = mat.baseColor * Vec3::Pow(Vec3(col), 2.2f);
+            mat.opacity *= col.w;
+        }
+
+        // Metallic Roughness Map
+        if (src.metallicRoughnessTexID >= 0.0f)
+        {
+            Vec4 matRgh = SampleTexture((int)src.metallicRoughnessTexID, state.texCoord);
+            mat.metallic = matRgh.z;
+            mat.roughness = std::max(matRgh.y * matRgh.y, 0.001f);
+        }
+
+        // Normal Map
+        if (src.normalmapTexID >= 0.0f)
+        {
+            Vec3 texNormal = Vec3(SampleTexture((int)src.normalmapTexID, state.texCoord));
+
+            if (options.openglNormalMap)
+                texNormal.y = 1.0f - texNormal.y;
+            texNormal = Vec3::Normalize(texNormal * 2.0f - Vec3(1.0f, 1.0f, 1.0f));
+
+            Vec3 origNormal = state.normal;
+            state.normal = Vec3::Normalize(state.tangent * texNormal.x + state.bitangent * texNormal.y + state.normal * texNormal.z);
+            state.ffnormal = Vec3::Dot(origNormal, r.direction) <= 0.0f ? state.normal : -state.normal;
+        }
+
+        if (options.enableRoughnessMollification && state.depth > 0)
+            mat.roughness = std::max(Mix(0.0f, state.mat.roughness, options.roughnessMollificationAmt), mat.roughness);
+
+        // Emission Map
+        if (src.emissionmapTexID >= 0.0f)
+            mat.emission = Vec3::Pow(Vec3(SampleTexture((int)src.emissionmapTexID, state.texCoord)), 2.2f);
+
+        state.mat = mat;
+        state.eta = Vec3::Dot(r.direction, state.normal) < 0.0f ? (1.0f / mat.ior) : mat.ior;
+    }
+
+    Vec3 CpuPathTracer::DisneySample(const State& state, Vec3 V, const Vec3& N, Vec3& L, float& pdf)
+    {
+        pdf = 0.0f;
+        Vec3 f;
+
+        float r1 = Rand();
+        float r2 = Rand();
+
+        Vec3 T, B;
+        Onb(N, T, B);
+        V = ToLocal(T, B, N, V);
+
+        Vec3 specCol, sheenCol;
+        GetSpecColor(state.mat, state.eta, specCol, sheenCol);
+
+        // Fresnel is approximated with N as H isn't available at this stage
+        float diffuseWt, specReflectWt, specRefractWt, clearcoatWt;
+        float approxFresnel = DisneyFresnel(state.mat, state.eta, V.z, V.z);
+        GetLobeProbabilities(state.mat, specCol, approxFresnel, diffuseWt, specReflectWt, specRefractWt, clearcoatWt);
+
+        // CDF for picking a lobe
+        float cdf[4];
+        cdf[0] = diffuseWt;
+        cdf[1] = cdf[0] + clearcoatWt;
+        cdf[2] = cdf[1] + specReflectWt;
+        cdf[3] = cdf[2] + specRefractWt;
+
+        if (r1 < cdf[0]) // Diffuse Reflection Lobe
+        {
+            r1 /= cdf[0];
+            L = CosineSampleHemisphere(r1, r2);
+
+            Vec3 H = Vec3::Normalize(L + V);
+
+            f = EvalDiffuse(state.mat, sheenCol, V, L, H, pdf);
+            pdf *= diffuseWt;
+        }
+        else if (r1 < cdf[1]) // Clearcoat Lobe
+        {
+            r1 = (r1 - cdf[0]) / (cdf[1] - cdf[0]);
+
+            Vec3 H = SampleGTR1(state.mat.clearcoatRoughness, r1, r2);
+
+            if (H.z < 0.0f)
+                H = -H;
+
+            L = Vec3::Normalize(Reflect(-V, H));
+
+            f = EvalClearcoat(state.mat, V, L, H, pdf);
+            pdf *= clearcoatWt;
+        }
+        else  // Specular Reflection/Refraction Lobes
+        {
+            r1 = (r1 - cdf[1]) / (1.0f - cdf[1]);
+            Vec3 H = SampleGGXVNDF(V, state.mat.roughness, r1, r2);
+
+            if (H.z < 0.0f)
+                H = -H;
+
+            // L isn't known yet, so the metallic Fresnel takes the angle of the mirrored direction, which is that of V
+            float VDotH = Vec3::Dot(V, H);
+            float fresnel = DisneyFresnel(state.mat, state.eta, VDotH, VDotH);
+            float F = 1.0f - ((1.0f - fresnel) * state.mat.specTrans * (1.0f - state.mat.metallic));
+
+            if (Rand() < F)
+            {
+                L = Vec3::Normalize(Reflect(-V, H));
+
+                f = EvalSpecReflection(state.mat, state.eta, specCol, V, L, H, pdf);
+                pdf *= F;
+            }
+            else
+            {
+                L = Vec3::Normalize(Refract(-V, H, state.eta));
+
+                f = EvalSpecRefraction(state.mat, state.eta, V, L, H, pdf);
+                pdf *= 1.0f - F;
+            }
+
+            pdf *= specReflectWt + specRefractWt;
+        }
+
+        L = ToWorld(T, B, N, L);
+        return f * fabsf(Vec3::Dot(N, L));
+    }
+
+    Vec3 CpuPathTracer::EvalTransmittance(Ray r, float maxDist)
+    {
+        LightSampleRec lightSample;
+        State state;
+        Vec3 transmittance(1.0f, 1.0f, 1.0f);
+
+        for (int depth = 0; depth < options.maxDepth; depth++)
+        {
+            bool hit = ClosestHit(r, state, lightSample);
+
+            // If no hit (environment map) or if ray hit a light source then return transmittance
+            if (!hit || state.isEmitter || state.hitDist >= maxDist)
+                break;
+
+            GetMaterial(state, r);
+
+            bool alphatest = (state.mat.alphaMode == AlphaMode::Mask && state.mat.opacity < state.mat.alphaCutoff) || (state.mat.alphaMode == AlphaMode::Blend && Rand() > state.mat.opacity);
+            bool refractive = (1.0f - state.mat.metallic) * state.mat.specTrans > 0.0f;
+
+            // Refraction is ignored (Not physically correct but helps with sampling lights from inside refractive objects)
+            if (!(alphatest || refractive))
+                return Vec3(0.0f, 0.0f, 0.0f);
+
+            // Evaluate transmittance
+            if (Vec3::Dot(r.direction, state.normal) > 0.0f && state.mat.medium.type != MediumType::None)
+            {
+                Vec3 color = state.mat.medium.type == MediumType::Absorb ? Vec3(1.0f, 1.0f, 1.0f) - state.mat.medium.color : Vec3(1.0f, 1.0f, 1.0f);
+                transmittance = transmittance * Exp(-color * (state.mat.medium.density * state.hitDist));
+            }
+
+            // Move ray origin to hit point
+            r.origin = state.fhp + r.direction * EPS;
+            maxDist -= state.hitDist + EPS;
+        }
+
+        return transmittance;
+    }
+
+    Vec3 CpuPathTracer::DirectLight(const Ray& r, const State& state, bool isSurface)
+    {
+        Vec3 Ld;
+        Vec3 Li;
+        Vec3 scatterPos = state.fhp + state.ffnormal * EPS;
+        bool volumeMIS = renderer.enableMedium && options.enableVolumeMIS;
+
+        ScatterSampleRec scatterSample;
+
+        // Scattering towards a light. Volumes use the phase function in place of the BSDF
+        auto evalScatter = [&](const Vec3& lightDir)
+        {
+            if (isSurface)
+                scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightDir, scatterSample.pdf);
+            else
+            {
+                float p = PhaseHG(Vec3::Dot(-r.direction, lightDir), state.medium.anisotropy);
+                scatterSample.f = Vec3(p, p, p);
+                scatterSample.pdf = p;
+            }
+        };
+
+        // Environment Light
+        if (renderer.enableEnvMap && !options.enableUniformLight)
+        {
+            float lightPdf;
+            Vec3 lightDir = SampleEnvMap(Li, lightPdf);
+
+            Ray shadowRay = { scatterPos, lightDir };
+
+            // If there are volumes in the scene then evaluate transmittance rather than a binary anyhit test
+            bool visible = true;
+            if (volumeMIS)
+                Li = Li * EvalTransmittance(shadowRay, INF);
+            else
+                visible = !AnyHit(shadowRay, INF - EPS);
+
+            if (visible)
+            {
+                if (volumeMIS)
+                    evalScatter(lightDir);
+                else
+                    scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightDir, scatterSample.pdf);
+
+                if (scatterSample.pdf > 0.0f)
+                {
+                    float misWeight = PowerHeuristic(lightPdf, scatterSample.pdf);
+                    if (misWeight > 0.0f)
+                        Ld += Li * scatterSample.f * (misWeight * options.envMapIntensity / lightPdf);
+                }
+            }
+        }
+
+        // Analytic Lights
+        if (!scene.lights.empty())
+        {
+            LightSampleRec lightSample;
+
+            // Pick a light to sample
+            float lightPmf;
+            const Light& light = scene.lights[SampleLight(lightPmf)];
+
+            SampleOneLight(light, scatterPos, lightSample);
+            lightSample.pdf *= lightPmf;
+            Li = lightSample.emission;
+
+            if (lightPmf > 0.0f && Vec3::Dot(lightSample.direction, lightSample.normal) < 0.0f) // Required for quad lights with single sided emission
+            {
+                Ray shadowRay = { scatterPos, lightSample.direction };
+
+                bool visible = true;
+                if (volumeMIS)
+                    Li = Li * EvalTransmittance(shadowRay, lightSample.dist);
+                else
+                    visible = !AnyHit(shadowRay, lightSample.dist - EPS);
+
+                if (visible)
+                {
+                    if (volumeMIS)
+                        evalScatter(lightSample.direction);
+                    else
+                        scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightSample.direction, scatterSample.pdf);
+
+                    float misWeight = 1.0f;
+                    if (light.area > 0.0f) // No MIS for distant light
+                        misWeight = PowerHeuristic(lightSample.pdf, scatterSample.pdf);
+
+                    if (scatterSample.pdf > 0.0f)
+                        Ld += Li * scatterSample.f * (misWeight / lightSample.pdf);
+                }
+            }
+        }
+
+        // Emissive meshes
+        if (!scene.meshLights.empty())
+        {
+            LightSampleRec lightSample;
+            SampleMeshLight(scatterPos, lightSample);
+            Li = lightSample.emission;
+
+            if (lightSample.pdf > 0.0f)
+            {
+                // The emitter is part of the scene geometry, so the shadow ray stops short of it
+                Ray shadowRay = { scatterPos, lightSample.direction };
+
+                bool visible = true;
+                if (volumeMIS)
+                    Li = Li * EvalTransmittance(shadowRay, lightSample.dist - EPS);
+                else
+                    visible = !AnyHit(shadowRay, lightSample.dist - EPS);
+
+                if (visible)
+                {
+                    if (volumeMIS)
+                        evalScatter(lightSample.direction);
+                    else
+                        scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightSample.direction, scatterSample.pdf);
+
+                    if (scatterSample.pdf > 0.0f)
+                        Ld += Li * scatterSample.f * (PowerHeuristic(lightSample.pdf, scatterSample.pdf) / lightSample.pdf);
+                }
+            }
+        }
+
+        return Ld;
+    }
+
+    Vec4 CpuPathTracer::PathTrace(Ray r)
+    {
+        Vec3 radiance;
+        Vec3 throughput(1.0f, 1.0f, 1.0f);
+        State state;
+        LightSampleRec lightSample;
+        ScatterSampleRec scatterSample;
+
+        float alpha = 1.0f;
+
+        // For medium tracking
+        bool inMedium = false;
+        bool mediumSampled = false;
+        bool surfaceScatter = false;
+
+        // Without volume MIS, paths that were last scattered by a medium take the full contribution of what they hit
+        bool medium = renderer.enableMedium;
+        bool volumeMIS = medium && options.enableVolumeMIS;
+
+        for (state.depth = 0;; state.depth++)
+        {
+            bool hit = ClosestHit(r, state, lightSample);
+
+            if (!hit)
+            {
+                if ((options.enableBackground || options.transparentBackground) && state.depth == 0)
+                    alpha = 0.0f;
+
+                if (!(options.hideEmitters && state.depth == 0))
+                {
+                    if (options.enableUniformLight)
+                        radiance += options.uniformLightCol * throughput;
+                    else if (renderer.enableEnvMap)
+                    {
+                        float envMapPdf;
+                        Vec3 envMapCol = EvalEnvMap(r, envMapPdf);
+
+                        // Gather radiance from envmap and use scatterSample.pdf from previous bounce for MIS
+                        float misWeight = 1.0f;
+                        if (state.depth > 0)
+                            misWeight = PowerHeuristic(scatterSample.pdf, envMapPdf);
+
+                        if (medium && !volumeMIS && !surfaceScatter)
+                            misWeight = 1.0f;
+
+                        if (misWeight > 0.0f)
+                            radiance += envMapCol * throughput * (misWeight * options.envMapIntensity);
+                    }
+                }
+                break;
+            }
+
+            GetMaterial(state, r);
+
+            // Gather radiance from emissive objects
+            {
+                float misWeight = 1.0f;
+
+                // Emissive meshes are also reached by next event estimation, so use scatterSample.pdf from previous bounce for MIS
+                if (!scene.meshLights.empty() && state.depth > 0 && !state.isEmitter)
+                    misWeight = PowerHeuristic(scatterSample.pdf, lightSample.pdf);
+
+                if (medium && !volumeMIS && !surfaceScatter)
+                    misWeight = 1.0f;
+
+                radiance += state.mat.emission * throughput * misWeight;
+            }
+
+            // Gather radiance from light and use scatterSample.pdf from previous bounce for MIS
+            if (state.isEmitter)
+            {
+                float misWeight = 1.0f;
+
+                if (state.depth > 0)
+                    misWeight = PowerHeuristic(scatterSample.pdf, lightSample.pdf);
+
+                if (medium && !volumeMIS && !surfaceScatter)
+                    misWeight = 1.0f;
+
+                radiance += lightSample.emission * throughput * misWeight;
+
+                break;
+            }
+
+            // Stop tracing ray if maximum depth was reached
+            if (state.depth == options.maxDepth)
+                break;
+
+            mediumSampled = false;
+            surfaceScatter = false;
+
+            // Handle absorption/emission/scattering from medium
+            if (medium && inMedium)
+            {
+                if (state.medium.type == MediumType::Absorb)
+                {
+                    throughput = throughput * Exp(-(Vec3(1.0f, 1.0f, 1.0f) - state.medium.color) * (state.hitDist * state.medium.density));
+                }
+                else if (state.medium.type == MediumType::Emissive)
+                {
+                    radiance += state.medium.color * throughput * (state.hitDist * state.medium.density);
+                }
+                else
+                {
+                    // Sample a distance in the medium
+                    float scatterDist = std::min(-logf(Rand()) / state.medium.density, state.hitDist);
+                    mediumSampled = scatterDist < state.hitDist;
+
+                    if (mediumSampled)
+                    {
+                        throughput = throughput * state.medium.color;
+
+                        // Move ray origin to scattering position
+                        r.origin = r.origin + r.direction * scatterDist;
+                        state.fhp = r.origin;
+
+                        // Transmittance Evaluation
+                        radiance += DirectLight(r, state, false) * throughput;
+
+                        // Pick a new direction based on the phase function
+                        float r1 = Rand();
+                        float r2 = Rand();
+                        Vec3 scatterDir = SampleHG(-r.direction, state.medium.anisotropy, r1, r2);
+                        scatterSample.pdf = PhaseHG(Vec3::Dot(-r.direction, scatterDir), state.medium.anisotropy);
+                        r.direction = scatterDir;
+                    }
+                }
+            }
+
+            // If medium was not sampled then proceed with surface BSDF evaluation
+            if (!mediumSampled)
+            {
+                // Ignore intersection and continue ray based on alpha test
+                if (renderer.enableAlphaTest &&
+                    ((state.mat.alphaMode == AlphaMode::Mask && state.mat.opacity < state.mat.alphaCutoff) ||
+                     (state.mat.alphaMode == AlphaMode::Blend && Rand() > state.mat.opacity)))
+                {
+                    scatterSample.L = r.direction;
+                    state.depth--;
+                }
+                else
+                {
+                    surfaceScatter = true;
+
+                    // Next event estimation
+                    radiance += DirectLight(r, state, true) * throughput;
+
+                    // Sample BSDF for color and outgoing direction
+                    scatterSample.f = DisneySample(state, -r.direction, state.ffnormal, scatterSample.L, scatterSample.pdf);
+                    if (scatterSample.pdf > 0.0f)
+                        throughput = throughput * scatterSample.f / scatterSample.pdf;
+                    else
+                        break;
+                }
+
+                // Move ray origin to hit point and set direction for next bounce
+                r.direction = scatterSample.L;
+                r.origin = state.fhp + r.direction * EPS;
+
+                if (medium)
+                {
+                    // Ray is in medium only if it is entering a surface containing a medium
+                    if (Vec3::Dot(r.direction, state.normal) < 0.0f && state.mat.medium.type != MediumType::None)
+                    {
+                        inMedium = true;
+                        state.medium = state.mat.medium;
+                    }
+                    else if (state.mat.medium.type != MediumType::None)
+                        inMedium = false;
+                }
+            }
+
+            // Russian roulette
+            if (options.enableRR && state.depth >= options.RRDepth)
+            {
+                float q = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)) + 0.001f, 0.95f);
+                if (Rand() > q)
+                    break;
+                throughput = throughput / q;
+            }
+        }
+
+        return Vec4(radiance.x, radiance.y, radiance.z, alpha);
+    }
+
+    CpuRenderer::CpuRenderer(Scene* scene, int numThreads) : scene(scene), sampleIndex(0)
+    {
+        // Textures are sampled from the decoded images, so they must not be freed once processed
+        if (!scene->initialized)
+        {
+            scene->renderOptions.freeCPUData = false;
+            scene->ProcessScene();
+        }
+        else if (scene->renderOptions.freeCPUData)
+            printf("Scene textures were freed after upload and will render white on the CPU\n");
+
+        // Textures are read straight from the decoded images, so the updates meant for the GPU are dropped
+        scene->WaitForTextures();
+        std::vector<TextureUpdate> textureUpdates;
+        scene->TakeTextureUpdates(textureUpdates);
+
+        if (scene->vertIndices.empty() && !scene->LoadMeshData())
+            printf("Mesh data is not available for CPU rendering\n");
+
+        bvhTraversal = new BvhTraversal(scene);
+
+        enableEnvMap = scene->renderOptions.enableEnvMap && scene->envMap != nullptr && scene->envMap->img != nullptr;
+
+        enableAlphaTest = false;
+        enableMedium = false;
+        for (const Material& material : scene->materials)
+        {
+            enableAlphaTest |= (int)material.alphaMode != AlphaMode::Opaque;
+            enableMedium |= (int)material.mediumType != MediumType::None;
+        }
+
+        renderSize = scene->renderOptions.renderResolution;
+        accumBuffer.resize(renderSize.x * renderSize.y);
+
+        tileSize = iVec2(std::max(scene->renderOptions.tileWidth, 1), std::max(scene->renderOptions.tileHeight, 1));
+        numTiles = iVec2((renderSize.x + tileSize.x - 1) / tileSize.x, (renderSize.y + tileSize.y - 1) / tileSize.y);
+        tileSamples.resize(numTiles.x * numTiles.y);
+        tileLastPasses.resize(numTiles.x * numTiles.y);
+
+        numWorkers = numThreads > 0 ? numThreads : std::max((int)std::thread::hardware_concurrency(), 1);
+        threadPool = new ThreadPool(numWorkers);
+        tileQueues = std::vector<TileQueue>(numWorkers);
+    }
+
+    CpuRenderer::~CpuRenderer()
+    {
+        delete threadPool;
+        delete bvhTraversal;
+    }
+
+    int CpuRenderer::GetSampleCount()
+    {
+        return *std::min_element(tileSamples.begin(), tileSamples.end());
+    }
+
+    void CpuRenderer::Render(int spp)
+    {
+        // Tiles are dealt out round robin, so every thread starts with tiles from all over the image
+        int next = 0;
+        for (int y = 0; y < renderSize.y; y += tileSize.y)
+        {
+            for (int x = 0; x < renderSize.x; x += tileSize.x)
+            {
+                Tile tile = { x, y, std::min(tileSize.x, renderSize.x - x), std::min(tileSize.y, renderSize.y - y) };
+                tileQueues[next].tiles.push_back(tile);
+                next = (next + 1) % numWorkers;
+            }
+        }
+
+        for (int i = 0; i < numWorkers; i++)
+            threadPool->Submit([this, i, spp]() { RenderTiles(i, spp); });
+        threadPool->Wait();
+
+        // Every tile is rendered spp times, like spp passes of the GPU renderer
+        for (size_t i = 0; i < tileSamples.size(); i++)
+        {
+            tileSamples[i] += spp;
+            tileLastPasses[i] += spp;
+        }
+        sampleIndex += spp;
+    }
+
+    bool CpuRenderer::NextTile(int worker, Tile& tile)
+    {
+        {
+            std::lock_guard<std::mutex> lock(tileQueues[worker].mutex);
+            if (!tileQueues[worker].tiles.empty())
+            {
+                tile = tileQueues[worker].tiles.front();
+                tileQueues[worker].tiles.pop_front();
+                return true;
+            }
+        }
+
+        // Steal from the other threads, starting with the next one so thieves spread out
+        for (int i = 1; i < numWorkers; i++)
+        {
+            TileQueue& victim = tileQueues[(worker + i) % numWorkers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tiles.empty())
+            {
+                tile = victim.tiles.back();
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void CpuRenderer::RenderTiles(int worker, int spp)
+    {
+        Tile tile;
+        while (NextTile(worker, tile))
+        {
+            for (int y = tile.y; y < tile.y + tile.height; y++)
+            {
+                for (int x = tile.x; x < tile.x + tile.width; x++)
+                {
+                    Vec4& accum = accumBuffer[y * renderSize.x + x];
+                    for (int s = 0; s < spp; s++)
+                    {
+                        Vec4 color = TracePixel(x, y, sampleIndex + s);
+                        accum = Vec4(accum.x + color.x, accum.y + color.y, accum.z + color.z, accum.w + color.w);
+                    }
+                }
+            }
+        }
+    }
+
+    Vec4 CpuRenderer::TracePixel(int x, int y, int sampleIndex)
+    {
+        CpuPathTracer tracer(*this, x, y, sampleIndex);
+        const Camera* camera = scene->camera;
+
+        // Tent filtered jitter around the pixel center, as in tile.glsl
+        float r1 = 2.0f * tracer.Rand();
+        float r2 = 2.0f * tracer.Rand();
+
+        float jitterX = r1 < 1.0f ? sqrtf(r1) - 1.0f : 1.0f - sqrtf(2.0f - r1);
+        float jitterY = r2 < 1.0f ? sqrtf(r2) - 1.0f : 1.0f - sqrtf(2.0f - r2);
+
+        float dx = (x + 0.5f) / renderSize.x * 2.0f - 1.0f + jitterX / (renderSize.x * 0.5f);
+        float dy = (y + 0.5f) / renderSize.y * 2.0f - 1.0f + jitterY / (renderSize.y * 0.5f);
+
+        float scale = tanf(camera->fov * 0.5f);
+        dy *= (float)renderSize.y / renderSize.x * scale;
+        dx *= scale;
+        Vec3 rayDir = Vec3::Normalize(camera->right * dx + camera->up * dy + camera->forward);
+
+        Vec3 focalPoint = rayDir * camera->focalDist;
+        float camR1 = tracer.Rand() * TWO_PI;
+        float camR2 = tracer.Rand() * camera->aperture;
+        Vec3 randomAperturePos = (camera->right * cosf(camR1) + camera->up * sinf(camR1)) * sqrtf(camR2);
+        Vec3 finalRayDir = Vec3::Normalize(focalPoint - randomAperturePos);
+
+        Ray ray = { camera->position + randomAperturePos, finalRayDir };
+        return tracer.PathTrace(ray);
+    }
+
+    void CpuRenderer::GetOutputBuffer(unsigned char** data, int& w, int& h)
+    {
+        const RenderOptions& options = scene->renderOptions;
+        w = renderSize.x;
+        h = renderSize.y;
+        *data = new unsigned char[w * h * 4];
+
+        // Same tonemapping and background blend as tonemap.glsl
+        for (int y = 0; y < h; y++)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                int samples = tileSamples[(y / tileSize.y) * numTiles.x + x / tileSize.x];
+                float invSampleCounter = samples > 0 ? 1.0f / samples : 0.0f;
+                const Vec4& accum = accumBuffer[y * w + x];
+                Vec3 color = Vec3(accum) * invSampleCounter;
+                float alpha = accum.w * invSampleCounter;
+
+                if (options.enableTonemap)
+                {
+                    if (options.enableAces)
+                    {
+                        if (options.simpleAcesFit)
+                            color = ACES(color);
+                        else
+                            color = ACESFitted(color);
+                    }
+                    else
+                        color = color * (1.0f / (1.0f + Luminance(color) / 1.5f));
+                }
+
+                color = Vec3::Pow(Vec3::Max(color, Vec3(0.0f, 0.0f, 0.0f)), 1.0f / 2.2f);
+
+                float outAlpha = 1.0f;
+                Vec3 bgCol = options.backgroundCol;
+
+                if (options.transparentBackground)
+                {
+                    outAlpha = alpha;
+                    bool odd = ((x / 10) + (y / 10)) % 2 == 1;
+                    bgCol = odd ? Vec3(0.2f, 0.2f, 0.2f) : Vec3(0.1f, 0.1f, 0.1f);
+                }
+
+                if (options.enableBackground || options.transparentBackground)
+                    color = Mix(bgCol, color, alpha);
+
+                unsigned char* out = *data + (y * w + x) * 4;
+                out[0] = (unsigned char)(Math::Clamp(color.x, 0.0f, 1.0f) * 255.0f + 0.5f);
+                out[1] = (unsigned char)(Math::Clamp(color.y, 0.0f, 1.0f) * 255.0f + 0.5f);
+                out[2] = (unsigned char)(Math::Clamp(color.z, 0.0f, 1.0f) * 255.0f + 0.5f);
+                out[3] = (unsigned char)(Math::Clamp(outAlpha, 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    void CpuRenderer::GetCheckpoint(Checkpoint& checkpoint)
+    {
+        checkpoint.sceneHash = scene->Hash();
+        checkpoint.renderSize = renderSize;
+        checkpoint.numTiles = numTiles;
+        checkpoint.sampleCounter = *std::max_element(tileLastPasses.begin(), tileLastPasses.end()) + 1;
+        checkpoint.frameCounter = sampleIndex;
+        checkpoint.tileSamples = tileSamples;
+        checkpoint.tileLastPasses = tileLastPasses;
+        checkpoint.accum = accumBuffer;
+    }
+
+    bool CpuRenderer::SaveCheckpoint(const std::string& filename)
+    {
+        Checkpoint checkpoint;
+        GetCheckpoint(checkpoint);
+        return WriteCheckpoint(checkpoint, filename);
+    }
+
+    bool CpuRenderer::AddCheckpoint(const std::string& filename)
+    {
+        Checkpoint other;
+        if (!ReadCheckpoint(filename, other))
+            return false;
+
+        Checkpoint checkpoint;
+        GetCheckpoint(checkpoint);
+        if (!MergeCheckpoint(checkpoint, other))
+            return false;
+
+        accumBuffer.swap(checkpoint.accum);
+        tileSamples.swap(checkpoint.tileSamples);
+        tileLastPasses.swap(checkpoint.tileLastPasses);
+        sampleIndex = checkpoint.frameCounter;
+
+        return true;
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include "Vec2.h"
+#include "Vec3.h"
+#include "Vec4.h"
+#include "ThreadPool.h"
+
+namespace GLSLPT
+{
+    class Scene;
+    class BvhTraversal;
+    struct Checkpoint;
+
+    // Path tracer that runs on the CPU with the integrator of the GLSL kernels. It needs no GL context, so machines
+    // without a GPU can render, and serves as a reference for the shaders.
+    // Samples are summed into an RGBA float buffer laid out like the accumulation texture, bottom row first
+    class CpuRenderer
+    {
+    public:
+        CpuRenderer(Scene* scene, int numThreads = 0);
+        ~CpuRenderer();
+
+        // Adds spp samples to every pixel. Tiles are spread over all threads and idle threads steal tiles from busy ones
+        void Render(int spp = 1);
+
+        // Samples of the pixels with the fewest, as checkpoints may have more samples in some tiles
+        int GetSampleCount();
+        void GetOutputBuffer(unsigned char**, int& w, int& h);
+
+        const std::vector<Vec4>& GetAccumulation() { return accumBuffer; }
+
+        // Index of the first sample, which seeds the random numbers. Machines rendering the same image are given
+        // ranges that don't overlap, so their checkpoints can be merged
+        void SetSampleOffset(int offset) { sampleIndex = offset; }
+
+        // Writes the samples in the checkpoint format of the GPU renderer, so either one can resume or merge them
+        bool SaveCheckpoint(const std::string& filename);
+
+        // Adds the samples of a checkpoint of this scene to the image. Rendering carries on after its last sample
+        bool AddCheckpoint(const std::string& filename);
+
+    private:
+        struct Tile
+        {
+            int x, y;
+            int width, height;
+        };
+
+        // Tiles waiting to be rendered by one thread. The owner takes tiles from the front and thieves from the back
+        struct TileQueue
+        {
+            std::deque<Tile> tiles;
+            std::mutex mutex;
+        };
+
+        void RenderTiles(int worker, int spp);
+        bool NextTile(int worker, Tile& tile);
+        Vec4 TracePixel(int x, int y, int sampleIndex);
+        void GetCheckpoint(Checkpoint& checkpoint);
+
+        Scene* scene;
+        ThreadPool* threadPool;
+        int numWorkers;
+        std::vector<TileQueue> tileQueues;
+
+        BvhTraversal* bvhTraversal;
+
+        // Features the shaders would be compiled with for this scene
+        bool enableEnvMap;
+        bool enableAlphaTest;
+        bool enableMedium;
+
+        std::vector<Vec4> accumBuffer;
+        iVec2 renderSize;
+        int sampleIndex;
+
+        // Tiles of the GPU renderer, so checkpoints keep their sample counts per tile
+        iVec2 tileSize;
+        iVec2 numTiles;
+        std::vector<int> tileSamples;
+        std::vector<int> tileLastPasses;
+
+        friend struct CpuPathTracer;
+    };
+}
@@ -26,7 +26,9 @@
 #include <memory.h>
 #include <stdio.h>
 #include <string>
+#include <algorithm>
 #include "EnvironmentMap.h"
+#include "ThreadPool.h"
 
 namespace GLSLPT
 {
@@ -36,39 +38,101 @@ namespace GLSLPT
     }
 
     // https://pbr-book.org/3ed-2018/Light_Transport_I_Surface_Reflection/Sampling_Light_Sources#InfiniteAreaLights
-    void EnvironmentMap::BuildCDF()
+    void EnvironmentMap::BuildDistributions()
     {
-        // Gather weights for CDF
-        float* weights = new float[width * height];
-        for (int v = 0; v < height; v++)
+        // Sampling only needs to follow the broad distribution of light, so it uses a box filtered luminance map
+        // that is much smaller than the image itself
+        importanceWidth = std::min(width, MAX_IMPORTANCE_WIDTH);
+        importanceHeight = std::min(height, MAX_IMPORTANCE_HEIGHT);
+
+        int numCells = importanceWidth * importanceHeight;
+        aliasTable = new AliasEntry[numCells + importanceHeight];
+        std::vector<double> weights(numCells);
+        std::vector<double> rowSums(importanceHeight);
+
+        // Rows don't depend on each other so their conditional distributions are built in parallel.
+        // Cells are weighted by sin(theta) as rows near the poles cover less solid angle
+        ThreadPool pool;
+        int rowsPerJob = std::max(importanceHeight / 64, 1);
+        for (int start = 0; start < importanceHeight; start += rowsPerJob)
         {
-            for (int u = 0; u < width; u++)
+            int end = std::min(start + rowsPerJob, importanceHeight);
+            pool.Submit([this, start, end, &weights, &rowSums]()
             {
-                int imgIdx = v * width * 3 + u * 3;
-                weights[u + v * width] = Luminance(img[imgIdx + 0], img[imgIdx + 1], img[imgIdx + 2]);
-            }
+                for (int v = start; v < end; v++)
+                {
+                    int y0 = v * height / importanceHeight;
+                    int y1 = (v + 1) * height / importanceHeight;
+                    double sinTheta = sin(PI * (v + 0.5) / importanceHeight);
+                    double rowSum = 0.0;
+                    for (int u = 0; u < importanceWidth; u++)
+                    {
+                        int x0 = u * width / importanceWidth;
+                        int x1 = (u + 1) * width / importanceWidth;
+
+                        double lum = 0.0;
+                        for (int y = y0; y < y1; y++)
+                        {
+                            for (int x = x0; x < x1; x++)
+                            {
+                                size_t imgIdx = ((size_t)y * width + x) * 3;
+                                lum += Luminance(img[imgIdx + 0], img[imgIdx + 1], img[imgIdx + 2]);
+                            }
+                        }
+
+                        double weight = lum / ((y1 - y0) * (x1 - x0)) * sinTheta;
+                        weights[v * importanceWidth + u] = weight;
+                        rowSum += weight;
+                    }
+                    rowSums[v] = rowSum;
+                    BuildAliasTable(&weights[v * importanceWidth], importanceWidth, &aliasTable[v * importanceWidth]);
+                }
+            });
         }
+        pool.Wait();
 
-        // Build CDF
-        cdf = new float[width * height];
-        cdf[0] = weights[0];
-        for (int i = 1; i < width * height; i++)
-            cdf[i] = cdf[i - 1] + weights[i];
+        // Marginal distribution over rows
+        AliasEntry* marginal = &aliasTable[numCells];
+        BuildAliasTable(&rowSums[0], importanceHeight, marginal);
 
-        totalSum = cdf[width * height - 1];
+        double sum = 0.0;
+        for (int v = 0; v < importanceHeight; v++)
+            sum += rowSums[v];
 
-        delete[] weights;
+        // Store the pdf of each entry and its alias so the shader gets it from the same fetch.
+        // Conditional entries hold the joint pdf of the cell with respect to uv, marginal ones the probability of the row
+        double invSum = sum > 0.0 ? 1.0 / sum : 0.0;
+        for (int i = 0; i < numCells; i++)
+        {
+            int row = i - i % importanceWidth;
+            aliasTable[i].pdf = (float)(weights[i] * invSum * numCells);
+            aliasTable[i].aliasPdf = (float)(weights[row + aliasTable[i].alias] * invSum * numCells);
+        }
+        for (int v = 0; v < importanceHeight; v++)
+        {
+            marginal[v].pdf = (float)(rowSums[v] * invSum);
+            marginal[v].aliasPdf = (float)(rowSums[marginal[v].alias] * invSum);
+        }
     }
 
     bool EnvironmentMap::LoadMap(const std::string& filename)
     {
+        name = filename;
         img = stbi_loadf(filename.c_str(), &width, &height, NULL, 3);
 
         if (img == nullptr)
             return false;
 
-        BuildCDF();
+        BuildDistributions();
 
         return true;
     }
+
+    void EnvironmentMap::ReleaseData()
+    {
+        stbi_image_free(img);
+        delete[] aliasTable;
+        img = nullptr;
+        aliasTable = nullptr;
+    }
 }
\ No newline at end of file
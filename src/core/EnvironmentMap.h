@@ -24,25 +24,36 @@
 
 #pragma once
 
+#include <string>
 #include <vector>
 #include "MathUtils.h"
+#include "AliasTable.h"
 #include "stb_image.h"
 
 namespace GLSLPT
 {
+    // Resolution limit of the luminance map that environment map sampling is based on
+    const int MAX_IMPORTANCE_WIDTH = 512;
+    const int MAX_IMPORTANCE_HEIGHT = 256;
+
     class EnvironmentMap
     {
     public:
-        EnvironmentMap() : width(0), height(0), img(nullptr), cdf(nullptr) {};
-        ~EnvironmentMap() { stbi_image_free(img); delete[] cdf; }
+        EnvironmentMap() : width(0), height(0), importanceWidth(0), importanceHeight(0), img(nullptr), aliasTable(nullptr) {};
+        ~EnvironmentMap() { stbi_image_free(img); delete[] aliasTable; }
 
         bool LoadMap(const std::string& filename);
-        void BuildCDF();
+        void BuildDistributions();
+
+        // Frees the image and alias tables once they are on the GPU
+        void ReleaseData();
 
+        std::string name;
         int width;
         int height;
-        float totalSum;
+        int importanceWidth;
+        int importanceHeight;
         float* img;
-        float* cdf;
+        AliasEntry* aliasTable; // Conditional table of each importance map row, one after the other, followed by the marginal table over rows
     };
 }
@@ -0,0 +1,325 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstdio>
+#include <algorithm>
+#include "LightBvh.h"
+#include "Scene.h"
+
+namespace GLSLPT
+{
+    // Number of candidate split positions per axis
+    static const int NUM_BUCKETS = 12;
+
+    // Trails are stored as 32 bit ints, which limits how deep leaves can be
+    static const int MAX_TRAIL_DEPTH = 31;
+
+    static float Luminance(const Vec3& c)
+    {
+        return 0.212671f * c.x + 0.715160f * c.y + 0.072169f * c.z;
+    }
+
+    float LightPower(const Light& light, float sceneRadius)
+    {
+        // Emission of distant lights is irradiance
+        if (light.type == DistantLight)
+            return Luminance(light.emission) * sceneRadius * sceneRadius * PI;
+
+        return Luminance(light.emission) * light.area * PI;
+    }
+
+    // Cone of directions around an axis. A cosTheta of -1 covers every direction
+    struct DirectionCone
+    {
+        Vec3 axis;
+        float cosTheta;
+    };
+
+    // Smallest cone containing both cones
+    static DirectionCone MergeCones(const DirectionCone& a, const DirectionCone& b)
+    {
+        if (a.cosTheta == -1.0f || b.cosTheta == -1.0f)
+            return { a.axis, -1.0f };
+
+        float thetaA = acosf(Math::Clamp(a.cosTheta, -1.0f, 1.0f));
+        float thetaB = acosf(Math::Clamp(b.cosTheta, -1.0f, 1.0f));
+        float thetaD = acosf(Math::Clamp(Vec3::Dot(a.axis, b.axis), -1.0f, 1.0f));
+
+        if (std::min(thetaD + thetaB, PI) <= thetaA)
+            return a;
+        if (std::min(thetaD + thetaA, PI) <= thetaB)
+            return b;
+
+        float theta = (thetaA + thetaD + thetaB) * 0.5f;
+        Vec3 rotationAxis = Vec3::Cross(a.axis, b.axis);
+        if (theta >= PI || Vec3::Length(rotationAxis) < 1e-6f)
+            return { a.axis, -1.0f };
+
+        // Rotate the axis of a towards b until the cone just covers both
+        float rotation = theta - thetaA;
+        rotationAxis = Vec3::Normalize(rotationAxis);
+        Vec3 axis = a.axis * cosf(rotation) + Vec3::Cross(rotationAxis, a.axis) * sinf(rotation);
+
+        return { Vec3::Normalize(axis), cosf(theta) };
+    }
+
+    // Solid angle measure of the directions lit by a cone of hemispherical emitters
+    // https://fpsunflower.github.io/ckulla/data/many-lights-hpg2018.pdf
+    static float OrientationMeasure(float cosTheta)
+    {
+        float thetaO = acosf(Math::Clamp(cosTheta, -1.0f, 1.0f));
+        float thetaW = std::min(thetaO + PI * 0.5f, PI);
+        float sinThetaO = sinf(thetaO);
+
+        return 2.0f * PI * (1.0f - cosTheta) +
+            PI * 0.5f * (2.0f * thetaW * sinThetaO - cosf(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + cosTheta);
+    }
+
+    static float SurfaceArea(const Vec3& boundsMin, const Vec3& boundsMax)
+    {
+        Vec3 d = boundsMax - boundsMin;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    void LightBvh::Build(const std::vector<Light>& lights)
+    {
+        nodes.clear();
+        trails.assign(lights.size(), 0);
+        distantLights.clear();
+
+        std::vector<LightBounds> bounds;
+        for (int i = 0; i < lights.size(); i++)
+        {
+            const Light& light = lights[i];
+
+            if (light.type == DistantLight)
+            {
+                distantLights.push_back(i);
+                continue;
+            }
+
+            LightBounds b;
+            if (light.type == RectLight)
+            {
+                Vec3 corners[3] = { light.position + light.u, light.position + light.v, light.position + light.u + light.v };
+                b.boundsMin = light.position;
+                b.boundsMax = light.position;
+                for (int j = 0; j < 3; j++)
+                {
+                    b.boundsMin = Vec3::Min(b.boundsMin, corners[j]);
+                    b.boundsMax = Vec3::Max(b.boundsMax, corners[j]);
+                }
+
+                // Quad lights only emit on the side their normal points to
+                b.axis = Vec3::Normalize(Vec3::Cross(light.u, light.v));
+                b.cosTheta = 1.0f;
+            }
+            else
+            {
+                Vec3 radius(light.radius, light.radius, light.radius);
+                b.boundsMin = light.position - radius;
+                b.boundsMax = light.position + radius;
+                b.axis = Vec3(0.0f, 0.0f, 1.0f);
+                b.cosTheta = -1.0f;
+            }
+
+            // Quads are flat, so give their boxes some thickness for the ray tests in the shader
+            Vec3 extent = b.boundsMax - b.boundsMin;
+            float pad = 1e-4f * std::max(std::max(extent.x, std::max(extent.y, extent.z)), 1.0f);
+            b.boundsMin = b.boundsMin - Vec3(pad, pad, pad);
+            b.boundsMax = b.boundsMax + Vec3(pad, pad, pad);
+
+            b.centroid = (b.boundsMin + b.boundsMax) * 0.5f;
+            b.power = LightPower(light);
+            b.lightIndex = i;
+            bounds.push_back(b);
+        }
+
+        if (bounds.empty())
+            return;
+
+        nodes.reserve(bounds.size() * 2 - 1);
+        BuildRecursive(bounds, 0, bounds.size(), 0, 0);
+
+        printf("Light BVH : %d area lights, %d distant lights, %d nodes\n", (int)bounds.size(), (int)distantLights.size(), (int)nodes.size());
+    }
+
+    // Splits are chosen with the surface area orientation heuristic from the paper above
+    int LightBvh::BuildRecursive(std::vector<LightBounds>& bounds, int start, int end, int depth, int trail)
+    {
+        int nodeIndex = nodes.size();
+        nodes.push_back(LightBvhNode());
+
+        LightBvhNode node;
+        node.boundsMin = bounds[start].boundsMin;
+        node.boundsMax = bounds[start].boundsMax;
+        node.power = 0.0f;
+        DirectionCone cone = { bounds[start].axis, bounds[start].cosTheta };
+        Vec3 centroidMin = bounds[start].centroid;
+        Vec3 centroidMax = bounds[start].centroid;
+
+        for (int i = start; i < end; i++)
+        {
+            node.boundsMin = Vec3::Min(node.boundsMin, bounds[i].boundsMin);
+            node.boundsMax = Vec3::Max(node.boundsMax, bounds[i].boundsMax);
+            node.power += bounds[i].power;
+            cone = MergeCones(cone, { bounds[i].axis, bounds[i].cosTheta });
+            centroidMin = Vec3::Min(centroidMin, bounds[i].centroid);
+            centroidMax = Vec3::Max(centroidMax, bounds[i].centroid);
+        }
+        node.axis = cone.axis;
+        node.cosTheta = cone.cosTheta;
+
+        if (end - start == 1)
+        {
+            node.child = -(bounds[start].lightIndex + 1);
+            trails[bounds[start].lightIndex] = trail;
+            nodes[nodeIndex] = node;
+            return nodeIndex;
+        }
+
+        // Once the tree gets deep, split at the median so the remaining lights still fit in the trail bits
+        int levels = 0;
+        while ((1 << levels) < end - start)
+            levels++;
+        bool useHeuristic = depth + 1 + levels <= MAX_TRAIL_DEPTH;
+
+        int mid = start;
+        if (useHeuristic)
+        {
+            Vec3 nodeExtent = node.boundsMax - node.boundsMin;
+            float maxExtent = std::max(nodeExtent.x, std::max(nodeExtent.y, nodeExtent.z));
+            float bestCost = INFINITY;
+            int bestAxis = -1;
+            int bestSplit = 0;
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float centroidExtent = centroidMax[axis] - centroidMin[axis];
+                if (centroidExtent <= 0.0f)
+                    continue;
+
+                struct Bucket
+                {
+                    Vec3 boundsMin, boundsMax;
+                    DirectionCone cone;
+                    float power;
+                    int count;
+                } buckets[NUM_BUCKETS] = {};
+
+                for (int i = start; i < end; i++)
+                {
+                    int b = std::min((int)(NUM_BUCKETS * (bounds[i].centroid[axis] - centroidMin[axis]) / centroidExtent), NUM_BUCKETS - 1);
+                    DirectionCone lightCone = { bounds[i].axis, bounds[i].cosTheta };
+                    if (buckets[b].count == 0)
+                    {
+                        buckets[b].boundsMin = bounds[i].boundsMin;
+                        buckets[b].boundsMax = bounds[i].boundsMax;
+                        buckets[b].cone = lightCone;
+                    }
+                    else
+                    {
+                        buckets[b].boundsMin = Vec3::Min(buckets[b].boundsMin, bounds[i].boundsMin);
+                        buckets[b].boundsMax = Vec3::Max(buckets[b].boundsMax, bounds[i].boundsMax);
+                        buckets[b].cone = MergeCones(buckets[b].cone, lightCone);
+                    }
+                    buckets[b].power += bounds[i].power;
+                    buckets[b].count++;
+                }
+
+                // Splits across thin axes are penalized as they tend to produce overlapping children
+                float kr = nodeExtent[axis] > 0.0f ? maxExtent / nodeExtent[axis] : 1.0f;
+
+                for (int split = 1; split < NUM_BUCKETS; split++)
+                {
+                    float cost = 0.0f;
+                    for (int side = 0; side < 2; side++)
+                    {
+                        int first = side == 0 ? 0 : split;
+                        int last = side == 0 ? split : NUM_BUCKETS;
+                        Bucket merged = {};
+                        for (int b = first; b < last; b++)
+                        {
+                            if (buckets[b].count == 0)
+                                continue;
+                            if (merged.count == 0)
+                                merged = buckets[b];
+                            else
+                            {
+                                merged.boundsMin = Vec3::Min(merged.boundsMin, buckets[b].boundsMin);
+                                merged.boundsMax = Vec3::Max(merged.boundsMax, buckets[b].boundsMax);
+                                merged.cone = MergeCones(merged.cone, buckets[b].cone);
+                                merged.power += buckets[b].power;
+                                merged.count += buckets[b].count;
+                            }
+                        }
+                        if (merged.count == 0)
+                        {
+                            cost = INFINITY;
+                            break;
+                        }
+                        cost += merged.power * OrientationMeasure(merged.cone.cosTheta) * SurfaceArea(merged.boundsMin, merged.boundsMax) * kr;
+                    }
+
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = split;
+                    }
+                }
+            }
+
+            if (bestAxis != -1)
+            {
+                float centroidExtent = centroidMax[bestAxis] - centroidMin[bestAxis];
+                LightBounds* midPtr = std::partition(&bounds[start], &bounds[end - 1] + 1, [&](const LightBounds& b)
+                {
+                    int bucket = std::min((int)(NUM_BUCKETS * (b.centroid[bestAxis] - centroidMin[bestAxis]) / centroidExtent), NUM_BUCKETS - 1);
+                    return bucket < bestSplit;
+                });
+                mid = midPtr - &bounds[0];
+            }
+        }
+
+        // All centroids in the same place or too deep for the heuristic
+        if (mid == start || mid == end)
+        {
+            Vec3 centroidExtent = centroidMax - centroidMin;
+            int axis = centroidExtent.x > centroidExtent.y ? (centroidExtent.x > centroidExtent.z ? 0 : 2) : (centroidExtent.y > centroidExtent.z ? 1 : 2);
+            mid = (start + end) / 2;
+            std::nth_element(&bounds[start], &bounds[mid], &bounds[end - 1] + 1, [axis](const LightBounds& a, const LightBounds& b)
+            {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+        }
+
+        BuildRecursive(bounds, start, mid, depth + 1, trail);
+        node.child = BuildRecursive(bounds, mid, end, depth + 1, trail | (1 << depth));
+        nodes[nodeIndex] = node;
+
+        return nodeIndex;
+    }
+}
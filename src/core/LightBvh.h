@@ -0,0 +1,76 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <vector>
+#include "Vec3.h"
+
+namespace GLSLPT
+{
+    struct Light;
+
+    // Node of the light BVH. Laid out as three RGBA32F texels for the shader
+    struct LightBvhNode
+    {
+        Vec3 boundsMin;
+        float power;     // Summed power of the lights below the node
+        Vec3 boundsMax;
+        int child;       // Second child of interior nodes (the first one follows the node). -(light index + 1) for leaves
+        Vec3 axis;       // Cone of normals of the lights below the node. Every light emits over a hemisphere around its
+        float cosTheta;  // normal, so only the spread of the normals needs to be stored
+    };
+
+    // Estimated power of a light. Distant lights are treated as a disk of sceneRadius facing the scene, and have
+    // no power if it is left out
+    float LightPower(const Light& light, float sceneRadius = 0.0f);
+
+    // Hierarchy over the area lights of a scene, used to pick lights in proportion to their estimated contribution
+    // at a point and to find the closest light along a ray without testing every light
+    class LightBvh
+    {
+    public:
+        void Build(const std::vector<Light>& lights);
+
+        std::vector<LightBvhNode> nodes;   // Depth first, root first. Empty if there are no area lights
+        std::vector<int> trails;           // Per light, the child taken at each level on the way down to its leaf. Bit n is set
+                                           // when the second child is taken at depth n
+        std::vector<int> distantLights;    // Indices of the lights that are sampled outside of the hierarchy
+
+    private:
+        struct LightBounds
+        {
+            Vec3 boundsMin;
+            Vec3 boundsMax;
+            Vec3 centroid;
+            Vec3 axis;
+            float cosTheta;
+            float power;
+            int lightIndex;
+        };
+
+        int BuildRecursive(std::vector<LightBounds>& bounds, int start, int end, int depth, int trail);
+    };
+}
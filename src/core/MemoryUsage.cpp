@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "MemoryUsage.h"
+
+#if defined(_WIN32)
+#include "Config.h"
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/resource.h>
+#else
+#include <cstdio>
+#endif
+
+namespace GLSLPT
+{
+    void GetMemoryUsage(size_t& resident, size_t& peak)
+    {
+        resident = 0;
+        peak = 0;
+
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        {
+            resident = counters.WorkingSetSize;
+            peak = counters.PeakWorkingSetSize;
+        }
+#elif defined(__APPLE__)
+        mach_task_basic_info info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+            resident = info.resident_size;
+
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            peak = usage.ru_maxrss;
+#else
+        FILE* file = fopen("/proc/self/status", "r");
+        if (!file)
+            return;
+
+        char line[256];
+        while (fgets(line, sizeof(line), file))
+        {
+            unsigned long kb;
+            if (sscanf(line, "VmRSS: %lu kB", &kb) == 1)
+                resident = kb * 1024;
+            else if (sscanf(line, "VmHWM: %lu kB", &kb) == 1)
+                peak = kb * 1024;
+        }
+        fclose(file);
+#endif
+    }
+}
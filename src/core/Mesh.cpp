@@ -44,6 +44,7 @@ namespace GLSLPT
     bool Mesh::LoadFromFile(const std::string& filename)
     {
         name = filename;
+        this->filename = filename;
         tinyobj::attrib_t attrib;
         std::vector<tinyobj::shape_t> shapes;
         std::vector<tinyobj::material_t> materials;
@@ -118,6 +119,23 @@ namespace GLSLPT
         return true;
     }
 
+    void Mesh::ReleaseData()
+    {
+        if (filename.empty())
+            return;
+
+        std::vector<Vec4>().swap(verticesUVX);
+        std::vector<Vec4>().swap(normalsUVY);
+    }
+
+    bool Mesh::ReloadData()
+    {
+        if (!verticesUVX.empty() || filename.empty())
+            return true;
+
+        return LoadFromFile(filename);
+    }
+
     void Mesh::BuildBVH()
     {
         const int numTris = verticesUVX.size() / 3;
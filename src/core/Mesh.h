@@ -42,11 +42,17 @@ namespace GLSLPT
         void BuildBVH();
         bool LoadFromFile(const std::string& filename);
 
+        // Vertex data of meshes loaded from a file can be freed once it is on the GPU
+        // and is read back from the file when it is needed again
+        void ReleaseData();
+        bool ReloadData();
+
         std::vector<Vec4> verticesUVX; // Vertex + texture Coord (u/s)
         std::vector<Vec4> normalsUVY;  // Normal + texture Coord (v/t)
 
         RadeonRays::Bvh* bvh;
         std::string name;
+        std::string filename; // Empty for meshes that were not loaded from a file
     };
 
     class MeshInstance
@@ -22,10 +22,16 @@
  * SOFTWARE.
  */
 
+#include <cstring>
+#include <cstdio>
+#include <chrono>
 #include "Config.h"
 #include "Renderer.h"
+#include "BlueNoise.h"
 #include "ShaderIncludes.h"
 #include "Scene.h"
+#include "TileScheduler.h"
+#include "Checkpoint.h"
 #include "OpenImageDenoise/oidn.hpp"
 
 namespace GLSLPT
@@ -38,36 +44,117 @@ namespace GLSLPT
         return new Program(shaders);
     }
 
+    static GLenum CompressedFormat(TextureFormat format)
+    {
+        if (format == BC1)
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        if (format == BC3)
+            return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        if (format == BC7)
+            return GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+        return GL_COMPRESSED_RG_RGTC2;
+    }
+
+    static bool HasExtension(const char* name)
+    {
+        GLint numExtensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for (int i = 0; i < numExtensions; i++)
+        {
+            if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // Direction numbers of the first four Sobol dimensions, 32 per dimension. Uses the primitive polynomials
+    // and initial values of Joe and Kuo, with the first dimension being the van der Corput sequence
+    static void SobolDirections(GLuint* directions)
+    {
+        const int degree[4] = { 0, 1, 2, 3 };
+        const int coeffs[4] = { 0, 0, 1, 1 };
+        const GLuint initial[4][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 3, 0 }, { 1, 3, 1 } };
+
+        for (int i = 0; i < 32; i++)
+            directions[i] = 1u << (31 - i);
+
+        for (int dim = 1; dim < 4; dim++)
+        {
+            GLuint* v = directions + dim * 32;
+            int s = degree[dim];
+
+            for (int i = 0; i < s; i++)
+                v[i] = initial[dim][i] << (31 - i);
+
+            for (int i = s; i < 32; i++)
+            {
+                v[i] = v[i - s] ^ (v[i - s] >> s);
+                for (int k = 1; k < s; k++)
+                    v[i] ^= ((coeffs[dim] >> (s - 1 - k)) & 1) * v[i - k];
+            }
+        }
+    }
+
     Renderer::Renderer(Scene* scene, const std::string& shadersDirectory)
         : scene(scene)
         , BVHBuffer(0)
         , BVHTex(0)
+        , BVHLinksBuffer(0)
+        , BVHLinksTex(0)
         , vertexIndicesBuffer(0)
         , vertexIndicesTex(0)
         , verticesBuffer(0)
         , verticesTex(0)
         , normalsBuffer(0)
         , normalsTex(0)
+        , trianglesBuffer(0)
+        , trianglesTex(0)
         , materialsTex(0)
         , transformsTex(0)
         , lightsTex(0)
-        , textureMapsArrayTex(0)
+        , lightAliasBuffer(0)
+        , lightAliasTex(0)
+        , lightBVHBuffer(0)
+        , lightBVHTex(0)
+        , meshLightsBuffer(0)
+        , meshLightsTex(0)
+        , textureInfoBuffer(0)
+        , textureInfoTex(0)
+        , textureMapsArrayTex()
         , envMapTex(0)
-        , envMapCDFTex(0)
-        , pathTraceTextureLowRes(0)
-        , pathTraceTexture(0)
-        , accumTexture(0)
-        , tileOutputTexture()
-        , denoisedTexture(0)
+        , envMapAliasBuffer(0)
+        , envMapAliasTex(0)
+        , blueNoiseTex(0)
         , pathTraceFBO(0)
         , pathTraceFBOLowRes(0)
         , accumFBO(0)
         , outputFBO(0)
+        , temporalFBO(0)
         , shadersDirectory(shadersDirectory)
         , pathTraceShader(nullptr)
         , pathTraceShaderLowRes(nullptr)
         , outputShader(nullptr)
         , tonemapShader(nullptr)
+        , temporalShader(nullptr)
+        , pathTraceTextureLowRes(0)
+        , pathTraceTexture(0)
+        , accumTexture(0)
+        , tileOutputTexture()
+        , denoisedTexture(0)
+        , previewDepthTexture(0)
+        , historyTexture()
+        , historyPositionTexture()
+        , historyCamera(nullptr)
+        , historyBuffer(0)
+        , historySamples(0)
+        , previewFrame(0)
+        , tileScheduler(nullptr)
+        , tileSamplesTex(0)
+        , resumeCheckpoint(nullptr)
+        , checkpointSamples(0)
+        , textureRestartPending(false)
+        , textureRestartInterval(0.5)
+        , lastTextureRestart(std::chrono::steady_clock::now())
     {
         if (scene == nullptr)
         {
@@ -76,7 +163,14 @@ namespace GLSLPT
         }
 
         if (!scene->initialized)
+        {
+            // Neither S3TC nor BPTC is part of GL 3.3, so textures only use the ones the driver has
+            scene->enableS3TC = HasExtension("GL_EXT_texture_compression_s3tc");
+            scene->enableBPTC = HasExtension("GL_ARB_texture_compression_bptc");
+            if (scene->renderOptions.enableTextureCompression && !scene->enableS3TC)
+                printf("S3TC is not supported, so color textures are %s\n", scene->enableBPTC ? "BC7" : "uncompressed");
             scene->ProcessScene();
+        }
 
         InitGPUDataBuffers();
         quad = new Quad();
@@ -88,48 +182,75 @@ namespace GLSLPT
 
     Renderer::~Renderer()
     {
+        // Let a checkpoint that is still being written finish
+        if (checkpointWrite.valid())
+            checkpointWrite.wait();
+        delete resumeCheckpoint;
+
         delete quad;
 
         // Delete textures
         glDeleteTextures(1, &BVHTex);
+        glDeleteTextures(1, &BVHLinksTex);
         glDeleteTextures(1, &vertexIndicesTex);
         glDeleteTextures(1, &verticesTex);
         glDeleteTextures(1, &normalsTex);
+        glDeleteTextures(1, &trianglesTex);
         glDeleteTextures(1, &materialsTex);
         glDeleteTextures(1, &transformsTex);
         glDeleteTextures(1, &lightsTex);
-        glDeleteTextures(1, &textureMapsArrayTex);
+        glDeleteTextures(1, &lightAliasTex);
+        glDeleteTextures(1, &lightBVHTex);
+        glDeleteTextures(1, &meshLightsTex);
+        glDeleteTextures(1, &textureInfoTex);
+        glDeleteTextures(MAX_TEXTURE_BUCKETS, textureMapsArrayTex);
         glDeleteTextures(1, &envMapTex);
-        glDeleteTextures(1, &envMapCDFTex);
+        glDeleteTextures(1, &envMapAliasTex);
+        glDeleteTextures(1, &blueNoiseTex);
         glDeleteTextures(1, &pathTraceTexture);
         glDeleteTextures(1, &pathTraceTextureLowRes);
         glDeleteTextures(1, &accumTexture);
         glDeleteTextures(1, &tileOutputTexture[0]);
         glDeleteTextures(1, &tileOutputTexture[1]);
         glDeleteTextures(1, &denoisedTexture);
+        glDeleteTextures(1, &tileSamplesTex);
+        glDeleteTextures(1, &previewDepthTexture);
+        glDeleteTextures(2, historyTexture);
+        glDeleteTextures(2, historyPositionTexture);
 
         // Delete buffers
         glDeleteBuffers(1, &BVHBuffer);
+        glDeleteBuffers(1, &BVHLinksBuffer);
         glDeleteBuffers(1, &vertexIndicesBuffer);
         glDeleteBuffers(1, &verticesBuffer);
         glDeleteBuffers(1, &normalsBuffer);
+        glDeleteBuffers(1, &trianglesBuffer);
+        glDeleteBuffers(1, &textureInfoBuffer);
+        glDeleteBuffers(1, &lightAliasBuffer);
+        glDeleteBuffers(1, &lightBVHBuffer);
+        glDeleteBuffers(1, &meshLightsBuffer);
+        glDeleteBuffers(1, &envMapAliasBuffer);
 
         // Delete FBOs
         glDeleteFramebuffers(1, &pathTraceFBO);
         glDeleteFramebuffers(1, &pathTraceFBOLowRes);
         glDeleteFramebuffers(1, &accumFBO);
         glDeleteFramebuffers(1, &outputFBO);
+        glDeleteFramebuffers(1, &temporalFBO);
 
         // Delete shaders
         delete pathTraceShader;
         delete pathTraceShaderLowRes;
         delete outputShader;
         delete tonemapShader;
+        delete temporalShader;
 
         // Delete denoiser data
         delete[] denoiserInputFramePtr;
         delete[] frameOutputPtr;
 
+        delete historyCamera;
+        delete tileScheduler;
     }
 
     void Renderer::InitGPUDataBuffers()
@@ -144,6 +265,14 @@ namespace GLSLPT
         glBindTexture(GL_TEXTURE_BUFFER, BVHTex);
         glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, BVHBuffer);
 
+        // Create buffer and texture for BVH parent links (Used by the stackless traversal)
+        glGenBuffers(1, &BVHLinksBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, BVHLinksBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::NodeLink) * scene->bvhTranslator.links.size(), &scene->bvhTranslator.links[0], GL_STATIC_DRAW);
+        glGenTextures(1, &BVHLinksTex);
+        glBindTexture(GL_TEXTURE_BUFFER, BVHLinksTex);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32I, BVHLinksBuffer);
+
         // Create buffer and texture for vertex indices
         glGenBuffers(1, &vertexIndicesBuffer);
         glBindBuffer(GL_TEXTURE_BUFFER, vertexIndicesBuffer);
@@ -168,6 +297,17 @@ namespace GLSLPT
         glBindTexture(GL_TEXTURE_BUFFER, normalsTex);
         glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, normalsBuffer);
 
+        // Create buffer and texture for precomputed triangle data
+        if (!scene->triangles.empty())
+        {
+            glGenBuffers(1, &trianglesBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, trianglesBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(Vec3) * scene->triangles.size(), &scene->triangles[0], GL_STATIC_DRAW);
+            glGenTextures(1, &trianglesTex);
+            glBindTexture(GL_TEXTURE_BUFFER, trianglesTex);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, trianglesBuffer);
+        }
+
         // Create texture for materials
         glGenTextures(1, &materialsTex);
         glBindTexture(GL_TEXTURE_2D, materialsTex);
@@ -196,15 +336,100 @@ namespace GLSLPT
             glBindTexture(GL_TEXTURE_2D, 0);
         }
 
-        // Create texture for scene textures
+        // Create buffer and texture for the alias table that picks lights by power
+        if (!scene->lightAliasTable.empty())
+        {
+            glGenBuffers(1, &lightAliasBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, lightAliasBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(AliasEntry) * scene->lightAliasTable.size(), &scene->lightAliasTable[0], GL_STATIC_DRAW);
+            glGenTextures(1, &lightAliasTex);
+            glBindTexture(GL_TEXTURE_BUFFER, lightAliasTex);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, lightAliasBuffer);
+        }
+
+        // Create buffer and texture for the light BVH. The trail of each light and the indices of distant lights
+        // follow the nodes, packed four to a texel
+        if (!scene->lightBvh.nodes.empty() || !scene->lightBvh.distantLights.empty())
+        {
+            const LightBvh& lightBvh = scene->lightBvh;
+            int nodeInts = lightBvh.nodes.size() * sizeof(LightBvhNode) / sizeof(int);
+            int trailInts = (lightBvh.trails.size() + 3) / 4 * 4;
+            int distantInts = (lightBvh.distantLights.size() + 3) / 4 * 4;
+
+            std::vector<int> lightBvhData(nodeInts + trailInts + distantInts, 0);
+            if (!lightBvh.nodes.empty())
+                memcpy(&lightBvhData[0], &lightBvh.nodes[0], lightBvh.nodes.size() * sizeof(LightBvhNode));
+            std::copy(lightBvh.trails.begin(), lightBvh.trails.end(), lightBvhData.begin() + nodeInts);
+            std::copy(lightBvh.distantLights.begin(), lightBvh.distantLights.end(), lightBvhData.begin() + nodeInts + trailInts);
+
+            glGenBuffers(1, &lightBVHBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, lightBVHBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(int) * lightBvhData.size(), &lightBvhData[0], GL_STATIC_DRAW);
+            glGenTextures(1, &lightBVHTex);
+            glBindTexture(GL_TEXTURE_BUFFER, lightBVHTex);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBVHBuffer);
+        }
+
+        // Create buffer and texture for emissive triangles. The alias index and the vertex and material indices are
+        // reinterpreted as ints in the shader
+        if (!scene->meshLights.empty())
+        {
+            glGenBuffers(1, &meshLightsBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, meshLightsBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(MeshLight) * scene->meshLights.size(), &scene->meshLights[0], GL_STATIC_DRAW);
+            glGenTextures(1, &meshLightsTex);
+            glBindTexture(GL_TEXTURE_BUFFER, meshLightsTex);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, meshLightsBuffer);
+        }
+
+        // Create buffer and texture for the bucket and layer of each scene texture
         if (!scene->textures.empty())
         {
-            glGenTextures(1, &textureMapsArrayTex);
-            glBindTexture(GL_TEXTURE_2D_ARRAY, textureMapsArrayTex);
-            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, scene->renderOptions.texArrayWidth, scene->renderOptions.texArrayHeight, scene->textures.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, &scene->textureMapsArray[0]);
+            glGenBuffers(1, &textureInfoBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, textureInfoBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(iVec2) * scene->textureLocations.size(), &scene->textureLocations[0], GL_STATIC_DRAW);
+            glGenTextures(1, &textureInfoTex);
+            glBindTexture(GL_TEXTURE_BUFFER, textureInfoTex);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32I, textureInfoBuffer);
+        }
+
+        // Create texture arrays for scene textures. One per size bucket, each with a full mip chain
+        for (int i = 0; i < scene->textureBuckets.size(); i++)
+        {
+            const TextureBucket& bucket = scene->textureBuckets[i];
+            int levels = TextureMipLevels(bucket.width, bucket.height);
+
+            glGenTextures(1, &textureMapsArrayTex[i]);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textureMapsArrayTex[i]);
+
+            if (bucket.format == Uncompressed)
+            {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, bucket.width, bucket.height, bucket.layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, &bucket.texData[0]);
+                glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            }
+            else
+            {
+                // Block compressed mips can't be generated by the driver so all levels come from the scene
+                GLenum internalFormat = CompressedFormat(bucket.format);
+                size_t offset = 0;
+                for (int j = 0; j < levels; j++)
+                {
+                    int w = std::max(bucket.width >> j, 1);
+                    int h = std::max(bucket.height >> j, 1);
+                    int levelBytes = TextureLevelSize(bucket.format, w, h) * bucket.layers;
+                    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, j, internalFormat, w, h, bucket.layers, 0, levelBytes, &bucket.texData[offset]);
+                    offset += levelBytes;
+                }
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+            }
+
             glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
             glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+            static const char* formatNames[] = { "RGBA8", "BC1", "BC3", "BC5", "BC7" };
+            size_t bytes = (size_t)TextureMipChainSize(bucket.format, bucket.width, bucket.height) * bucket.layers;
+            printf("Texture bucket %dx%d %s : %d textures, %.2f MB\n", bucket.width, bucket.height, formatNames[bucket.format], bucket.layers, bytes / (1024.0 * 1024.0));
         }
 
         // Create texture for environment map
@@ -212,17 +437,23 @@ namespace GLSLPT
         {
             glGenTextures(1, &envMapTex);
             glBindTexture(GL_TEXTURE_2D, envMapTex);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, scene->envMap->width, scene->envMap->height, 0, GL_RGB, GL_FLOAT, scene->envMap->img);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB9_E5, scene->envMap->width, scene->envMap->height, 0, GL_RGB, GL_FLOAT, scene->envMap->img);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glBindTexture(GL_TEXTURE_2D, 0);
 
-            glGenTextures(1, &envMapCDFTex);
-            glBindTexture(GL_TEXTURE_2D, envMapCDFTex);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, scene->envMap->width, scene->envMap->height, 0, GL_RED, GL_FLOAT, scene->envMap->cdf);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-            glBindTexture(GL_TEXTURE_2D, 0);
+            // Alias table for importance sampling. The alias index is fetched as an int and the other fields reinterpreted as floats
+            int aliasTableSize = (scene->envMap->importanceWidth + 1) * scene->envMap->importanceHeight;
+            glGenBuffers(1, &envMapAliasBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, envMapAliasBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(AliasEntry) * aliasTableSize, scene->envMap->aliasTable, GL_STATIC_DRAW);
+            glGenTextures(1, &envMapAliasTex);
+            glBindTexture(GL_TEXTURE_BUFFER, envMapAliasTex);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, envMapAliasBuffer);
+
+            size_t bytes = sizeof(unsigned int) * scene->envMap->width * scene->envMap->height + sizeof(AliasEntry) * aliasTableSize;
+            printf("Environment map %dx%d RGB9_E5, importance map %dx%d : %.2f MB\n", scene->envMap->width, scene->envMap->height,
+                scene->envMap->importanceWidth, scene->envMap->importanceHeight, bytes / (1024.0 * 1024.0));
         }
 
         // Bind textures to texture slots as they will not change slots during the lifespan of the renderer
@@ -241,11 +472,29 @@ namespace GLSLPT
         glActiveTexture(GL_TEXTURE7);
         glBindTexture(GL_TEXTURE_2D, lightsTex);
         glActiveTexture(GL_TEXTURE8);
-        glBindTexture(GL_TEXTURE_2D_ARRAY, textureMapsArrayTex);
+        glBindTexture(GL_TEXTURE_BUFFER, textureInfoTex);
         glActiveTexture(GL_TEXTURE9);
         glBindTexture(GL_TEXTURE_2D, envMapTex);
         glActiveTexture(GL_TEXTURE10);
-        glBindTexture(GL_TEXTURE_2D, envMapCDFTex);
+        glBindTexture(GL_TEXTURE_BUFFER, envMapAliasTex);
+        glActiveTexture(GL_TEXTURE11);
+        glBindTexture(GL_TEXTURE_BUFFER, BVHLinksTex);
+        glActiveTexture(GL_TEXTURE12);
+        glBindTexture(GL_TEXTURE_BUFFER, trianglesTex);
+        for (int i = 0; i < MAX_TEXTURE_BUCKETS; i++)
+        {
+            glActiveTexture(GL_TEXTURE13 + i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textureMapsArrayTex[i]);
+        }
+        glActiveTexture(GL_TEXTURE17);
+        glBindTexture(GL_TEXTURE_BUFFER, lightBVHTex);
+        glActiveTexture(GL_TEXTURE18);
+        glBindTexture(GL_TEXTURE_BUFFER, lightAliasTex);
+        glActiveTexture(GL_TEXTURE19);
+        glBindTexture(GL_TEXTURE_BUFFER, meshLightsTex);
+
+        if (scene->renderOptions.freeCPUData)
+            scene->ReleaseCPUData();
     }
 
     void Renderer::ResizeRenderer()
@@ -257,22 +506,33 @@ namespace GLSLPT
         glDeleteTextures(1, &tileOutputTexture[0]);
         glDeleteTextures(1, &tileOutputTexture[1]);
         glDeleteTextures(1, &denoisedTexture);
+        glDeleteTextures(1, &tileSamplesTex);
+        glDeleteTextures(1, &previewDepthTexture);
+        glDeleteTextures(2, historyTexture);
+        glDeleteTextures(2, historyPositionTexture);
 
         // Delete FBOs
         glDeleteFramebuffers(1, &pathTraceFBO);
         glDeleteFramebuffers(1, &pathTraceFBOLowRes);
         glDeleteFramebuffers(1, &accumFBO);
         glDeleteFramebuffers(1, &outputFBO);
+        glDeleteFramebuffers(1, &temporalFBO);
 
         // Delete denoiser data
         delete[] denoiserInputFramePtr;
         delete[] frameOutputPtr;
 
+        delete tileScheduler;
+
         // Delete shaders
         delete pathTraceShader;
         delete pathTraceShaderLowRes;
         delete outputShader;
         delete tonemapShader;
+        delete temporalShader;
+
+        // The history is sized like the render, so it is created again by InitShaders
+        temporalFBO = 0;
 
         InitFBOs();
         InitShaders();
@@ -296,9 +556,22 @@ namespace GLSLPT
         numTiles.x = ceil((float)renderSize.x / tileWidth);
         numTiles.y = ceil((float)renderSize.y / tileHeight);
 
-        tile.x = -1;
+        tile.x = 0;
         tile.y = numTiles.y - 1;
 
+        tileScheduler = new TileScheduler(numTiles);
+
+        // Texel per tile holding its number of samples. It stays bound to unit 26 for the shaders that normalize the accumulation
+        std::vector<float> zeroSamples(numTiles.x * numTiles.y, 0.0f);
+
+        glGenTextures(1, &tileSamplesTex);
+        glActiveTexture(GL_TEXTURE26);
+        glBindTexture(GL_TEXTURE_2D, tileSamplesTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, numTiles.x, numTiles.y, 0, GL_RED, GL_FLOAT, &zeroSamples[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glActiveTexture(GL_TEXTURE0);
+
         // Create FBOs for path trace shader 
         glGenFramebuffers(1, &pathTraceFBO);
         glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBO);
@@ -385,6 +658,7 @@ namespace GLSLPT
         delete pathTraceShaderLowRes;
         delete outputShader;
         delete tonemapShader;
+        delete temporalShader;
 
         InitShaders();
     }
@@ -396,6 +670,7 @@ namespace GLSLPT
         ShaderInclude::ShaderSource pathTraceShaderLowResSrcObj = ShaderInclude::load(shadersDirectory + "preview.glsl");
         ShaderInclude::ShaderSource outputShaderSrcObj = ShaderInclude::load(shadersDirectory + "output.glsl");
         ShaderInclude::ShaderSource tonemapShaderSrcObj = ShaderInclude::load(shadersDirectory + "tonemap.glsl");
+        ShaderInclude::ShaderSource temporalShaderSrcObj = ShaderInclude::load(shadersDirectory + "temporal.glsl");
 
         // Add preprocessor defines for conditional compilation
         std::string pathtraceDefines = "";
@@ -458,6 +733,62 @@ namespace GLSLPT
         if (scene->renderOptions.enableVolumeMIS)
             pathtraceDefines += "#define OPT_VOL_MIS\n";
 
+        if (scene->renderOptions.enableStacklessBVH)
+            pathtraceDefines += "#define OPT_STACKLESS_BVH\n";
+
+        if (trianglesTex)
+            pathtraceDefines += "#define OPT_TRIANGLE_BUFFER\n";
+
+        if (scene->renderOptions.enableSignedAABB)
+            pathtraceDefines += "#define OPT_SIGNED_AABB\n";
+
+        if (lightBVHTex)
+            pathtraceDefines += "#define OPT_LIGHT_BVH\n";
+
+        if (meshLightsTex)
+            pathtraceDefines += "#define OPT_MESH_LIGHTS\n";
+
+        if (scene->renderOptions.enableSobolSampler)
+            pathtraceDefines += "#define OPT_SOBOL\n";
+
+        if (scene->renderOptions.enableBlueNoise)
+        {
+            // The mask takes a moment to build, so it is only made once the option is first turned on
+            if (!blueNoiseTex)
+            {
+                std::vector<float> mask;
+                BuildBlueNoise(BLUE_NOISE_SIZE, mask);
+
+                glGenTextures(1, &blueNoiseTex);
+                glActiveTexture(GL_TEXTURE20);
+                glBindTexture(GL_TEXTURE_2D, blueNoiseTex);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, BLUE_NOISE_SIZE, BLUE_NOISE_SIZE, 0, GL_RED, GL_FLOAT, &mask[0]);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glActiveTexture(GL_TEXTURE0);
+            }
+
+            pathtraceDefines += "#define OPT_BLUE_NOISE\n";
+        }
+
+        if (scene->renderOptions.enableTemporalReprojection)
+        {
+            // Like the blue noise mask, the history is only made once the option is first turned on
+            if (!temporalFBO)
+                InitTemporalBuffers();
+
+            pathtraceDefines += "#define OPT_TEMPORAL_REPROJECTION\n";
+        }
+
+        for (int i = 0; i < scene->textureBuckets.size(); i++)
+        {
+            if (scene->textureBuckets[i].format == BC5)
+            {
+                pathtraceDefines += "#define OPT_COMPRESSED_NORMALMAP\n";
+                break;
+            }
+        }
+
         if (pathtraceDefines.size() > 0)
         {
             size_t idx = pathTraceShaderSrcObj.src.find("#version");
@@ -489,6 +820,15 @@ namespace GLSLPT
         pathTraceShaderLowRes = LoadShaders(vertexShaderSrcObj, pathTraceShaderLowResSrcObj);
         outputShader = LoadShaders(vertexShaderSrcObj, outputShaderSrcObj);
         tonemapShader = LoadShaders(vertexShaderSrcObj, tonemapShaderSrcObj);
+        temporalShader = LoadShaders(vertexShaderSrcObj, temporalShaderSrcObj);
+
+        // Texture arrays of the texture buckets are bound to consecutive units starting at 13
+        GLint textureUnits[MAX_TEXTURE_BUCKETS];
+        for (int i = 0; i < MAX_TEXTURE_BUCKETS; i++)
+            textureUnits[i] = 13 + i;
+
+        GLuint sobolDirections[128];
+        SobolDirections(sobolDirections);
 
         // Setup shader uniforms
         GLuint shaderObject;
@@ -497,14 +837,16 @@ namespace GLSLPT
 
         if (scene->envMap)
         {
-            glUniform2f(glGetUniformLocation(shaderObject, "envMapRes"), (float)scene->envMap->width, (float)scene->envMap->height);
-            glUniform1f(glGetUniformLocation(shaderObject, "envMapTotalSum"), scene->envMap->totalSum);
+            glUniform2f(glGetUniformLocation(shaderObject, "envMapImportanceRes"), (float)scene->envMap->importanceWidth, (float)scene->envMap->importanceHeight);
         }
         
         glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.topLevelIndex);
         glUniform2f(glGetUniformLocation(shaderObject, "resolution"), float(renderSize.x), float(renderSize.y));
         glUniform2f(glGetUniformLocation(shaderObject, "invNumTiles"), invNumTiles.x, invNumTiles.y);
         glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), scene->lights.size());
+        glUniform1i(glGetUniformLocation(shaderObject, "numOfDistantLights"), scene->lightBvh.distantLights.size());
+        glUniform1i(glGetUniformLocation(shaderObject, "numOfMeshLights"), scene->meshLights.size());
+        glUniform1f(glGetUniformLocation(shaderObject, "invMeshLightsPower"), scene->meshLightsPower > 0.0f ? 1.0f / scene->meshLightsPower : 0.0f);
         glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 0);
         glUniform1i(glGetUniformLocation(shaderObject, "BVH"), 1);
         glUniform1i(glGetUniformLocation(shaderObject, "vertexIndicesTex"), 2);
@@ -513,9 +855,17 @@ namespace GLSLPT
         glUniform1i(glGetUniformLocation(shaderObject, "materialsTex"), 5);
         glUniform1i(glGetUniformLocation(shaderObject, "transformsTex"), 6);
         glUniform1i(glGetUniformLocation(shaderObject, "lightsTex"), 7);
-        glUniform1i(glGetUniformLocation(shaderObject, "textureMapsArrayTex"), 8);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureInfoTex"), 8);
+        glUniform1iv(glGetUniformLocation(shaderObject, "textureMapsArrayTex"), MAX_TEXTURE_BUCKETS, textureUnits);
         glUniform1i(glGetUniformLocation(shaderObject, "envMapTex"), 9);
-        glUniform1i(glGetUniformLocation(shaderObject, "envMapCDFTex"), 10);
+        glUniform1i(glGetUniformLocation(shaderObject, "envMapAliasTex"), 10);
+        glUniform1i(glGetUniformLocation(shaderObject, "BVHLinksTex"), 11);
+        glUniform1i(glGetUniformLocation(shaderObject, "trianglesTex"), 12);
+        glUniform1i(glGetUniformLocation(shaderObject, "lightBVHTex"), 17);
+        glUniform1i(glGetUniformLocation(shaderObject, "lightAliasTex"), 18);
+        glUniform1i(glGetUniformLocation(shaderObject, "meshLightsTex"), 19);
+        glUniform1uiv(glGetUniformLocation(shaderObject, "sobolDirections"), 128, sobolDirections);
+        glUniform1i(glGetUniformLocation(shaderObject, "blueNoiseTex"), 20);
         pathTraceShader->StopUsing();
 
         pathTraceShaderLowRes->Use();
@@ -523,12 +873,14 @@ namespace GLSLPT
 
         if (scene->envMap)
         {
-            glUniform2f(glGetUniformLocation(shaderObject, "envMapRes"), (float)scene->envMap->width, (float)scene->envMap->height);
-            glUniform1f(glGetUniformLocation(shaderObject, "envMapTotalSum"), scene->envMap->totalSum);
+            glUniform2f(glGetUniformLocation(shaderObject, "envMapImportanceRes"), (float)scene->envMap->importanceWidth, (float)scene->envMap->importanceHeight);
         }
         glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.topLevelIndex);
         glUniform2f(glGetUniformLocation(shaderObject, "resolution"), float(renderSize.x), float(renderSize.y));
         glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), scene->lights.size());
+        glUniform1i(glGetUniformLocation(shaderObject, "numOfDistantLights"), scene->lightBvh.distantLights.size());
+        glUniform1i(glGetUniformLocation(shaderObject, "numOfMeshLights"), scene->meshLights.size());
+        glUniform1f(glGetUniformLocation(shaderObject, "invMeshLightsPower"), scene->meshLightsPower > 0.0f ? 1.0f / scene->meshLightsPower : 0.0f);
         glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 0);
         glUniform1i(glGetUniformLocation(shaderObject, "BVH"), 1);
         glUniform1i(glGetUniformLocation(shaderObject, "vertexIndicesTex"), 2);
@@ -537,10 +889,128 @@ namespace GLSLPT
         glUniform1i(glGetUniformLocation(shaderObject, "materialsTex"), 5);
         glUniform1i(glGetUniformLocation(shaderObject, "transformsTex"), 6);
         glUniform1i(glGetUniformLocation(shaderObject, "lightsTex"), 7);
-        glUniform1i(glGetUniformLocation(shaderObject, "textureMapsArrayTex"), 8);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureInfoTex"), 8);
+        glUniform1iv(glGetUniformLocation(shaderObject, "textureMapsArrayTex"), MAX_TEXTURE_BUCKETS, textureUnits);
         glUniform1i(glGetUniformLocation(shaderObject, "envMapTex"), 9);
-        glUniform1i(glGetUniformLocation(shaderObject, "envMapCDFTex"), 10);
+        glUniform1i(glGetUniformLocation(shaderObject, "envMapAliasTex"), 10);
+        glUniform1i(glGetUniformLocation(shaderObject, "BVHLinksTex"), 11);
+        glUniform1i(glGetUniformLocation(shaderObject, "trianglesTex"), 12);
+        glUniform1i(glGetUniformLocation(shaderObject, "lightBVHTex"), 17);
+        glUniform1i(glGetUniformLocation(shaderObject, "lightAliasTex"), 18);
+        glUniform1i(glGetUniformLocation(shaderObject, "meshLightsTex"), 19);
+        glUniform1uiv(glGetUniformLocation(shaderObject, "sobolDirections"), 128, sobolDirections);
+        glUniform1i(glGetUniformLocation(shaderObject, "blueNoiseTex"), 20);
         pathTraceShaderLowRes->StopUsing();
+
+        // Units past the scene data are used for the history so its bindings are left alone
+        temporalShader->Use();
+        shaderObject = temporalShader->getObject();
+        glUniform1i(glGetUniformLocation(shaderObject, "previewTexture"), 21);
+        glUniform1i(glGetUniformLocation(shaderObject, "previewDepthTexture"), 22);
+        glUniform1i(glGetUniformLocation(shaderObject, "historyTexture"), 23);
+        glUniform1i(glGetUniformLocation(shaderObject, "historyPositionTexture"), 24);
+        glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 25);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileSamplesTex"), 26);
+        glUniform2f(glGetUniformLocation(shaderObject, "resolution"), float(renderSize.x), float(renderSize.y));
+        glUniform2i(glGetUniformLocation(shaderObject, "tileSize"), tileWidth, tileHeight);
+        glUniform1i(glGetUniformLocation(shaderObject, "maxHistorySamples"), MAX_HISTORY_SAMPLES);
+        temporalShader->StopUsing();
+
+        tonemapShader->Use();
+        shaderObject = tonemapShader->getObject();
+        glUniform1i(glGetUniformLocation(shaderObject, "tileSamplesTex"), 26);
+        glUniform2i(glGetUniformLocation(shaderObject, "tileSize"), tileWidth, tileHeight);
+        tonemapShader->StopUsing();
+    }
+
+    void Renderer::InitTemporalBuffers()
+    {
+        historyBuffer = 0;
+        historySamples = 0;
+
+        if (!historyCamera)
+            historyCamera = new Camera(*scene->camera);
+
+        // Distances to the first hits of the preview go to a second attachment of its FBO
+        glGenTextures(1, &previewDepthTexture);
+        glBindTexture(GL_TEXTURE_2D, previewDepthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, windowSize.x * pixelRatio, windowSize.y * pixelRatio, 0, GL_RED, GL_FLOAT, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+
+        glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBOLowRes);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, previewDepthTexture, 0);
+        glDrawBuffers(2, drawBuffers);
+
+        // Two sets of history textures so one can be read while the other is written
+        glGenTextures(2, historyTexture);
+        glGenTextures(2, historyPositionTexture);
+        for (int i = 0; i < 2; i++)
+        {
+            glBindTexture(GL_TEXTURE_2D, historyTexture[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, renderSize.x, renderSize.y, 0, GL_RGBA, GL_FLOAT, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            glBindTexture(GL_TEXTURE_2D, historyPositionTexture[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, renderSize.x, renderSize.y, 0, GL_RGBA, GL_FLOAT, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &temporalFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, temporalFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, historyTexture[0], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, historyPositionTexture[0], 0);
+        glDrawBuffers(2, drawBuffers);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Draws the temporal shader into the next set of history textures
+    void Renderer::DrawHistory()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, temporalFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, historyTexture[1 - historyBuffer], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, historyPositionTexture[1 - historyBuffer], 0);
+        glViewport(0, 0, renderSize.x, renderSize.y);
+
+        glActiveTexture(GL_TEXTURE21);
+        glBindTexture(GL_TEXTURE_2D, pathTraceTextureLowRes);
+        glActiveTexture(GL_TEXTURE22);
+        glBindTexture(GL_TEXTURE_2D, previewDepthTexture);
+        glActiveTexture(GL_TEXTURE23);
+        glBindTexture(GL_TEXTURE_2D, historyTexture[historyBuffer]);
+        glActiveTexture(GL_TEXTURE24);
+        glBindTexture(GL_TEXTURE_2D, historyPositionTexture[historyBuffer]);
+        glActiveTexture(GL_TEXTURE25);
+        glBindTexture(GL_TEXTURE_2D, accumTexture);
+        glActiveTexture(GL_TEXTURE0);
+
+        quad->Draw(temporalShader);
+        historyBuffer = 1 - historyBuffer;
+    }
+
+    void Renderer::ResolveAccumulation()
+    {
+        // Folds the samples accumulated while the camera stood still into the history, before they are cleared
+        temporalShader->Use();
+        GLuint shaderObject = temporalShader->getObject();
+        glUniform1i(glGetUniformLocation(shaderObject, "resolveAccum"), true);
+        temporalShader->StopUsing();
+
+        DrawHistory();
+
+        historySamples = std::min(historySamples + sampleCounter, MAX_HISTORY_SAMPLES);
     }
 
     void Renderer::Render()
@@ -559,6 +1029,14 @@ namespace GLSLPT
             glViewport(0, 0, windowSize.x * pixelRatio, windowSize.y * pixelRatio);
             quad->Draw(pathTraceShaderLowRes);
 
+            // Blend the preview into the history reprojected from the last camera
+            if (scene->renderOptions.enableTemporalReprojection && temporalFBO)
+            {
+                DrawHistory();
+                historySamples = std::min(historySamples + 1, MAX_HISTORY_SAMPLES);
+                previewFrame++;
+            }
+
             scene->instancesModified = false;
             scene->dirty = false;
             scene->envMapModified = false;
@@ -579,13 +1057,24 @@ namespace GLSLPT
             glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
             quad->Draw(outputShader);
 
+            tileScheduler->AddSample();
+            float samples = (float)tileScheduler->GetTileSamples(tile);
+            glActiveTexture(GL_TEXTURE26);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, tile.x, tile.y, 1, 1, GL_RED, GL_FLOAT, &samples);
+            glActiveTexture(GL_TEXTURE0);
+
             // Here we render to tileOutputTexture[currentBuffer] but display tileOutputTexture[1-currentBuffer] until all tiles are done rendering
             // When all tiles are rendered, we flip the bound texture and start rendering to the other one
             glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
             glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileOutputTexture[currentBuffer], 0);
             glViewport(0, 0, renderSize.x, renderSize.y);
             glBindTexture(GL_TEXTURE_2D, accumTexture);
+            tonemapShader->Use();
+            glUniform1i(glGetUniformLocation(tonemapShader->getObject(), "perTileSamples"), true);
             quad->Draw(tonemapShader);
+            tonemapShader->Use();
+            glUniform1i(glGetUniformLocation(tonemapShader->getObject(), "perTileSamples"), false);
+            tonemapShader->StopUsing();
         }
     }
 
@@ -593,8 +1082,14 @@ namespace GLSLPT
     {
         glActiveTexture(GL_TEXTURE0);
 
+        // With temporal reprojection the history is shown until the accumulation has as many samples
+        if (scene->renderOptions.enableTemporalReprojection && temporalFBO && sampleCounter <= historySamples)
+        {
+            glBindTexture(GL_TEXTURE_2D, historyTexture[historyBuffer]);
+            quad->Draw(tonemapShader);
+        }
         // For the first sample or if the camera is moving, we do not have an image ready with all the tiles rendered, so we display a low res preview.
-        if (scene->dirty || sampleCounter == 1)
+        else if (scene->dirty || sampleCounter == 1)
         {
             glBindTexture(GL_TEXTURE_2D, pathTraceTextureLowRes);
             quad->Draw(tonemapShader);
@@ -610,6 +1105,37 @@ namespace GLSLPT
         }
     }
 
+    void Renderer::UpdateTileWeights()
+    {
+        const RenderOptions& options = scene->renderOptions;
+        std::vector<float> weights(numTiles.x * numTiles.y, 1.0f);
+
+        if (options.enableROI)
+        {
+            // Tiles under the region. Its y axis points down while tiles are counted from the bottom
+            int minX = (int)floor(options.roi.x * renderSize.x / tileWidth);
+            int maxX = (int)ceil(options.roi.z * renderSize.x / tileWidth) - 1;
+            int minY = (int)floor((1.0f - options.roi.w) * renderSize.y / tileHeight);
+            int maxY = (int)ceil((1.0f - options.roi.y) * renderSize.y / tileHeight) - 1;
+            minX = std::max(minX, 0);
+            minY = std::max(minY, 0);
+            maxX = std::min(maxX, numTiles.x - 1);
+            maxY = std::min(maxY, numTiles.y - 1);
+
+            // A region that covers no tile leaves the weights even
+            if (minX <= maxX && minY <= maxY)
+            {
+                float outsideWeight = options.roiSampleRatio > 0 ? 1.0f / options.roiSampleRatio : 0.0f;
+                for (int y = 0; y < numTiles.y; y++)
+                    for (int x = 0; x < numTiles.x; x++)
+                        if (x < minX || x > maxX || y < minY || y > maxY)
+                            weights[y * numTiles.x + x] = outsideWeight;
+            }
+        }
+
+        tileScheduler->SetWeights(weights);
+    }
+
     float Renderer::GetProgress()
     {
         int maxSpp = scene->renderOptions.maxSpp;
@@ -638,8 +1164,149 @@ namespace GLSLPT
         return sampleCounter;
     }
 
+    bool Renderer::SaveCheckpoint(const std::string& filename)
+    {
+        // Wait for the first pass so a resumed image has every tile, and skip checkpoints that add no samples
+        if (scene->dirty || sampleCounter == 1 || tileScheduler->GetTotalSamples() == checkpointSamples)
+            return false;
+
+        // One checkpoint is written at a time
+        if (checkpointWrite.valid() && checkpointWrite.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+
+        Checkpoint checkpoint;
+        checkpoint.sceneHash = scene->Hash();
+        checkpoint.renderSize = renderSize;
+        checkpoint.numTiles = numTiles;
+        checkpoint.sampleCounter = sampleCounter;
+        checkpoint.frameCounter = frameCounter;
+        checkpoint.tileSamples = tileScheduler->GetSamples();
+        checkpoint.tileLastPasses = tileScheduler->GetLastPasses();
+        checkpoint.accum.resize(renderSize.x * renderSize.y);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, accumTexture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &checkpoint.accum[0]);
+
+        checkpointSamples = tileScheduler->GetTotalSamples();
+        checkpointWrite = std::async(std::launch::async, [checkpoint = std::move(checkpoint), filename]() {
+            return WriteCheckpoint(checkpoint, filename);
+        });
+
+        return true;
+    }
+
+    bool Renderer::LoadCheckpoint(const std::string& filename)
+    {
+        Checkpoint* checkpoint = new Checkpoint;
+        if (!ReadCheckpoint(filename, *checkpoint))
+        {
+            delete checkpoint;
+            return false;
+        }
+
+        if (checkpoint->sceneHash != scene->Hash() || checkpoint->renderSize.x != renderSize.x || checkpoint->renderSize.y != renderSize.y ||
+            checkpoint->numTiles.x != numTiles.x || checkpoint->numTiles.y != numTiles.y)
+        {
+            printf("Checkpoint %s was rendered with a different scene or settings\n", filename.c_str());
+            delete checkpoint;
+            return false;
+        }
+
+        // Textures that finish loading later would clear the image again, so they are all patched in by the next update
+        scene->WaitForTextures();
+
+        // Applied by the next update, which clears the image
+        delete resumeCheckpoint;
+        resumeCheckpoint = checkpoint;
+        scene->dirty = true;
+
+        return true;
+    }
+
+    void Renderer::RestoreCheckpoint()
+    {
+        const Checkpoint& checkpoint = *resumeCheckpoint;
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, accumTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, renderSize.x, renderSize.y, GL_RGBA, GL_FLOAT, &checkpoint.accum[0]);
+
+        tileScheduler->Restore(checkpoint.sampleCounter, checkpoint.tileSamples, checkpoint.tileLastPasses);
+        std::vector<float> samples(checkpoint.tileSamples.begin(), checkpoint.tileSamples.end());
+        glActiveTexture(GL_TEXTURE26);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, numTiles.x, numTiles.y, GL_RED, GL_FLOAT, &samples[0]);
+        glActiveTexture(GL_TEXTURE0);
+
+        // The frame counter seeds the random numbers, so it carries on rather than repeating earlier samples
+        sampleCounter = checkpoint.sampleCounter;
+        frameCounter = checkpoint.frameCounter;
+        checkpointSamples = tileScheduler->GetTotalSamples();
+
+        // Both tile buffers start out with the resumed image, so it shows before the current pass is done
+        glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
+        glViewport(0, 0, renderSize.x, renderSize.y);
+        glBindTexture(GL_TEXTURE_2D, accumTexture);
+        tonemapShader->Use();
+        glUniform1i(glGetUniformLocation(tonemapShader->getObject(), "perTileSamples"), true);
+        for (int i = 0; i < 2; i++)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileOutputTexture[i], 0);
+            quad->Draw(tonemapShader);
+        }
+        tonemapShader->Use();
+        glUniform1i(glGetUniformLocation(tonemapShader->getObject(), "perTileSamples"), false);
+        tonemapShader->StopUsing();
+
+        printf("Resumed from checkpoint at %d spp\n", sampleCounter);
+
+        delete resumeCheckpoint;
+        resumeCheckpoint = nullptr;
+    }
+
     void Renderer::Update(float secondsElapsed)
     {
+        // Patch in scene textures that finished loading. The image is restarted so placeholders don't linger in it, but
+        // only at doubling intervals while more textures are on the way, so the samples so far aren't thrown away every
+        // frame. The last texture always restarts it, so the converged image has no placeholders
+        std::vector<TextureUpdate> textureUpdates;
+        scene->TakeTextureUpdates(textureUpdates);
+        for (int i = 0; i < textureUpdates.size(); i++)
+        {
+            iVec2 location = scene->textureLocations[textureUpdates[i].texID];
+            const TextureBucket& bucket = scene->textureBuckets[location.x];
+
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textureMapsArrayTex[location.x]);
+            size_t offset = 0;
+            for (int j = 0; j < TextureMipLevels(bucket.width, bucket.height); j++)
+            {
+                int w = std::max(bucket.width >> j, 1);
+                int h = std::max(bucket.height >> j, 1);
+                int levelBytes = TextureLevelSize(bucket.format, w, h);
+                const unsigned char* levelData = &textureUpdates[i].texData[offset];
+
+                if (bucket.format == Uncompressed)
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, j, 0, 0, location.y, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, levelData);
+                else
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, j, 0, 0, location.y, w, h, 1, CompressedFormat(bucket.format), levelBytes, levelData);
+                offset += levelBytes;
+            }
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            textureRestartPending = true;
+        }
+
+        if (textureRestartPending)
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (!scene->TexturesLoading() || std::chrono::duration<double>(now - lastTextureRestart).count() >= textureRestartInterval)
+            {
+                scene->dirty = true;
+                textureRestartPending = false;
+                textureRestartInterval *= 2.0;
+                lastTextureRestart = now;
+            }
+        }
+
         // If maxSpp was reached then stop updates
         // TODO: Tonemapping and denosing still need to be able to run on final image
         if (!scene->dirty && scene->renderOptions.maxSpp != -1 && sampleCounter >= scene->renderOptions.maxSpp)
@@ -662,6 +1329,31 @@ namespace GLSLPT
             int size = sizeof(RadeonRays::BvhTranslator::Node) * (scene->bvhTranslator.nodes.size() - index);
             glBindBuffer(GL_TEXTURE_BUFFER, BVHBuffer);
             glBufferSubData(GL_TEXTURE_BUFFER, offset, size, &scene->bvhTranslator.nodes[index]);
+
+            // Update top level BVH links
+            offset = sizeof(RadeonRays::BvhTranslator::NodeLink) * index;
+            size = sizeof(RadeonRays::BvhTranslator::NodeLink) * (scene->bvhTranslator.links.size() - index);
+            glBindBuffer(GL_TEXTURE_BUFFER, BVHLinksBuffer);
+            glBufferSubData(GL_TEXTURE_BUFFER, offset, size, &scene->bvhTranslator.links[index]);
+
+            // Update emissive triangles, which are stored in world space
+            if (meshLightsTex)
+            {
+                glBindBuffer(GL_TEXTURE_BUFFER, meshLightsBuffer);
+                glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(MeshLight) * scene->meshLights.size(), &scene->meshLights[0]);
+
+                float invMeshLightsPower = scene->meshLightsPower > 0.0f ? 1.0f / scene->meshLightsPower : 0.0f;
+                GLuint shaderObject;
+                pathTraceShader->Use();
+                shaderObject = pathTraceShader->getObject();
+                glUniform1f(glGetUniformLocation(shaderObject, "invMeshLightsPower"), invMeshLightsPower);
+                pathTraceShader->StopUsing();
+
+                pathTraceShaderLowRes->Use();
+                shaderObject = pathTraceShaderLowRes->getObject();
+                glUniform1f(glGetUniformLocation(shaderObject, "invMeshLightsPower"), invMeshLightsPower);
+                pathTraceShaderLowRes->StopUsing();
+            }
         }
 
         // Recreate texture for envmaps
@@ -671,23 +1363,24 @@ namespace GLSLPT
             if (scene->envMap != nullptr)
             {
                 glBindTexture(GL_TEXTURE_2D, envMapTex);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, scene->envMap->width, scene->envMap->height, 0, GL_RGB, GL_FLOAT, scene->envMap->img);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB9_E5, scene->envMap->width, scene->envMap->height, 0, GL_RGB, GL_FLOAT, scene->envMap->img);
 
-                glBindTexture(GL_TEXTURE_2D, envMapCDFTex);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, scene->envMap->width, scene->envMap->height, 0, GL_RED, GL_FLOAT, scene->envMap->cdf);
+                glBindBuffer(GL_TEXTURE_BUFFER, envMapAliasBuffer);
+                glBufferData(GL_TEXTURE_BUFFER, sizeof(AliasEntry) * (scene->envMap->importanceWidth + 1) * scene->envMap->importanceHeight, scene->envMap->aliasTable, GL_STATIC_DRAW);
 
                 GLuint shaderObject;
                 pathTraceShader->Use();
                 shaderObject = pathTraceShader->getObject();
-                glUniform2f(glGetUniformLocation(shaderObject, "envMapRes"), (float)scene->envMap->width, (float)scene->envMap->height);
-                glUniform1f(glGetUniformLocation(shaderObject, "envMapTotalSum"), scene->envMap->totalSum);
+                glUniform2f(glGetUniformLocation(shaderObject, "envMapImportanceRes"), (float)scene->envMap->importanceWidth, (float)scene->envMap->importanceHeight);
                 pathTraceShader->StopUsing();
 
                 pathTraceShaderLowRes->Use();
                 shaderObject = pathTraceShaderLowRes->getObject();
-                glUniform2f(glGetUniformLocation(shaderObject, "envMapRes"), (float)scene->envMap->width, (float)scene->envMap->height);
-                glUniform1f(glGetUniformLocation(shaderObject, "envMapTotalSum"), scene->envMap->totalSum);
+                glUniform2f(glGetUniformLocation(shaderObject, "envMapImportanceRes"), (float)scene->envMap->importanceWidth, (float)scene->envMap->importanceHeight);
                 pathTraceShaderLowRes->StopUsing();
+
+                if (scene->renderOptions.freeCPUData)
+                    scene->envMap->ReleaseData();
             }
         }
 
@@ -732,11 +1425,48 @@ namespace GLSLPT
         // If scene was modified then clear out image for re-rendering
         if (scene->dirty)
         {
-            tile.x = -1;
-            tile.y = numTiles.y - 1;
+            // The history can be reprojected if only the camera changed
+            if (scene->renderOptions.enableTemporalReprojection && temporalFBO)
+            {
+                Camera lastCamera = *historyCamera;
+                *historyCamera = *scene->camera;
+                bool reuseHistory = historySamples > 0 && historyCamera->isMoving && !scene->instancesModified && !scene->envMapModified;
+
+                // Samples rendered since the last preview would be lost otherwise
+                if (reuseHistory && tileScheduler->GetTotalSamples() > 0)
+                    ResolveAccumulation();
+
+                if (!reuseHistory)
+                    historySamples = 0;
+
+                GLuint shaderObject;
+                temporalShader->Use();
+                shaderObject = temporalShader->getObject();
+                glUniform1i(glGetUniformLocation(shaderObject, "resolveAccum"), false);
+                glUniform1i(glGetUniformLocation(shaderObject, "reuseHistory"), reuseHistory);
+                glUniform3f(glGetUniformLocation(shaderObject, "camera.position"), scene->camera->position.x, scene->camera->position.y, scene->camera->position.z);
+                glUniform3f(glGetUniformLocation(shaderObject, "camera.right"), scene->camera->right.x, scene->camera->right.y, scene->camera->right.z);
+                glUniform3f(glGetUniformLocation(shaderObject, "camera.up"), scene->camera->up.x, scene->camera->up.y, scene->camera->up.z);
+                glUniform3f(glGetUniformLocation(shaderObject, "camera.forward"), scene->camera->forward.x, scene->camera->forward.y, scene->camera->forward.z);
+                glUniform1f(glGetUniformLocation(shaderObject, "camera.fov"), scene->camera->fov);
+                glUniform3f(glGetUniformLocation(shaderObject, "prevCamera.position"), lastCamera.position.x, lastCamera.position.y, lastCamera.position.z);
+                glUniform3f(glGetUniformLocation(shaderObject, "prevCamera.right"), lastCamera.right.x, lastCamera.right.y, lastCamera.right.z);
+                glUniform3f(glGetUniformLocation(shaderObject, "prevCamera.up"), lastCamera.up.x, lastCamera.up.y, lastCamera.up.z);
+                glUniform3f(glGetUniformLocation(shaderObject, "prevCamera.forward"), lastCamera.forward.x, lastCamera.forward.y, lastCamera.forward.z);
+                glUniform1f(glGetUniformLocation(shaderObject, "prevCamera.fov"), lastCamera.fov);
+                temporalShader->StopUsing();
+            }
+
+            tileScheduler->Reset();
             sampleCounter = 1;
             denoised = false;
             frameCounter = 1;
+            checkpointSamples = 0;
+
+            std::vector<float> zeroSamples(numTiles.x * numTiles.y, 0.0f);
+            glActiveTexture(GL_TEXTURE26);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, numTiles.x, numTiles.y, GL_RED, GL_FLOAT, &zeroSamples[0]);
+            glActiveTexture(GL_TEXTURE0);
 
             // Clear out the accumulated texture for rendering a new image
             glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
@@ -745,19 +1475,14 @@ namespace GLSLPT
         else // Update render state
         {
             frameCounter++;
-            tile.x++;
-            if (tile.x >= numTiles.x)
+            UpdateTileWeights();
+            tile = tileScheduler->NextTile();
+
+            // When a pass is done the image can be displayed and the next pass is rendered to the other buffer
+            if (tileScheduler->GetPass() != sampleCounter)
             {
-                tile.x = 0;
-                tile.y--;
-                if (tile.y < 0)
-                {
-                    // If we've reached here, it means all the tiles have been rendered (for a single sample) and the image can now be displayed.
-                    tile.x = 0;
-                    tile.y = numTiles.y - 1;
-                    sampleCounter++;
-                    currentBuffer = 1 - currentBuffer;
-                }
+                sampleCounter = tileScheduler->GetPass();
+                currentBuffer = 1 - currentBuffer;
             }
         }
 
@@ -781,6 +1506,7 @@ namespace GLSLPT
         glUniform3f(glGetUniformLocation(shaderObject, "uniformLightCol"), scene->renderOptions.uniformLightCol.x, scene->renderOptions.uniformLightCol.y, scene->renderOptions.uniformLightCol.z);
         glUniform1f(glGetUniformLocation(shaderObject, "roughnessMollificationAmt"), scene->renderOptions.roughnessMollificationAmt);
         glUniform1i(glGetUniformLocation(shaderObject, "frameNum"), frameCounter);   
+        glUniform1i(glGetUniformLocation(shaderObject, "sampleNum"), tileScheduler->GetTileSamples(tile));
         pathTraceShader->StopUsing();
 
         pathTraceShaderLowRes->Use();
@@ -795,7 +1521,12 @@ namespace GLSLPT
         glUniform1i(glGetUniformLocation(shaderObject, "enableEnvMap"), scene->envMap == nullptr ? false : scene->renderOptions.enableEnvMap);
         glUniform1f(glGetUniformLocation(shaderObject, "envMapIntensity"), scene->renderOptions.envMapIntensity);
         glUniform1f(glGetUniformLocation(shaderObject, "envMapRot"), scene->renderOptions.envMapRot / 360.0f);
-        glUniform1i(glGetUniformLocation(shaderObject, "maxDepth"), scene->dirty ? 2 : scene->renderOptions.maxDepth);
+        // The preview stays shallow while moving. With temporal reprojection the history converges to the image at
+        // previewMaxDepth and is replaced by the full depth accumulation once the camera stops
+        int previewDepth = std::min(scene->renderOptions.previewMaxDepth, scene->renderOptions.maxDepth);
+        glUniform1i(glGetUniformLocation(shaderObject, "maxDepth"), scene->dirty ? previewDepth : scene->renderOptions.maxDepth);
+        glUniform1i(glGetUniformLocation(shaderObject, "frameNum"), previewFrame);
+        glUniform1i(glGetUniformLocation(shaderObject, "sampleNum"), previewFrame);
         glUniform3f(glGetUniformLocation(shaderObject, "camera.position"), scene->camera->position.x, scene->camera->position.y, scene->camera->position.z);
         glUniform3f(glGetUniformLocation(shaderObject, "uniformLightCol"), scene->renderOptions.uniformLightCol.x, scene->renderOptions.uniformLightCol.y, scene->renderOptions.uniformLightCol.z);
         glUniform1f(glGetUniformLocation(shaderObject, "roughnessMollificationAmt"), scene->renderOptions.roughnessMollificationAmt);
@@ -803,11 +1534,14 @@ namespace GLSLPT
 
         tonemapShader->Use();
         shaderObject = tonemapShader->getObject();
-        glUniform1f(glGetUniformLocation(shaderObject, "invSampleCounter"), 1.0f / (sampleCounter));
         glUniform1i(glGetUniformLocation(shaderObject, "enableTonemap"), scene->renderOptions.enableTonemap);
         glUniform1i(glGetUniformLocation(shaderObject, "enableAces"), scene->renderOptions.enableAces);
         glUniform1i(glGetUniformLocation(shaderObject, "simpleAcesFit"), scene->renderOptions.simpleAcesFit);
         glUniform3f(glGetUniformLocation(shaderObject, "backgroundCol"), scene->renderOptions.backgroundCol.x, scene->renderOptions.backgroundCol.y, scene->renderOptions.backgroundCol.z);
         tonemapShader->StopUsing();
+
+        // A loaded checkpoint takes the place of the image that was just cleared
+        if (scene->dirty && resumeCheckpoint)
+            RestoreCheckpoint();
     }
 }
\ No newline at end of file
@@ -25,15 +25,27 @@
 #pragma once
 
 #include <vector>
+#include <future>
+#include <chrono>
 #include "Quad.h"
 #include "Program.h"
 #include "Vec2.h"
 #include "Vec3.h"
+#include "Vec4.h"
 
 namespace GLSLPT
 {
     Program* LoadShaders(const ShaderInclude::ShaderSource& vertShaderObj, const ShaderInclude::ShaderSource& fragShaderObj);
 
+    // Number of texture arrays that scene textures are bucketed into. Must match MAX_TEXTURE_BUCKETS in uniforms.glsl
+    const int MAX_TEXTURE_BUCKETS = 4;
+
+    // Width and height of the blue noise mask. Must match BLUE_NOISE_SIZE in globals.glsl
+    const int BLUE_NOISE_SIZE = 64;
+
+    // Most samples a pixel of the reprojected preview history stands for, so shading that went stale while moving fades out
+    const int MAX_HISTORY_SAMPLES = 32;
+
     struct RenderOptions
     {
         RenderOptions()
@@ -45,11 +57,14 @@ namespace GLSLPT
             tileWidth = 100;
             tileHeight = 100;
             maxDepth = 2;
+            previewMaxDepth = 2;
             maxSpp = -1;
             RRDepth = 2;
             texArrayWidth = 2048;
             texArrayHeight = 2048;
             denoiserFrameCnt = 20;
+            roiSampleRatio = 0;
+            checkpointInterval = 0;
             enableRR = true;
             enableDenoiser = false;
             enableTonemap = true;
@@ -63,6 +78,19 @@ namespace GLSLPT
             independentRenderSize = false;
             enableRoughnessMollification = false;
             enableVolumeMIS = false;
+            enableStacklessBVH = false;
+            enableBVHTreeletLayout = false;
+            enableTriangleBuffer = false;
+            enableSignedAABB = false;
+            enableTextureCompression = false;
+            freeCPUData = false;
+            enableLightBVH = false;
+            enableSobolSampler = false;
+            enableBlueNoise = false;
+            enableTemporalReprojection = false;
+            enableROI = false;
+            roiFollowMouse = false;
+            roi = Vec4(0.25f, 0.25f, 0.75f, 0.75f);
             envMapIntensity = 1.0f;
             envMapRot = 0.0f;
             roughnessMollificationAmt = 0.0f;
@@ -75,11 +103,14 @@ namespace GLSLPT
         int tileWidth;
         int tileHeight;
         int maxDepth;
+        int previewMaxDepth;
         int maxSpp;
         int RRDepth;
         int texArrayWidth;
         int texArrayHeight;
         int denoiserFrameCnt;
+        int roiSampleRatio; // Passes over the region of interest per pass over the rest of the image. 0 freezes the rest
+        int checkpointInterval; // Seconds between checkpoints of the accumulated samples. 0 disables them
         bool enableRR;
         bool enableDenoiser;
         bool enableTonemap;
@@ -94,12 +125,29 @@ namespace GLSLPT
         bool independentRenderSize;
         bool enableRoughnessMollification;
         bool enableVolumeMIS;
+        bool enableStacklessBVH;
+        bool enableBVHTreeletLayout;
+        bool enableTriangleBuffer;
+        bool enableSignedAABB;
+        bool enableTextureCompression;
+        bool freeCPUData; // Release scene data on the CPU once it has been uploaded
+        bool enableLightBVH;
+        bool enableSobolSampler; // Owen scrambled Sobol points instead of independent random numbers
+        bool enableBlueNoise; // Camera and first bounce samples come from a blue noise mask
+        bool enableTemporalReprojection; // While the camera moves, earlier samples are reprojected into the preview
+        bool enableROI; // Sample the tiles under the region of interest more often
+        bool roiFollowMouse;
         float envMapIntensity;
         float envMapRot;
         float roughnessMollificationAmt;
+        Vec4 roi; // Min x, min y, max x, max y of the region of interest in [0, 1] from the top left of the image
+        std::string textureCacheDir; // Compressed textures are cached here when set
     };
 
     class Scene;
+    class Camera;
+    class TileScheduler;
+    struct Checkpoint;
 
     class Renderer
     {
@@ -110,24 +158,39 @@ namespace GLSLPT
         // Opengl buffer objects and textures for storing scene data on the GPU
         GLuint BVHBuffer;
         GLuint BVHTex;
+        GLuint BVHLinksBuffer;
+        GLuint BVHLinksTex;
         GLuint vertexIndicesBuffer;
         GLuint vertexIndicesTex;
         GLuint verticesBuffer;
         GLuint verticesTex;
         GLuint normalsBuffer;
         GLuint normalsTex;
+        GLuint trianglesBuffer;
+        GLuint trianglesTex;
         GLuint materialsTex;
         GLuint transformsTex;
         GLuint lightsTex;
-        GLuint textureMapsArrayTex;
+        GLuint lightAliasBuffer;
+        GLuint lightAliasTex;
+        GLuint lightBVHBuffer;
+        GLuint lightBVHTex;
+        GLuint meshLightsBuffer;
+        GLuint meshLightsTex;
+        GLuint textureInfoBuffer;
+        GLuint textureInfoTex;
+        GLuint textureMapsArrayTex[MAX_TEXTURE_BUCKETS];
         GLuint envMapTex;
-        GLuint envMapCDFTex;
+        GLuint envMapAliasBuffer;
+        GLuint envMapAliasTex;
+        GLuint blueNoiseTex;
 
         // FBOs
         GLuint pathTraceFBO;
         GLuint pathTraceFBOLowRes;
         GLuint accumFBO;
         GLuint outputFBO;
+        GLuint temporalFBO;
 
         // Shaders
         std::string shadersDirectory;
@@ -135,6 +198,7 @@ namespace GLSLPT
         Program* pathTraceShaderLowRes;
         Program* outputShader;
         Program* tonemapShader;
+        Program* temporalShader;
 
         // Render textures
         GLuint pathTraceTextureLowRes;
@@ -143,6 +207,16 @@ namespace GLSLPT
         GLuint tileOutputTexture[2];
         GLuint denoisedTexture;
 
+        // Preview history for temporal reprojection, at render resolution. The position textures hold the world space
+        // first hit in xyz and the number of samples the pixel stands for in w
+        GLuint previewDepthTexture;
+        GLuint historyTexture[2];
+        GLuint historyPositionTexture[2];
+        Camera* historyCamera;
+        int historyBuffer;
+        int historySamples;
+        int previewFrame;
+
         // Render resolution and window resolution
         iVec2 renderSize;
         iVec2 windowSize;
@@ -158,6 +232,21 @@ namespace GLSLPT
         int sampleCounter;
         float pixelRatio;
 
+        // Picks the tile rendered each frame and counts its samples. The counts are also kept in a texture to normalize
+        // the tiles of the accumulation with
+        TileScheduler* tileScheduler;
+        GLuint tileSamplesTex;
+
+        // Checkpoint waiting to be applied when the image is cleared, and the one being written in the background
+        Checkpoint* resumeCheckpoint;
+        std::future<bool> checkpointWrite;
+        int checkpointSamples;
+
+        // Textures that arrive while others are still loading restart the image at growing intervals
+        bool textureRestartPending;
+        double textureRestartInterval;
+        std::chrono::steady_clock::time_point lastTextureRestart;
+
         // Denoiser output
         Vec3* denoiserInputFramePtr;
         Vec3* frameOutputPtr;
@@ -178,9 +267,21 @@ namespace GLSLPT
         int GetSampleCount();
         void GetOutputBuffer(unsigned char**, int& w, int& h);
 
+        // Saves the accumulated samples so the render can be continued after the process ends. The samples are read
+        // back right away and the file is written in the background. Returns false if nothing new was saved
+        bool SaveCheckpoint(const std::string& filename);
+
+        // Continues the render from a checkpoint of the same scene and settings instead of starting from scratch
+        bool LoadCheckpoint(const std::string& filename);
+
     private:
         void InitGPUDataBuffers();
         void InitFBOs();
         void InitShaders();
+        void InitTemporalBuffers();
+        void UpdateTileWeights();
+        void RestoreCheckpoint();
+        void DrawHistory();
+        void ResolveAccumulation();
     };
 }
\ No newline at end of file
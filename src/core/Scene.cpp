@@ -26,6 +26,10 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
 #include "stb_image_resize.h"
 #include "stb_image.h"
 #include "Scene.h"
@@ -33,8 +37,69 @@
 
 namespace GLSLPT
 {
+    static int NextPowerOfTwo(int x)
+    {
+        int p = 1;
+        while (p < x)
+            p <<= 1;
+        return p;
+    }
+
+    // Keeps the pixels of a texture decoded by a background job if they match the size read from its header
+    static void StoreDecodedTexture(Texture* texture, unsigned char* data, int width, int height)
+    {
+        if (data == nullptr || width != texture->width || height != texture->height)
+            printf("Unable to decode texture %s\n", texture->name.c_str());
+        else
+            texture->texData.assign(data, data + width * height * 4);
+        stbi_image_free(data);
+    }
+
+    // FNV-1a hash of the source pixels and the settings the texture is encoded with
+    static uint64_t HashTexture(const Texture& texture, int width, int height, TextureFormat format)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto hashBytes = [&hash](const unsigned char* data, size_t size) {
+            for (size_t i = 0; i < size; i++)
+                hash = (hash ^ data[i]) * 1099511628211ull;
+        };
+
+        int params[5] = { texture.width, texture.height, width, height, (int)format };
+        hashBytes((const unsigned char*)params, sizeof(params));
+        hashBytes(texture.texData.data(), texture.texData.size());
+        return hash;
+    }
+
+    static bool LoadCachedTexture(const std::string& path, size_t size, std::vector<unsigned char>& data)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+
+        data.resize(size);
+        bool valid = fread(data.data(), 1, size, file) == size && fgetc(file) == EOF;
+        fclose(file);
+        return valid;
+    }
+
+    static void SaveCachedTexture(const std::string& path, const std::vector<unsigned char>& data)
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            printf("Unable to write texture cache %s\n", path.c_str());
+            return;
+        }
+
+        fwrite(data.data(), 1, data.size(), file);
+        fclose(file);
+    }
+
     Scene::~Scene()
     {
+        // Stop texture jobs before the textures they write to are deleted
+        delete texturePool;
+
         for (int i = 0; i < meshes.size(); i++)
             delete meshes[i];
         meshes.clear();
@@ -94,15 +159,52 @@ namespace GLSLPT
         Texture* texture = new Texture;
 
         printf("Loading texture %s\n", filename.c_str());
-        if (texture->LoadTexture(filename))
-            textures.push_back(texture);
-        else
+        if (!texture->LoadTextureInfo(filename))
         {
             printf("Unable to load texture %s\n", filename.c_str());
             delete texture;
-            id = -1;
+            return -1;
+        }
+        textures.push_back(texture);
+
+        // Decode in the background while the rest of the scene loads
+        if (!texturePool)
+            texturePool = new ThreadPool();
+
+        textureDecodes.resize(textures.size());
+        textureDecodes[id] = texturePool->Submit([texture]() {
+            int width, height;
+            unsigned char* data = stbi_load(texture->name.c_str(), &width, &height, NULL, 4);
+            StoreDecodedTexture(texture, data, width, height);
+        });
+
+        return id;
+    }
+
+    int Scene::AddTexture(const std::string& name, std::vector<unsigned char> encoded)
+    {
+        int id = textures.size();
+        Texture* texture = new Texture;
+        textures.push_back(texture);
+
+        if (encoded.empty() || !texture->LoadTextureInfo(name, &encoded[0], (int)encoded.size()))
+        {
+            printf("Unable to load texture %s\n", name.c_str());
+            unsigned char white[4] = { 255, 255, 255, 255 };
+            *texture = Texture(name, white, 1, 1, 4);
+            return id;
         }
 
+        if (!texturePool)
+            texturePool = new ThreadPool();
+
+        textureDecodes.resize(textures.size());
+        textureDecodes[id] = texturePool->Submit([texture, encoded = std::move(encoded)]() {
+            int width, height;
+            unsigned char* data = stbi_load_from_memory(&encoded[0], (int)encoded.size(), &width, &height, NULL, 4);
+            StoreDecodedTexture(texture, data, width, height);
+        });
+
         return id;
     }
 
@@ -156,29 +258,26 @@ namespace GLSLPT
             RadeonRays::bbox bbox = meshes[meshInstances[i].meshID]->bvh->Bounds();
             Mat4 matrix = meshInstances[i].transform;
 
-            Vec3 minBound = bbox.pmin;
-            Vec3 maxBound = bbox.pmax;
+            Vec3A minBound = bbox.pmin;
+            Vec3A maxBound = bbox.pmax;
 
-            Vec3 right       = Vec3(matrix[0][0], matrix[0][1], matrix[0][2]);
-            Vec3 up          = Vec3(matrix[1][0], matrix[1][1], matrix[1][2]);
-            Vec3 forward     = Vec3(matrix[2][0], matrix[2][1], matrix[2][2]);
-            Vec3 translation = Vec3(matrix[3][0], matrix[3][1], matrix[3][2]);
+            Vec3A right       = Vec3A(matrix[0][0], matrix[0][1], matrix[0][2]);
+            Vec3A up          = Vec3A(matrix[1][0], matrix[1][1], matrix[1][2]);
+            Vec3A forward     = Vec3A(matrix[2][0], matrix[2][1], matrix[2][2]);
+            Vec3A translation = Vec3A(matrix[3][0], matrix[3][1], matrix[3][2]);
 
-            Vec3 xa = right * minBound.x;
-            Vec3 xb = right * maxBound.x;
+            Vec3A xa = right * minBound.x;
+            Vec3A xb = right * maxBound.x;
 
-            Vec3 ya = up * minBound.y;
-            Vec3 yb = up * maxBound.y;
+            Vec3A ya = up * minBound.y;
+            Vec3A yb = up * maxBound.y;
 
-            Vec3 za = forward * minBound.z;
-            Vec3 zb = forward * maxBound.z;
-
-            minBound = Vec3::Min(xa, xb) + Vec3::Min(ya, yb) + Vec3::Min(za, zb) + translation;
-            maxBound = Vec3::Max(xa, xb) + Vec3::Max(ya, yb) + Vec3::Max(za, zb) + translation;
+            Vec3A za = forward * minBound.z;
+            Vec3A zb = forward * maxBound.z;
 
             RadeonRays::bbox bound;
-            bound.pmin = minBound;
-            bound.pmax = maxBound;
+            bound.pmin = Vec3A::Min(xa, xb) + Vec3A::Min(ya, yb) + Vec3A::Min(za, zb) + translation;
+            bound.pmax = Vec3A::Max(xa, xb) + Vec3A::Max(ya, yb) + Vec3A::Max(za, zb) + translation;
 
             bounds[i] = bound;
         }
@@ -209,23 +308,79 @@ namespace GLSLPT
         for (int i = 0; i < meshInstances.size(); i++)
             transforms[i] = meshInstances[i].transform;
 
+        // Emissive triangles move with their instances
+        if (!emissiveTriangles.empty())
+            BuildMeshLights();
+
         instancesModified = true;
         dirty = true;
     }
 
-    void Scene::ProcessScene()
+    void Scene::ProcessTexture(int texID)
     {
-        printf("Processing scene data\n");
-        createBLAS();
+        Texture* texture = textures[texID];
+        const TextureBucket& bucket = textureBuckets[textureLocations[texID].x];
 
-        printf("Building scene BVH\n");
-        createTLAS();
+        // The placeholder stays if decoding failed
+        if (texture->texData.empty())
+        {
+            std::lock_guard<std::mutex> lock(textureUpdatesMutex);
+            texturesLoading--;
+            return;
+        }
 
-        // Flatten BVH
-        printf("Flattening BVH\n");
-        bvhTranslator.Process(sceneBvh, meshes, meshInstances);
+        // Encoding is slow so compressed mip chains are kept on disk, keyed by the source pixels and the target size and format
+        std::vector<unsigned char> mipChain;
+        std::string cachePath;
+        if (bucket.format != Uncompressed && !renderOptions.textureCacheDir.empty())
+        {
+            uint64_t hash = HashTexture(*texture, bucket.width, bucket.height, bucket.format);
+            char cacheName[32];
+            snprintf(cacheName, sizeof(cacheName), "/%016llx.tex", (unsigned long long)hash);
+            cachePath = renderOptions.textureCacheDir + cacheName;
+        }
+
+        if (cachePath.empty() || !LoadCachedTexture(cachePath, TextureMipChainSize(bucket.format, bucket.width, bucket.height), mipChain))
+        {
+            // Resize textures to fit the texture array of their bucket
+            std::vector<unsigned char> resized;
+            const unsigned char* baseLevel = &texture->texData[0];
+            if (texture->width != bucket.width || texture->height != bucket.height)
+            {
+                resized.resize(bucket.width * bucket.height * 4);
+                stbir_resize_uint8(baseLevel, texture->width, texture->height, 0, &resized[0], bucket.width, bucket.height, 0, 4);
+                baseLevel = &resized[0];
+            }
+
+            CompressMipChain(bucket.format, baseLevel, bucket.width, bucket.height, mipChain);
+
+            if (!cachePath.empty())
+                SaveCachedTexture(cachePath, mipChain);
+        }
+
+        if (renderOptions.freeCPUData)
+            std::vector<unsigned char>().swap(texture->texData);
 
-        // Copy mesh data
+        std::lock_guard<std::mutex> lock(textureUpdatesMutex);
+        textureUpdates.push_back(TextureUpdate{ texID, std::move(mipChain) });
+        texturesLoading--;
+    }
+
+    void Scene::TakeTextureUpdates(std::vector<TextureUpdate>& updates)
+    {
+        std::lock_guard<std::mutex> lock(textureUpdatesMutex);
+        updates.swap(textureUpdates);
+        textureUpdates.clear();
+    }
+
+    void Scene::WaitForTextures()
+    {
+        if (texturePool)
+            texturePool->Wait();
+    }
+
+    void Scene::CopyMeshData()
+    {
         int verticesCnt = 0;
         printf("Copying Mesh Data\n");
         for (int i = 0; i < meshes.size(); i++)
@@ -251,6 +406,261 @@ namespace GLSLPT
             verticesCnt += meshes[i]->verticesUVX.size();
         }
 
+        // Precompute the data needed for ray-triangle tests so traversal can read it in one go
+        if (renderOptions.enableTriangleBuffer)
+        {
+            printf("Precomputing triangle data\n");
+            triangles.resize(vertIndices.size() * 3);
+            for (int i = 0; i < vertIndices.size(); i++)
+            {
+                Vec3 v0 = Vec3(verticesUVX[vertIndices[i].x]);
+                Vec3 v1 = Vec3(verticesUVX[vertIndices[i].y]);
+                Vec3 v2 = Vec3(verticesUVX[vertIndices[i].z]);
+
+                triangles[i * 3 + 0] = v0;
+                triangles[i * 3 + 1] = v1 - v0;
+                triangles[i * 3 + 2] = v2 - v0;
+            }
+        }
+    }
+
+    void Scene::ReleaseCPUData()
+    {
+        for (int i = 0; i < meshes.size(); i++)
+            meshes[i]->ReleaseData();
+
+        std::vector<Indices>().swap(vertIndices);
+        std::vector<Vec4>().swap(verticesUVX);
+        std::vector<Vec4>().swap(normalsUVY);
+        std::vector<Vec3>().swap(triangles);
+
+        // Scene textures are released by their loading jobs as they finish
+        for (int i = 0; i < textureBuckets.size(); i++)
+            std::vector<unsigned char>().swap(textureBuckets[i].texData);
+
+        if (envMap)
+            envMap->ReleaseData();
+    }
+
+    bool Scene::LoadMeshData()
+    {
+        if (!vertIndices.empty())
+            return true;
+
+        for (int i = 0; i < meshes.size(); i++)
+        {
+            if (!meshes[i]->ReloadData())
+            {
+                printf("Unable to reload mesh %s\n", meshes[i]->name.c_str());
+                return false;
+            }
+        }
+
+        CopyMeshData();
+        return true;
+    }
+
+    uint64_t Scene::Hash() const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto hashBytes = [&hash](const void* data, size_t size) {
+            for (size_t i = 0; i < size; i++)
+                hash = (hash ^ ((const unsigned char*)data)[i]) * 1099511628211ull;
+        };
+
+        // Meshes and textures go by their names, as their data may have been released
+        for (const Mesh* mesh : meshes)
+            hashBytes(mesh->name.c_str(), mesh->name.size() + 1);
+        for (const Texture* texture : textures)
+            hashBytes(texture->name.c_str(), texture->name.size() + 1);
+        if (envMap)
+            hashBytes(envMap->name.c_str(), envMap->name.size() + 1);
+
+        for (const MeshInstance& instance : meshInstances)
+        {
+            int ids[2] = { instance.meshID, instance.materialID };
+            hashBytes(ids, sizeof(ids));
+            hashBytes(&instance.transform, sizeof(Mat4));
+        }
+        hashBytes(materials.data(), sizeof(Material) * materials.size());
+        hashBytes(lights.data(), sizeof(Light) * lights.size());
+
+        float cameraParams[] = {
+            camera->position.x, camera->position.y, camera->position.z,
+            camera->forward.x, camera->forward.y, camera->forward.z,
+            camera->up.x, camera->up.y, camera->up.z,
+            camera->fov, camera->focalDist, camera->aperture
+        };
+        hashBytes(cameraParams, sizeof(cameraParams));
+
+        // Options that change the converged image or the sample sequence. Display options like tonemapping don't
+        const RenderOptions& options = renderOptions;
+        int intOptions[] = {
+            options.renderResolution.x, options.renderResolution.y, options.tileWidth, options.tileHeight,
+            options.maxDepth, options.RRDepth, options.enableRR, options.enableEnvMap, options.enableUniformLight,
+            options.hideEmitters, options.openglNormalMap, options.enableRoughnessMollification,
+            options.enableTextureCompression, options.enableSobolSampler, options.enableBlueNoise
+        };
+        float floatOptions[] = {
+            options.envMapIntensity, options.envMapRot, options.roughnessMollificationAmt,
+            options.uniformLightCol.x, options.uniformLightCol.y, options.uniformLightCol.z
+        };
+        hashBytes(intOptions, sizeof(intOptions));
+        hashBytes(floatOptions, sizeof(floatOptions));
+
+        return hash;
+    }
+
+    void Scene::BuildLightDistribution()
+    {
+        // Distant lights are given the power that falls on the region holding the area lights, as that is where they
+        // compete with each other. The whole scene would let a distant light win every pick if the scene has a large
+        // ground plane. Scenes with only distant lights fall back to the scene bounds
+        RadeonRays::bbox lightBounds;
+        for (const Light& light : lights)
+        {
+            if (light.type == RectLight)
+            {
+                lightBounds.grow(light.position);
+                lightBounds.grow(light.position + light.u);
+                lightBounds.grow(light.position + light.v);
+                lightBounds.grow(light.position + light.u + light.v);
+            }
+            else if (light.type == SphereLight)
+            {
+                Vec3 radius(light.radius, light.radius, light.radius);
+                lightBounds.grow(light.position - radius);
+                lightBounds.grow(light.position + radius);
+            }
+        }
+
+        bool hasAreaLights = lightBounds.pmin.x <= lightBounds.pmax.x;
+        float distantRadius = Vec3::Length((hasAreaLights ? lightBounds : sceneBounds).extents()) * 0.5f;
+
+        int numLights = lights.size();
+        std::vector<double> weights(numLights);
+        double sum = 0.0;
+        for (int i = 0; i < numLights; i++)
+        {
+            weights[i] = LightPower(lights[i], distantRadius);
+            sum += weights[i];
+        }
+
+        lightAliasTable.resize(numLights);
+        BuildAliasTable(&weights[0], numLights, &lightAliasTable[0]);
+
+        for (int i = 0; i < numLights; i++)
+        {
+            AliasEntry& entry = lightAliasTable[i];
+            entry.pdf = sum > 0.0 ? (float)(weights[i] / sum) : 1.0f / numLights;
+            entry.aliasPdf = sum > 0.0 ? (float)(weights[entry.alias] / sum) : 1.0f / numLights;
+        }
+    }
+
+    // Emitted radiance per unit area that mesh lights are weighted by. Emission maps are assumed to be fully bright.
+    // Must match MeshLightDensity in lights.glsl
+    static float MeshLightDensity(const Material& material)
+    {
+        if (material.emissionmapTexID >= 0)
+            return 1.0f;
+
+        return 0.212671f * material.emission.x + 0.715160f * material.emission.y + 0.072169f * material.emission.z;
+    }
+
+    void Scene::CollectEmissiveTriangles()
+    {
+        std::vector<int> firstVertex(meshes.size());
+        for (int i = 1; i < meshes.size(); i++)
+            firstVertex[i] = firstVertex[i - 1] + meshes[i - 1]->verticesUVX.size();
+
+        for (int i = 0; i < meshInstances.size(); i++)
+        {
+            if (MeshLightDensity(materials[meshInstances[i].materialID]) <= 0.0f)
+                continue;
+
+            int meshID = meshInstances[i].meshID;
+            const std::vector<Vec4>& vertices = meshes[meshID]->verticesUVX;
+            for (int j = 0; j < vertices.size(); j += 3)
+                emissiveTriangles.push_back({ Vec3(vertices[j]), Vec3(vertices[j + 1]), Vec3(vertices[j + 2]), firstVertex[meshID] + j, i });
+        }
+    }
+
+    void Scene::BuildMeshLights()
+    {
+        int numTriangles = emissiveTriangles.size();
+        meshLights.resize(numTriangles);
+        std::vector<double> weights(numTriangles);
+        std::vector<float> densities(numTriangles);
+        double sum = 0.0;
+
+        for (int i = 0; i < numTriangles; i++)
+        {
+            const EmissiveTriangle& triangle = emissiveTriangles[i];
+            const MeshInstance& instance = meshInstances[triangle.instance];
+            Vec3 v0 = instance.transform.TransformPoint(triangle.v0);
+            Vec3 v1 = instance.transform.TransformPoint(triangle.v1);
+            Vec3 v2 = instance.transform.TransformPoint(triangle.v2);
+
+            MeshLight& light = meshLights[i];
+            light.v0 = v0;
+            light.e1 = v1 - v0;
+            light.e2 = v2 - v0;
+            light.firstVertex = triangle.firstVertex;
+            light.matID = instance.materialID;
+            light.padding = 0.0f;
+
+            float area = 0.5f * Vec3::Length(Vec3::Cross(light.e1, light.e2));
+            densities[i] = MeshLightDensity(materials[instance.materialID]);
+            weights[i] = (double)densities[i] * area;
+            sum += weights[i];
+        }
+
+        std::vector<AliasEntry> table(numTriangles);
+        BuildAliasTable(&weights[0], numTriangles, &table[0]);
+
+        // Picking a triangle and then a point on it uniformly gives a pdf per unit area of density / sum
+        meshLightsPower = (float)sum;
+        for (int i = 0; i < numTriangles; i++)
+        {
+            meshLights[i].entry = table[i];
+            meshLights[i].entry.pdf = sum > 0.0 ? (float)(densities[i] / sum) : 0.0f;
+            meshLights[i].entry.aliasPdf = sum > 0.0 ? (float)(densities[table[i].alias] / sum) : 0.0f;
+        }
+    }
+
+    void Scene::ProcessScene()
+    {
+        printf("Processing scene data\n");
+        createBLAS();
+
+        printf("Building scene BVH\n");
+        createTLAS();
+
+        // Flatten BVH
+        printf("Flattening BVH\n");
+        bvhTranslator.treeletLayout = renderOptions.enableBVHTreeletLayout;
+        bvhTranslator.Process(sceneBvh, meshes, meshInstances);
+
+        CopyMeshData();
+
+        if (renderOptions.enableLightBVH && !lights.empty())
+        {
+            printf("Building light BVH\n");
+            lightBvh.Build(lights);
+        }
+        else if (!lights.empty())
+        {
+            printf("Building light distribution\n");
+            BuildLightDistribution();
+        }
+
+        CollectEmissiveTriangles();
+        if (!emissiveTriangles.empty())
+        {
+            printf("Building mesh light distribution : %d emissive triangles\n", (int)emissiveTriangles.size());
+            BuildMeshLights();
+        }
+
         // Copy transforms
         printf("Copying transforms\n");
         transforms.resize(meshInstances.size());
@@ -261,27 +671,159 @@ namespace GLSLPT
         if (!textures.empty())
             printf("Copying and resizing textures\n");
 
-        int reqWidth = renderOptions.texArrayWidth;
-        int reqHeight = renderOptions.texArrayHeight;
-        int texBytes = reqWidth * reqHeight * 4;
-        textureMapsArray.resize(texBytes * textures.size());
+        std::vector<bool> normalMapOnly(textures.size(), false);
+        for (int i = 0; i < materials.size(); i++)
+            if (materials[i].normalmapTexID >= 0)
+                normalMapOnly[(int)materials[i].normalmapTexID] = true;
 
-#pragma omp parallel for
+        for (int i = 0; i < materials.size(); i++)
+        {
+            float colorTexIDs[3] = { materials[i].baseColorTexId, materials[i].metallicRoughnessTexID, materials[i].emissionmapTexID };
+            for (int j = 0; j < 3; j++)
+                if (colorTexIDs[j] >= 0)
+                    normalMapOnly[(int)colorTexIDs[j]] = false;
+        }
+
+        // Pick a format for each texture. Normal maps only need two channels and
+        // textures without transparency don't need alpha. Textures that are also used for color keep all their channels.
+        // BC7 replaces BC3 where the GPU has it, and textures stay RGBA8 when it has neither format they could use
+        std::vector<TextureFormat> texFormats(textures.size(), Uncompressed);
+        if (renderOptions.enableTextureCompression)
+        {
+            for (int i = 0; i < textures.size(); i++)
+            {
+                if (normalMapOnly[i])
+                    texFormats[i] = BC5;
+                else if (textures[i]->hasAlpha)
+                    texFormats[i] = enableBPTC ? BC7 : enableS3TC ? BC3 : Uncompressed;
+                else
+                    texFormats[i] = enableS3TC ? BC1 : enableBPTC ? BC7 : Uncompressed;
+            }
+        }
+
+        // Round texture sizes up to a power of two so that mip chains are complete.
+        // texArrayWidth and texArrayHeight cap the size of the largest textures
+        std::vector<iVec2> texSizes(textures.size());
+        for (int i = 0; i < textures.size(); i++)
+        {
+            texSizes[i] = iVec2(std::min(NextPowerOfTwo(textures[i]->width), renderOptions.texArrayWidth),
+                                std::min(NextPowerOfTwo(textures[i]->height), renderOptions.texArrayHeight));
+
+            // Compressed textures are made of whole 4x4 blocks
+            if (texFormats[i] != Uncompressed)
+                texSizes[i] = iVec2(std::max(texSizes[i].x, 4), std::max(texSizes[i].y, 4));
+        }
+
+        auto findBucket = [this](int width, int height, TextureFormat format) {
+            for (int j = 0; j < textureBuckets.size(); j++)
+                if (textureBuckets[j].width == width && textureBuckets[j].height == height && textureBuckets[j].format == format)
+                    return j;
+            return -1;
+        };
+
+        textureBuckets.clear();
         for (int i = 0; i < textures.size(); i++)
         {
-            int texWidth = textures[i]->width;
-            int texHeight = textures[i]->height;
+            if (findBucket(texSizes[i].x, texSizes[i].y, texFormats[i]) == -1)
+                textureBuckets.push_back(TextureBucket{ texSizes[i].x, texSizes[i].y, 0, texFormats[i] });
+        }
+
+        // The shader has a fixed number of texture arrays, so merge the two smallest buckets of the same format until the rest fit.
+        // There are fewer formats than texture arrays so such a pair always exists
+        auto smallerArea = [](const TextureBucket& a, const TextureBucket& b) { return a.width * a.height < b.width * b.height; };
+        while (textureBuckets.size() > MAX_TEXTURE_BUCKETS)
+        {
+            std::sort(textureBuckets.begin(), textureBuckets.end(), smallerArea);
 
-            // Resize textures to fit 2D texture array
-            if (texWidth != reqWidth || texHeight != reqHeight)
+            int first = -1, second = -1;
+            for (int j = 1; j < textureBuckets.size() && second == -1; j++)
             {
-                unsigned char* resizedTex = new unsigned char[texBytes];
-                stbir_resize_uint8(&textures[i]->texData[0], texWidth, texHeight, 0, resizedTex, reqWidth, reqHeight, 0, 4);
-                std::copy(resizedTex, resizedTex + texBytes, &textureMapsArray[i * texBytes]);
-                delete[] resizedTex;
+                for (int k = 0; k < j; k++)
+                {
+                    if (textureBuckets[k].format == textureBuckets[j].format)
+                    {
+                        first = k;
+                        second = j;
+                        break;
+                    }
+                }
             }
+
+            TextureBucket merged = TextureBucket{ std::max(textureBuckets[first].width, textureBuckets[second].width),
+                                                  std::max(textureBuckets[first].height, textureBuckets[second].height), 0, textureBuckets[first].format };
+            textureBuckets.erase(textureBuckets.begin() + second);
+            textureBuckets.erase(textureBuckets.begin() + first);
+
+            if (findBucket(merged.width, merged.height, merged.format) == -1)
+                textureBuckets.push_back(merged);
+        }
+        std::sort(textureBuckets.begin(), textureBuckets.end(), smallerArea);
+
+        // Place each texture in the smallest bucket of its format that holds it without downscaling
+        textureLocations.resize(textures.size());
+        for (int i = 0; i < textures.size(); i++)
+        {
+            for (int j = 0; j < textureBuckets.size(); j++)
+            {
+                if (textureBuckets[j].format == texFormats[i] && textureBuckets[j].width >= texSizes[i].x && textureBuckets[j].height >= texSizes[i].y)
+                {
+                    textureLocations[i] = iVec2(j, textureBuckets[j].layers++);
+                    break;
+                }
+            }
+        }
+
+        for (int i = 0; i < textureBuckets.size(); i++)
+        {
+            TextureBucket& bucket = textureBuckets[i];
+            if (bucket.format == Uncompressed)
+                bucket.texData.resize((size_t)TextureLevelSize(bucket.format, bucket.width, bucket.height) * bucket.layers);
             else
-                std::copy(textures[i]->texData.begin(), textures[i]->texData.end(), &textureMapsArray[i * texBytes]);
+                bucket.texData.resize((size_t)TextureMipChainSize(bucket.format, bucket.width, bucket.height) * bucket.layers);
+        }
+
+        // Fill each layer with a flat placeholder so rendering can start before the textures are loaded.
+        // Normal maps get an unperturbed normal and everything else mid grey
+        for (int i = 0; i < textures.size(); i++)
+        {
+            TextureBucket& bucket = textureBuckets[textureLocations[i].x];
+            int layer = textureLocations[i].y;
+
+            unsigned char placeholder[4] = { 128, 128, 128, 255 };
+            if (normalMapOnly[i])
+                placeholder[2] = 255;
+
+            // A flat image encodes to the same block everywhere, so a single texel is enough
+            unsigned char block[16];
+            int blockSize = TextureLevelSize(bucket.format, 1, 1);
+            CompressTexture(bucket.format, placeholder, 1, 1, block);
+
+            int levels = bucket.format == Uncompressed ? 1 : TextureMipLevels(bucket.width, bucket.height);
+            size_t offset = 0;
+            for (int j = 0; j < levels; j++)
+            {
+                size_t levelSize = TextureLevelSize(bucket.format, std::max(bucket.width >> j, 1), std::max(bucket.height >> j, 1));
+                unsigned char* layerData = &bucket.texData[offset + layer * levelSize];
+                for (size_t k = 0; k < levelSize; k += blockSize)
+                    memcpy(layerData + k, block, blockSize);
+                offset += levelSize * bucket.layers;
+            }
+        }
+
+        // Resize, mip and compress each texture once it has been decoded. The results are picked up by the renderer
+        texturesLoading = (int)textures.size();
+        for (int i = 0; i < textures.size(); i++)
+        {
+            if (!texturePool)
+                texturePool = new ThreadPool();
+
+            // Jobs run in submission order and all decodes were submitted earlier, so waiting on a decode can't stall the pool
+            std::shared_future<void> decode = i < textureDecodes.size() ? textureDecodes[i] : std::shared_future<void>();
+            texturePool->Submit([this, i, decode]() {
+                if (decode.valid())
+                    decode.wait();
+                ProcessTexture(i);
+            });
         }
 
         // Add a default camera
@@ -24,16 +24,23 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <atomic>
+#include "AliasTable.h"
 #include "EnvironmentMap.h"
 #include "bvh.h"
 #include "Renderer.h"
 #include "Mesh.h"
 #include "Camera.h"
 #include "bvh_translator.h"
+#include "LightBvh.h"
 #include "Texture.h"
+#include "TextureCompressor.h"
+#include "ThreadPool.h"
 #include "Material.h"
 
 namespace GLSLPT
@@ -58,21 +65,54 @@ namespace GLSLPT
         float type;
     };
 
+    // Emissive triangle in world space, picked by power for next event estimation.
+    // Laid out as four RGBA32F texels for the shader
+    struct MeshLight
+    {
+        AliasEntry entry; // pdf and aliasPdf are per unit area
+        Vec3 v0;
+        int firstVertex;  // Index of the first vertex of the triangle in verticesUVX and normalsUVY, for texture coordinates
+        Vec3 e1;
+        int matID;
+        Vec3 e2;
+        float padding;
+    };
+
     struct Indices
     {
         int x, y, z;
     };
 
+    // Textures of the same power of two size and format. Each bucket becomes one texture array on the GPU
+    struct TextureBucket
+    {
+        int width;
+        int height;
+        int layers;
+        TextureFormat format;
+        std::vector<unsigned char> texData; // Uncompressed buckets only hold the base level. Compressed ones hold every mip level, largest first
+    };
+
+    // Every mip level of a texture that finished loading after the scene was processed, largest first
+    struct TextureUpdate
+    {
+        int texID;
+        std::vector<unsigned char> texData;
+    };
+
     class Scene
     {
     public:
-        Scene() : camera(nullptr), envMap(nullptr), initialized(false), dirty(true) {
+        Scene() : camera(nullptr), envMap(nullptr), initialized(false), dirty(true), texturePool(nullptr) {
             sceneBvh = new RadeonRays::Bvh(10.0f, 64, false);
         }
         ~Scene();
 
         int AddMesh(const std::string& filename);
         int AddTexture(const std::string& filename);
+        // Texture from an encoded image in memory, e.g. embedded in a glTF file. These aren't shared by name and a
+        // texture that can't be read is added as white, so the textures of a file keep their indices
+        int AddTexture(const std::string& name, std::vector<unsigned char> encoded);
         int AddMaterial(const Material& material);
         int AddMeshInstance(const MeshInstance& meshInstance);
         int AddLight(const Light& light);
@@ -83,6 +123,21 @@ namespace GLSLPT
         void ProcessScene();
         void RebuildInstances();
 
+        // Textures are decoded in the background and start out as placeholders.
+        // Returns textures that have finished since the last call so the renderer can patch them in
+        void TakeTextureUpdates(std::vector<TextureUpdate>& updates);
+        void WaitForTextures();
+        bool TexturesLoading() const { return texturesLoading > 0; }
+
+        // Frees CPU copies of data that has been uploaded to the GPU
+        void ReleaseCPUData();
+
+        // Restores the merged mesh data after ReleaseCPUData, re-reading meshes from their files
+        bool LoadMeshData();
+
+        // Hash of everything that changes the rendered image, to tell if saved samples belong to this scene
+        uint64_t Hash() const;
+
         // Options
         RenderOptions renderOptions;
 
@@ -93,6 +148,8 @@ namespace GLSLPT
         std::vector<Indices> vertIndices;
         std::vector<Vec4> verticesUVX; // Vertex + texture Coord (u/s)
         std::vector<Vec4> normalsUVY; // Normal + texture Coord (v/t)
+        std::vector<Vec3> triangles; // Vertex 0 + two edges per triangle in leaf order. Only filled if enableTriangleBuffer is set
+                                     // Mesh data is empty after ReleaseCPUData until LoadMeshData is called
         std::vector<Mat4> transforms;
 
         // Materials
@@ -103,6 +160,12 @@ namespace GLSLPT
 
         // Lights
         std::vector<Light> lights;
+        LightBvh lightBvh; // Only built if enableLightBVH is set
+        std::vector<AliasEntry> lightAliasTable; // Picks lights in proportion to their power when there is no light BVH
+
+        // Emissive triangles of mesh instances
+        std::vector<MeshLight> meshLights;
+        float meshLightsPower = 0.0f; // Sum of the weights mesh lights are picked by
 
         // Environment Map
         EnvironmentMap* envMap;
@@ -116,7 +179,11 @@ namespace GLSLPT
 
         // Texture Data
         std::vector<Texture*> textures;
-        std::vector<unsigned char> textureMapsArray;
+        std::vector<TextureBucket> textureBuckets;
+        std::vector<iVec2> textureLocations; // Bucket and layer of each texture
+        // Compressed formats the GPU can sample, set by the renderer before the scene is processed. BC5 is always there
+        bool enableS3TC = true;  // BC1 and BC3
+        bool enableBPTC = false; // BC7
 
         bool initialized;
         bool dirty;
@@ -128,5 +195,25 @@ namespace GLSLPT
         RadeonRays::Bvh* sceneBvh;
         void createBLAS();
         void createTLAS();
+        void ProcessTexture(int texID);
+        void CopyMeshData();
+        void BuildLightDistribution();
+        void CollectEmissiveTriangles();
+        void BuildMeshLights();
+
+        // Emissive triangles in object space, so mesh lights can follow instance transforms after mesh data is released
+        struct EmissiveTriangle
+        {
+            Vec3 v0, v1, v2;
+            int firstVertex;
+            int instance;
+        };
+        std::vector<EmissiveTriangle> emissiveTriangles;
+
+        ThreadPool* texturePool;
+        std::vector<std::shared_future<void>> textureDecodes; // Indexed by texture. Empty for textures that were already decoded when added
+        std::vector<TextureUpdate> textureUpdates;
+        std::mutex textureUpdatesMutex;
+        std::atomic<int> texturesLoading{ 0 }; // Textures whose update hasn't been queued yet
     };
 }
@@ -32,9 +32,16 @@ namespace GLSLPT
         , width(w)
         , height(h)
         , components(c)
+        , hasAlpha(false)
     {
         texData.resize(width * height * components);
         std::copy(data, data + width * height * components, texData.begin());
+
+        if (components == 4)
+        {
+            for (int i = 3; i < texData.size() && !hasAlpha; i += 4)
+                hasAlpha = texData[i] != 255;
+        }
     }
 
     bool Texture::LoadTexture(const std::string& filename)
@@ -49,4 +56,29 @@ namespace GLSLPT
         stbi_image_free(data);
         return true;
     }
+
+    bool Texture::LoadTextureInfo(const std::string& filename)
+    {
+        name = filename;
+        components = 4;
+        int fileComponents;
+        if (!stbi_info(filename.c_str(), &width, &height, &fileComponents))
+            return false;
+
+        // Grey-alpha or RGBA files. Whether any texel is actually transparent isn't known until decoding
+        hasAlpha = fileComponents == 2 || fileComponents == 4;
+        return true;
+    }
+
+    bool Texture::LoadTextureInfo(const std::string& texName, const unsigned char* encoded, int size)
+    {
+        name = texName;
+        components = 4;
+        int fileComponents;
+        if (!stbi_info_from_memory(encoded, size, &width, &height, &fileComponents))
+            return false;
+
+        hasAlpha = fileComponents == 2 || fileComponents == 4;
+        return true;
+    }
 }
\ No newline at end of file
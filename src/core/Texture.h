@@ -32,15 +32,20 @@ namespace GLSLPT
     class Texture
     {
     public:
-        Texture() : width(0), height(0), components(0) {};
+        Texture() : width(0), height(0), components(0), hasAlpha(false) {};
         Texture(std::string texName, unsigned char* data, int w, int h, int c);
         ~Texture() { }
 
         bool LoadTexture(const std::string& filename);
 
+        // Reads the size and channels from the file header so the texture can be laid out before it is decoded
+        bool LoadTextureInfo(const std::string& filename);
+        bool LoadTextureInfo(const std::string& texName, const unsigned char* encoded, int size);
+
         int width;
         int height;
         int components;
+        bool hasAlpha;
         std::vector<unsigned char> texData;
         std::string name;
     };
@@ -0,0 +1,434 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "stb_image_resize.h"
+#include "TextureCompressor.h"
+
+namespace GLSLPT
+{
+    static int BlockBytes(TextureFormat format)
+    {
+        return format == BC1 ? 8 : 16;
+    }
+
+    static uint16_t PackRGB565(const float* c)
+    {
+        int r = (int)(std::min(std::max(c[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        int g = (int)(std::min(std::max(c[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+        int b = (int)(std::min(std::max(c[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        return (uint16_t)((r << 11) | (g << 5) | b);
+    }
+
+    static void UnpackRGB565(uint16_t c, int* out)
+    {
+        int r = (c >> 11) & 31;
+        int g = (c >> 5) & 63;
+        int b = c & 31;
+        out[0] = (r << 3) | (r >> 2);
+        out[1] = (g << 2) | (g >> 4);
+        out[2] = (b << 3) | (b >> 2);
+    }
+
+    // Color part of BC1 and BC3. Endpoints are placed at the extent of the colors along their principal axis
+    static void EncodeColorBlock(const unsigned char block[16][4], unsigned char* out)
+    {
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+                mean[c] += block[i][c] / 16.0f;
+
+        float cov[3][3] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            float d[3] = { block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2] };
+            for (int j = 0; j < 3; j++)
+                for (int k = 0; k < 3; k++)
+                    cov[j][k] += d[j] * d[k];
+        }
+
+        // Power iteration for the principal axis
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int iter = 0; iter < 8; iter++)
+        {
+            float next[3];
+            for (int j = 0; j < 3; j++)
+                next[j] = cov[j][0] * axis[0] + cov[j][1] * axis[1] + cov[j][2] * axis[2];
+
+            float len = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+            if (len < 1e-6f)
+                break;
+            for (int j = 0; j < 3; j++)
+                axis[j] = next[j] / len;
+        }
+
+        float len = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        for (int j = 0; j < 3; j++)
+            axis[j] /= len;
+
+        float minT = 0.0f, maxT = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            float t = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+
+        float maxEnd[3], minEnd[3];
+        for (int j = 0; j < 3; j++)
+        {
+            maxEnd[j] = mean[j] + axis[j] * maxT;
+            minEnd[j] = mean[j] + axis[j] * minT;
+        }
+
+        // color0 > color1 selects the four color mode in BC1
+        uint16_t c0 = PackRGB565(maxEnd);
+        uint16_t c1 = PackRGB565(minEnd);
+        if (c0 < c1)
+            std::swap(c0, c1);
+
+        int palette[4][3];
+        UnpackRGB565(c0, palette[0]);
+        UnpackRGB565(c1, palette[1]);
+        for (int j = 0; j < 3; j++)
+        {
+            palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+            palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+        }
+
+        uint32_t indices = 0;
+        if (c0 != c1)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                int bestDist = INT32_MAX;
+                for (int p = 0; p < 4; p++)
+                {
+                    int dr = block[i][0] - palette[p][0];
+                    int dg = block[i][1] - palette[p][1];
+                    int db = block[i][2] - palette[p][2];
+                    int dist = dr * dr + dg * dg + db * db;
+                    if (dist < bestDist)
+                    {
+                        bestDist = dist;
+                        best = p;
+                    }
+                }
+                indices |= (uint32_t)best << (2 * i);
+            }
+        }
+
+        out[0] = c0 & 0xFF;
+        out[1] = c0 >> 8;
+        out[2] = c1 & 0xFF;
+        out[3] = c1 >> 8;
+        for (int i = 0; i < 4; i++)
+            out[4 + i] = (indices >> (8 * i)) & 0xFF;
+    }
+
+    // Single channel block shared by the alpha of BC3 and both channels of BC5
+    static void EncodeChannelBlock(const unsigned char block[16][4], int channel, unsigned char* out)
+    {
+        int minV = 255, maxV = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            minV = std::min(minV, (int)block[i][channel]);
+            maxV = std::max(maxV, (int)block[i][channel]);
+        }
+
+        // value0 > value1 selects the eight value mode
+        int palette[8];
+        palette[0] = maxV;
+        palette[1] = minV;
+        for (int p = 2; p < 8; p++)
+            palette[p] = ((8 - p) * maxV + (p - 1) * minV + 3) / 7;
+
+        uint64_t indices = 0;
+        if (maxV != minV)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                int bestDist = 256;
+                for (int p = 0; p < 8; p++)
+                {
+                    int dist = abs(block[i][channel] - palette[p]);
+                    if (dist < bestDist)
+                    {
+                        bestDist = dist;
+                        best = p;
+                    }
+                }
+                indices |= (uint64_t)best << (3 * i);
+            }
+        }
+
+        out[0] = (unsigned char)maxV;
+        out[1] = (unsigned char)minV;
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = (indices >> (8 * i)) & 0xFF;
+    }
+
+    // Writes the low count bits of value into a block, starting at bit pos from the least significant bit of the first byte
+    static void WriteBits(unsigned char* out, int& pos, uint32_t value, int count)
+    {
+        for (int i = 0; i < count; i++, pos++)
+            out[pos >> 3] |= ((value >> i) & 1) << (pos & 7);
+    }
+
+    // BC7 mode 6: one set of RGBA endpoints with 7 bits per channel plus a low bit shared by the channels of each
+    // endpoint, and 16 levels between them. Endpoints are placed as for BC1, along the principal axis in RGBA
+    static void EncodeBC7Block(const unsigned char block[16][4], unsigned char* out)
+    {
+        static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+        float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 4; c++)
+                mean[c] += block[i][c] / 16.0f;
+
+        float cov[4][4] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            float d[4] = { block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2], block[i][3] - mean[3] };
+            for (int j = 0; j < 4; j++)
+                for (int k = 0; k < 4; k++)
+                    cov[j][k] += d[j] * d[k];
+        }
+
+        float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        for (int iter = 0; iter < 8; iter++)
+        {
+            float next[4];
+            for (int j = 0; j < 4; j++)
+                next[j] = cov[j][0] * axis[0] + cov[j][1] * axis[1] + cov[j][2] * axis[2] + cov[j][3] * axis[3];
+
+            float len = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+            if (len < 1e-6f)
+                break;
+            for (int j = 0; j < 4; j++)
+                axis[j] = next[j] / len;
+        }
+
+        float len = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3]);
+        for (int j = 0; j < 4; j++)
+            axis[j] /= len;
+
+        float minT = 0.0f, maxT = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            float t = 0.0f;
+            for (int j = 0; j < 4; j++)
+                t += (block[i][j] - mean[j]) * axis[j];
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+
+        // Each endpoint takes the shared low bit that brings its four channels closest
+        int endpoints[2][4];
+        int pBits[2];
+        for (int e = 0; e < 2; e++)
+        {
+            float t = e == 0 ? minT : maxT;
+            float bestError = 1e30f;
+            for (int p = 0; p < 2; p++)
+            {
+                int quantized[4];
+                float error = 0.0f;
+                for (int j = 0; j < 4; j++)
+                {
+                    float v = std::min(std::max(mean[j] + axis[j] * t, 0.0f), 255.0f);
+                    quantized[j] = std::min(std::max((int)((v - p) * 0.5f + 0.5f), 0), 127);
+                    float d = ((quantized[j] << 1) | p) - v;
+                    error += d * d;
+                }
+
+                if (error < bestError)
+                {
+                    bestError = error;
+                    pBits[e] = p;
+                    memcpy(endpoints[e], quantized, sizeof(quantized));
+                }
+            }
+        }
+
+        int palette[16][4];
+        for (int j = 0; j < 4; j++)
+        {
+            int e0 = (endpoints[0][j] << 1) | pBits[0];
+            int e1 = (endpoints[1][j] << 1) | pBits[1];
+            for (int p = 0; p < 16; p++)
+                palette[p][j] = ((64 - weights[p]) * e0 + weights[p] * e1 + 32) >> 6;
+        }
+
+        int indices[16];
+        for (int i = 0; i < 16; i++)
+        {
+            int bestDist = INT32_MAX;
+            for (int p = 0; p < 16; p++)
+            {
+                int dist = 0;
+                for (int j = 0; j < 4; j++)
+                    dist += (block[i][j] - palette[p][j]) * (block[i][j] - palette[p][j]);
+                if (dist < bestDist)
+                {
+                    bestDist = dist;
+                    indices[i] = p;
+                }
+            }
+        }
+
+        // The index of the first pixel is stored without its top bit. The weights are symmetric, so swapping the
+        // endpoints and mirroring the indices clears it
+        if (indices[0] & 8)
+        {
+            std::swap(endpoints[0], endpoints[1]);
+            std::swap(pBits[0], pBits[1]);
+            for (int i = 0; i < 16; i++)
+                indices[i] = 15 - indices[i];
+        }
+
+        memset(out, 0, 16);
+        int pos = 0;
+        WriteBits(out, pos, 1 << 6, 7);
+        for (int j = 0; j < 4; j++)
+        {
+            WriteBits(out, pos, endpoints[0][j], 7);
+            WriteBits(out, pos, endpoints[1][j], 7);
+        }
+        WriteBits(out, pos, pBits[0], 1);
+        WriteBits(out, pos, pBits[1], 1);
+        WriteBits(out, pos, indices[0], 3);
+        for (int i = 1; i < 16; i++)
+            WriteBits(out, pos, indices[i], 4);
+    }
+
+    int TextureLevelSize(TextureFormat format, int width, int height)
+    {
+        if (format == Uncompressed)
+            return width * height * 4;
+        return ((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+    }
+
+    int TextureMipLevels(int width, int height)
+    {
+        int levels = 1;
+        while (width > 1 || height > 1)
+        {
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+            levels++;
+        }
+        return levels;
+    }
+
+    int TextureMipChainSize(TextureFormat format, int width, int height)
+    {
+        int size = 0;
+        for (int i = 0; i < TextureMipLevels(width, height); i++)
+            size += TextureLevelSize(format, std::max(1, width >> i), std::max(1, height >> i));
+        return size;
+    }
+
+    void CompressTexture(TextureFormat format, const unsigned char* rgba, int width, int height, unsigned char* out)
+    {
+        if (format == Uncompressed)
+        {
+            memcpy(out, rgba, width * height * 4);
+            return;
+        }
+
+        unsigned char block[16][4];
+        for (int by = 0; by < height; by += 4)
+        {
+            for (int bx = 0; bx < width; bx += 4)
+            {
+                for (int y = 0; y < 4; y++)
+                {
+                    for (int x = 0; x < 4; x++)
+                    {
+                        int sx = std::min(bx + x, width - 1);
+                        int sy = std::min(by + y, height - 1);
+                        memcpy(block[y * 4 + x], &rgba[(sy * width + sx) * 4], 4);
+                    }
+                }
+
+                switch (format)
+                {
+                case BC1:
+                    EncodeColorBlock(block, out);
+                    break;
+                case BC3:
+                    EncodeChannelBlock(block, 3, out);
+                    EncodeColorBlock(block, out + 8);
+                    break;
+                case BC5:
+                    EncodeChannelBlock(block, 0, out);
+                    EncodeChannelBlock(block, 1, out + 8);
+                    break;
+                case BC7:
+                    EncodeBC7Block(block, out);
+                    break;
+                default:
+                    break;
+                }
+                out += BlockBytes(format);
+            }
+        }
+    }
+
+    void CompressMipChain(TextureFormat format, const unsigned char* rgba, int width, int height, std::vector<unsigned char>& out)
+    {
+        int levels = TextureMipLevels(width, height);
+        out.resize(TextureMipChainSize(format, width, height));
+
+        std::vector<unsigned char> level(rgba, rgba + width * height * 4);
+        std::vector<unsigned char> nextLevel;
+        int offset = 0;
+
+        for (int i = 0; i < levels; i++)
+        {
+            int levelWidth = std::max(1, width >> i);
+            int levelHeight = std::max(1, height >> i);
+
+            CompressTexture(format, &level[0], levelWidth, levelHeight, &out[offset]);
+            offset += TextureLevelSize(format, levelWidth, levelHeight);
+
+            if (i + 1 < levels)
+            {
+                int nextWidth = std::max(1, levelWidth / 2);
+                int nextHeight = std::max(1, levelHeight / 2);
+                nextLevel.resize(nextWidth * nextHeight * 4);
+                stbir_resize_uint8(&level[0], levelWidth, levelHeight, 0, &nextLevel[0], nextWidth, nextHeight, 0, 4);
+                level.swap(nextLevel);
+            }
+        }
+    }
+}
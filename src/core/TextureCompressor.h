@@ -0,0 +1,57 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <vector>
+
+namespace GLSLPT
+{
+    // Formats that scene textures are uploaded in
+    enum TextureFormat
+    {
+        Uncompressed, // RGBA8
+        BC1,          // Opaque color, 4 bits per pixel
+        BC3,          // Color with alpha, 8 bits per pixel
+        BC5,          // Two channel normal maps, 8 bits per pixel
+        BC7           // Color with or without alpha, 8 bits per pixel. Finer than BC3 but needs BPTC
+    };
+
+    // Size in bytes of a single image. Block compressed formats round the size up to whole 4x4 blocks
+    int TextureLevelSize(TextureFormat format, int width, int height);
+
+    // Number of mip levels down to 1x1
+    int TextureMipLevels(int width, int height);
+
+    // Size in bytes of all mip levels of an image
+    int TextureMipChainSize(TextureFormat format, int width, int height);
+
+    // Encodes an RGBA8 image. Partial blocks at the edges are padded by repeating the last row and column
+    void CompressTexture(TextureFormat format, const unsigned char* rgba, int width, int height, unsigned char* out);
+
+    // Generates the mip chain of an RGBA8 image and encodes every level.
+    // Levels are stored one after another starting from the largest
+    void CompressMipChain(TextureFormat format, const unsigned char* rgba, int width, int height, std::vector<unsigned char>& out);
+}
@@ -0,0 +1,97 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include "ThreadPool.h"
+
+namespace GLSLPT
+{
+    ThreadPool::ThreadPool(int numThreads) : runningJobs(0), stopping(false)
+    {
+        if (numThreads <= 0)
+            numThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+
+        for (int i = 0; i < numThreads; i++)
+            workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        // Jobs that haven't started are dropped. Their futures report a broken promise
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            jobs.clear();
+        }
+        jobAdded.notify_all();
+
+        for (int i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    std::shared_future<void> ThreadPool::Submit(std::function<void()> job)
+    {
+        std::packaged_task<void()> task(job);
+        std::shared_future<void> future = task.get_future().share();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(task));
+        }
+        jobAdded.notify_one();
+        return future;
+    }
+
+    void ThreadPool::Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobsDone.wait(lock, [this] { return jobs.empty() && runningJobs == 0; });
+    }
+
+    void ThreadPool::WorkerLoop()
+    {
+        while (true)
+        {
+            std::packaged_task<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobAdded.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+
+                task = std::move(jobs.front());
+                jobs.pop_front();
+                runningJobs++;
+            }
+
+            task();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                runningJobs--;
+            }
+            jobsDone.notify_all();
+        }
+    }
+}
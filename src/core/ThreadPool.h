@@ -0,0 +1,61 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+
+namespace GLSLPT
+{
+    // Fixed set of worker threads running jobs in the order they were submitted
+    class ThreadPool
+    {
+    public:
+        ThreadPool(int numThreads = 0);
+        ~ThreadPool();
+
+        std::shared_future<void> Submit(std::function<void()> job);
+
+        // Blocks until all submitted jobs have finished
+        void Wait();
+
+    private:
+        void WorkerLoop();
+
+        std::vector<std::thread> workers;
+        std::deque<std::packaged_task<void()>> jobs;
+        std::mutex mutex;
+        std::condition_variable jobAdded;
+        std::condition_variable jobsDone;
+        int runningJobs;
+        bool stopping;
+    };
+}
@@ -0,0 +1,135 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include "TileScheduler.h"
+
+namespace GLSLPT
+{
+    TileScheduler::TileScheduler(const iVec2& numTiles)
+        : numTiles(numTiles)
+    {
+        int count = numTiles.x * numTiles.y;
+        weights.assign(count, 1.0f);
+        intervals.assign(count, 1.0f);
+        Reset();
+    }
+
+    void TileScheduler::Reset()
+    {
+        lastPass.assign(weights.size(), 0);
+        samples.assign(weights.size(), 0);
+        pass = 1;
+        totalSamples = 0;
+        BuildQueue();
+    }
+
+    void TileScheduler::SetWeights(const std::vector<float>& newWeights)
+    {
+        if (newWeights == weights)
+            return;
+
+        weights = newWeights;
+
+        float maxWeight = 0.0f;
+        for (float weight : weights)
+            maxWeight = std::max(maxWeight, weight);
+
+        // The heaviest tiles are rendered in every pass, so there is always something to do
+        for (int i = 0; i < weights.size(); i++)
+        {
+            if (maxWeight <= 0.0f)
+                intervals[i] = 1.0f;
+            else
+                intervals[i] = weights[i] > 0.0f ? maxWeight / weights[i] : 0.0f;
+        }
+
+        BuildQueue();
+    }
+
+    iVec2 TileScheduler::NextTile()
+    {
+        // A tile that was handed out but not rendered is still due
+        if (current >= 0)
+            Schedule(current);
+
+        // The small tolerance keeps intervals like 1 / (1 / 3) from slipping a pass
+        while (queue.top().due > pass + 0.001f)
+            pass++;
+
+        current = queue.top().index;
+        queue.pop();
+
+        return iVec2(current % numTiles.x, current / numTiles.x);
+    }
+
+    void TileScheduler::AddSample()
+    {
+        if (current < 0)
+            return;
+
+        samples[current]++;
+        totalSamples++;
+        lastPass[current] = pass;
+        Schedule(current);
+        current = -1;
+    }
+
+    void TileScheduler::Restore(int pass, const std::vector<int>& samples, const std::vector<int>& lastPass)
+    {
+        this->pass = pass;
+        this->samples = samples;
+        this->lastPass = lastPass;
+
+        totalSamples = 0;
+        for (int count : samples)
+            totalSamples += count;
+
+        BuildQueue();
+    }
+
+    void TileScheduler::Schedule(int index)
+    {
+        float due;
+        if (lastPass[index] == 0)
+            due = 1.0f;
+        else if (intervals[index] > 0.0f)
+            due = lastPass[index] + intervals[index];
+        else
+            return;
+
+        int x = index % numTiles.x;
+        int y = index / numTiles.x;
+        queue.push({ due, (numTiles.y - 1 - y) * numTiles.x + x, index });
+    }
+
+    void TileScheduler::BuildQueue()
+    {
+        queue = std::priority_queue<Entry, std::vector<Entry>, Later>();
+        for (int i = 0; i < weights.size(); i++)
+            Schedule(i);
+        current = -1;
+    }
+}
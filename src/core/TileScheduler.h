@@ -0,0 +1,94 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <vector>
+#include <queue>
+#include "Vec2.h"
+
+namespace GLSLPT
+{
+    // Decides which tile of the image is rendered next. Every tile has a weight and a tile with weight w is due again
+    // 1 / w passes after it was last rendered, so weights can come from a region of interest or a variance estimate.
+    // Due tiles are taken from a priority queue, the longest overdue first and ties in scan order from the top left.
+    // A pass ends when no tile is due anymore. The first pass renders every tile
+    class TileScheduler
+    {
+    public:
+        TileScheduler(const iVec2& numTiles);
+
+        // Forgets all samples and starts again from the first pass
+        void Reset();
+
+        // Weight per tile, bottom row first. Weights are relative to the largest one. A tile with weight zero is
+        // only rendered in the first pass
+        void SetWeights(const std::vector<float>& weights);
+
+        // Tile to render next. Moves on to the next pass when the current one is done
+        iVec2 NextTile();
+
+        // Records a sample for the tile returned by the last call to NextTile
+        void AddSample();
+
+        // Continues from the state of an earlier render with the same tiles, e.g. from a checkpoint
+        void Restore(int pass, const std::vector<int>& samples, const std::vector<int>& lastPass);
+
+        int GetPass() const { return pass; }
+        int GetTileSamples(const iVec2& tile) const { return samples[tile.y * numTiles.x + tile.x]; }
+        int GetTotalSamples() const { return totalSamples; }
+        const std::vector<int>& GetSamples() const { return samples; }
+        const std::vector<int>& GetLastPasses() const { return lastPass; }
+
+    private:
+        struct Entry
+        {
+            float due;
+            int order; // Position in scan order from the top left
+            int index;
+        };
+
+        struct Later
+        {
+            bool operator()(const Entry& a, const Entry& b) const
+            {
+                return a.due != b.due ? a.due > b.due : a.order > b.order;
+            }
+        };
+
+        void Schedule(int index);
+        void BuildQueue();
+
+        std::priority_queue<Entry, std::vector<Entry>, Later> queue;
+        std::vector<float> weights;
+        std::vector<float> intervals; // Passes between two samples of a tile, 0 if it is never due again
+        std::vector<int> lastPass;    // Pass a tile was last rendered in, 0 if it wasn't yet
+        std::vector<int> samples;
+        iVec2 numTiles;
+        int pass;
+        int totalSamples;
+        int current;                  // Tile handed out by NextTile that has no sample yet, -1 if none
+    };
+}
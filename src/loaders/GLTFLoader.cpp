@@ -216,6 +216,14 @@ namespace GLSLPT
         }
     }
 
+    // Keeps images encoded so they are decoded by the texture jobs of the scene instead of one after another here
+    static bool KeepEncodedImage(tinygltf::Image* image, const int /*imageIdx*/, std::string* /*err*/, std::string* /*warn*/,
+                                 int /*reqWidth*/, int /*reqHeight*/, const unsigned char* bytes, int size, void* /*userData*/)
+    {
+        image->image.assign(bytes, bytes + size);
+        return true;
+    }
+
     void LoadTextures(Scene* scene, tinygltf::Model& gltfModel)
     {
         for (size_t i = 0; i < gltfModel.textures.size(); ++i)
@@ -225,8 +233,7 @@ namespace GLSLPT
             std::string texName = gltfTex.name;
             if (strcmp(gltfTex.name.c_str(), "") == 0)
                 texName = image.uri;
-            Texture* texture = new Texture(texName, image.image.data(), image.width, image.height, image.component);
-            scene->textures.push_back(texture);
+            scene->AddTexture(texName, image.image);
         }
     }
 
@@ -383,6 +390,7 @@ namespace GLSLPT
     {
         tinygltf::Model gltfModel;
         tinygltf::TinyGLTF loader;
+        loader.SetImageLoader(KeepEncodedImage, nullptr);
         std::string err;
         std::string warn;
 
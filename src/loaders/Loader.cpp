@@ -268,6 +268,19 @@ namespace GLSLPT
                 char enableRoughnessMollification[10] = "none";
                 char enableVolumeMIS[10] = "none";
                 char enableUniformLight[10] = "none";
+                char enableStacklessBVH[10] = "none";
+                char enableBVHTreeletLayout[10] = "none";
+                char enableTriangleBuffer[10] = "none";
+                char enableSignedAABB[10] = "none";
+                char enableTextureCompression[10] = "none";
+                char textureCacheDir[200] = "none";
+                char freeCPUData[10] = "none";
+                char enableLightBVH[10] = "none";
+                char enableSobolSampler[10] = "none";
+                char enableBlueNoise[10] = "none";
+                char enableTemporalReprojection[10] = "none";
+                char enableROI[10] = "none";
+                char roiFollowMouse[10] = "none";
 
                 while (fgets(line, kMaxLineLength, file))
                 {
@@ -280,6 +293,7 @@ namespace GLSLPT
                     sscanf(line, " windowresolution %d %d", &renderOptions.windowResolution.x, &renderOptions.windowResolution.y);
                     sscanf(line, " envmapintensity %f", &renderOptions.envMapIntensity);
                     sscanf(line, " maxdepth %i", &renderOptions.maxDepth);
+                    sscanf(line, " previewmaxdepth %i", &renderOptions.previewMaxDepth);
                     sscanf(line, " maxspp %i", &renderOptions.maxSpp);
                     sscanf(line, " tilewidth %i", &renderOptions.tileWidth);
                     sscanf(line, " tileheight %i", &renderOptions.tileHeight);
@@ -301,6 +315,22 @@ namespace GLSLPT
                     sscanf(line, " enablevolumemis %s", enableVolumeMIS);
                     sscanf(line, " enableuniformlight %s", enableUniformLight);
                     sscanf(line, " uniformlightcolor %f %f %f", &renderOptions.uniformLightCol.x, &renderOptions.uniformLightCol.y, &renderOptions.uniformLightCol.z);
+                    sscanf(line, " enablestacklessbvh %s", enableStacklessBVH);
+                    sscanf(line, " enablebvhtreeletlayout %s", enableBVHTreeletLayout);
+                    sscanf(line, " enabletrianglebuffer %s", enableTriangleBuffer);
+                    sscanf(line, " enablesignedaabb %s", enableSignedAABB);
+                    sscanf(line, " enabletexturecompression %s", enableTextureCompression);
+                    sscanf(line, " texturecachedir %s", textureCacheDir);
+                    sscanf(line, " freecpudata %s", freeCPUData);
+                    sscanf(line, " enablelightbvh %s", enableLightBVH);
+                    sscanf(line, " enablesobolsampler %s", enableSobolSampler);
+                    sscanf(line, " enablebluenoise %s", enableBlueNoise);
+                    sscanf(line, " enabletemporalreprojection %s", enableTemporalReprojection);
+                    sscanf(line, " enableroi %s", enableROI);
+                    sscanf(line, " roi %f %f %f %f", &renderOptions.roi.x, &renderOptions.roi.y, &renderOptions.roi.z, &renderOptions.roi.w);
+                    sscanf(line, " roisampleratio %i", &renderOptions.roiSampleRatio);
+                    sscanf(line, " roifollowmouse %s", roiFollowMouse);
+                    sscanf(line, " checkpointinterval %i", &renderOptions.checkpointInterval);
                 }
 
                 if (strcmp(envMap, "none") != 0)
@@ -366,6 +396,69 @@ namespace GLSLPT
                 else if (strcmp(enableUniformLight, "true") == 0)
                     renderOptions.enableUniformLight = true;
 
+                if (strcmp(enableStacklessBVH, "false") == 0)
+                    renderOptions.enableStacklessBVH = false;
+                else if (strcmp(enableStacklessBVH, "true") == 0)
+                    renderOptions.enableStacklessBVH = true;
+
+                if (strcmp(enableBVHTreeletLayout, "false") == 0)
+                    renderOptions.enableBVHTreeletLayout = false;
+                else if (strcmp(enableBVHTreeletLayout, "true") == 0)
+                    renderOptions.enableBVHTreeletLayout = true;
+
+                if (strcmp(enableTriangleBuffer, "false") == 0)
+                    renderOptions.enableTriangleBuffer = false;
+                else if (strcmp(enableTriangleBuffer, "true") == 0)
+                    renderOptions.enableTriangleBuffer = true;
+
+                if (strcmp(enableSignedAABB, "false") == 0)
+                    renderOptions.enableSignedAABB = false;
+                else if (strcmp(enableSignedAABB, "true") == 0)
+                    renderOptions.enableSignedAABB = true;
+
+                if (strcmp(enableTextureCompression, "false") == 0)
+                    renderOptions.enableTextureCompression = false;
+                else if (strcmp(enableTextureCompression, "true") == 0)
+                    renderOptions.enableTextureCompression = true;
+
+                if (strcmp(textureCacheDir, "none") != 0)
+                    renderOptions.textureCacheDir = path + textureCacheDir;
+
+                if (strcmp(freeCPUData, "false") == 0)
+                    renderOptions.freeCPUData = false;
+                else if (strcmp(freeCPUData, "true") == 0)
+                    renderOptions.freeCPUData = true;
+
+                if (strcmp(enableLightBVH, "false") == 0)
+                    renderOptions.enableLightBVH = false;
+                else if (strcmp(enableLightBVH, "true") == 0)
+                    renderOptions.enableLightBVH = true;
+
+                if (strcmp(enableSobolSampler, "false") == 0)
+                    renderOptions.enableSobolSampler = false;
+                else if (strcmp(enableSobolSampler, "true") == 0)
+                    renderOptions.enableSobolSampler = true;
+
+                if (strcmp(enableBlueNoise, "false") == 0)
+                    renderOptions.enableBlueNoise = false;
+                else if (strcmp(enableBlueNoise, "true") == 0)
+                    renderOptions.enableBlueNoise = true;
+
+                if (strcmp(enableTemporalReprojection, "false") == 0)
+                    renderOptions.enableTemporalReprojection = false;
+                else if (strcmp(enableTemporalReprojection, "true") == 0)
+                    renderOptions.enableTemporalReprojection = true;
+
+                if (strcmp(enableROI, "false") == 0)
+                    renderOptions.enableROI = false;
+                else if (strcmp(enableROI, "true") == 0)
+                    renderOptions.enableROI = true;
+
+                if (strcmp(roiFollowMouse, "false") == 0)
+                    renderOptions.roiFollowMouse = false;
+                else if (strcmp(roiFollowMouse, "true") == 0)
+                    renderOptions.roiFollowMouse = true;
+
                 if (!renderOptions.independentRenderSize)
                     renderOptions.windowResolution = renderOptions.renderResolution;
             }
@@ -24,6 +24,7 @@
 
 #pragma once
 
+#include "Simd.h"
 #include "Vec3.h"
 
 namespace GLSLPT
@@ -40,6 +41,11 @@ namespace GLSLPT
         static Mat4 Translate(const Vec3& a);
         static Mat4 Scale(const Vec3& a);
         static Mat4 QuatToMatrix(float x, float y, float z, float w);
+        static Mat4 Inverse(const Mat4& a);
+
+        // Matrices are applied to row vectors, so the translation is in the last row
+        Vec3 TransformPoint(const Vec3& p) const;
+        Vec3 TransformVector(const Vec3& v) const;
 
         float data[4][4];
     };
@@ -74,27 +80,46 @@ namespace GLSLPT
     {
         Mat4 out;
 
-        out[0][0] = data[0][0] * b.data[0][0] + data[0][1] * b.data[1][0] + data[0][2] * b.data[2][0] + data[0][3] * b.data[3][0];
-        out[0][1] = data[0][0] * b.data[0][1] + data[0][1] * b.data[1][1] + data[0][2] * b.data[2][1] + data[0][3] * b.data[3][1];
-        out[0][2] = data[0][0] * b.data[0][2] + data[0][1] * b.data[1][2] + data[0][2] * b.data[2][2] + data[0][3] * b.data[3][2];
-        out[0][3] = data[0][0] * b.data[0][3] + data[0][1] * b.data[1][3] + data[0][2] * b.data[2][3] + data[0][3] * b.data[3][3];
+        Simd::Float4 b0 = Simd::LoadUnaligned(b.data[0]);
+        Simd::Float4 b1 = Simd::LoadUnaligned(b.data[1]);
+        Simd::Float4 b2 = Simd::LoadUnaligned(b.data[2]);
+        Simd::Float4 b3 = Simd::LoadUnaligned(b.data[3]);
+
+        // Each row of the result is the row of this matrix weighting the rows of b
+        for (int i = 0; i < 4; i++)
+        {
+            Simd::Float4 row = Simd::LoadUnaligned(data[i]);
+            Simd::Float4 r = Simd::Mul(Simd::Splat<0>(row), b0);
+            r = Simd::Add(r, Simd::Mul(Simd::Splat<1>(row), b1));
+            r = Simd::Add(r, Simd::Mul(Simd::Splat<2>(row), b2));
+            r = Simd::Add(r, Simd::Mul(Simd::Splat<3>(row), b3));
+            Simd::StoreUnaligned(out.data[i], r);
+        }
 
-        out[1][0] = data[1][0] * b.data[0][0] + data[1][1] * b.data[1][0] + data[1][2] * b.data[2][0] + data[1][3] * b.data[3][0];
-        out[1][1] = data[1][0] * b.data[0][1] + data[1][1] * b.data[1][1] + data[1][2] * b.data[2][1] + data[1][3] * b.data[3][1];
-        out[1][2] = data[1][0] * b.data[0][2] + data[1][1] * b.data[1][2] + data[1][2] * b.data[2][2] + data[1][3] * b.data[3][2];
-        out[1][3] = data[1][0] * b.data[0][3] + data[1][1] * b.data[1][3] + data[1][2] * b.data[2][3] + data[1][3] * b.data[3][3];
+        return out;
+    }
 
-        out[2][0] = data[2][0] * b.data[0][0] + data[2][1] * b.data[1][0] + data[2][2] * b.data[2][0] + data[2][3] * b.data[3][0];
-        out[2][1] = data[2][0] * b.data[0][1] + data[2][1] * b.data[1][1] + data[2][2] * b.data[2][1] + data[2][3] * b.data[3][1];
-        out[2][2] = data[2][0] * b.data[0][2] + data[2][1] * b.data[1][2] + data[2][2] * b.data[2][2] + data[2][3] * b.data[3][2];
-        out[2][3] = data[2][0] * b.data[0][3] + data[2][1] * b.data[1][3] + data[2][2] * b.data[2][3] + data[2][3] * b.data[3][3];
+    inline Vec3 Mat4::TransformPoint(const Vec3& p) const
+    {
+        Simd::Float4 r = Simd::Mul(Simd::Set1(p.x), Simd::LoadUnaligned(data[0]));
+        r = Simd::Add(r, Simd::Mul(Simd::Set1(p.y), Simd::LoadUnaligned(data[1])));
+        r = Simd::Add(r, Simd::Mul(Simd::Set1(p.z), Simd::LoadUnaligned(data[2])));
+        r = Simd::Add(r, Simd::LoadUnaligned(data[3]));
+
+        alignas(16) float out[4];
+        Simd::Store(out, r);
+        return Vec3(out[0], out[1], out[2]);
+    }
 
-        out[3][0] = data[3][0] * b.data[0][0] + data[3][1] * b.data[1][0] + data[3][2] * b.data[2][0] + data[3][3] * b.data[3][0];
-        out[3][1] = data[3][0] * b.data[0][1] + data[3][1] * b.data[1][1] + data[3][2] * b.data[2][1] + data[3][3] * b.data[3][1];
-        out[3][2] = data[3][0] * b.data[0][2] + data[3][1] * b.data[1][2] + data[3][2] * b.data[2][2] + data[3][3] * b.data[3][2];
-        out[3][3] = data[3][0] * b.data[0][3] + data[3][1] * b.data[1][3] + data[3][2] * b.data[2][3] + data[3][3] * b.data[3][3];
+    inline Vec3 Mat4::TransformVector(const Vec3& v) const
+    {
+        Simd::Float4 r = Simd::Mul(Simd::Set1(v.x), Simd::LoadUnaligned(data[0]));
+        r = Simd::Add(r, Simd::Mul(Simd::Set1(v.y), Simd::LoadUnaligned(data[1])));
+        r = Simd::Add(r, Simd::Mul(Simd::Set1(v.z), Simd::LoadUnaligned(data[2])));
 
-        return out;
+        alignas(16) float out[4];
+        Simd::Store(out, r);
+        return Vec3(out[0], out[1], out[2]);
     }
 
     inline Mat4 Mat4::QuatToMatrix(float x, float y, float z, float w)
@@ -139,4 +164,69 @@ namespace GLSLPT
 
         return out;
     }
-}
\ No newline at end of file
+
+    inline Mat4 Mat4::Inverse(const Mat4& a)
+    {
+        using namespace Simd;
+
+        // Blockwise inversion with the 2x2 blocks A B / C D each held in one register as (m00, m01, m10, m11).
+        // Works for any invertible matrix, not just affine ones. The terms are summed in a different order than a
+        // cofactor expansion, so results can differ from one in the last bits
+        auto mat2Mul = [](Float4 x, Float4 y) { // x * y
+            return Add(Mul(x, Shuffle<0, 3, 0, 3>(y, y)), Mul(Shuffle<1, 0, 3, 2>(x, x), Shuffle<2, 1, 2, 1>(y, y)));
+        };
+        auto mat2AdjMul = [](Float4 x, Float4 y) { // adj(x) * y
+            return Sub(Mul(Shuffle<3, 3, 0, 0>(x, x), y), Mul(Shuffle<1, 1, 2, 2>(x, x), Shuffle<2, 3, 0, 1>(y, y)));
+        };
+        auto mat2MulAdj = [](Float4 x, Float4 y) { // x * adj(y)
+            return Sub(Mul(x, Shuffle<3, 0, 3, 0>(y, y)), Mul(Shuffle<1, 0, 3, 2>(x, x), Shuffle<2, 1, 2, 1>(y, y)));
+        };
+
+        Float4 r0 = LoadUnaligned(a.data[0]);
+        Float4 r1 = LoadUnaligned(a.data[1]);
+        Float4 r2 = LoadUnaligned(a.data[2]);
+        Float4 r3 = LoadUnaligned(a.data[3]);
+
+        Float4 A = Shuffle<0, 1, 0, 1>(r0, r1);
+        Float4 B = Shuffle<2, 3, 2, 3>(r0, r1);
+        Float4 C = Shuffle<0, 1, 0, 1>(r2, r3);
+        Float4 D = Shuffle<2, 3, 2, 3>(r2, r3);
+
+        // Determinants of A, B, C and D
+        Float4 detSub = Sub(Mul(Shuffle<0, 2, 0, 2>(r0, r2), Shuffle<1, 3, 1, 3>(r1, r3)),
+                            Mul(Shuffle<1, 3, 1, 3>(r0, r2), Shuffle<0, 2, 0, 2>(r1, r3)));
+        Float4 detA = Splat<0>(detSub);
+        Float4 detB = Splat<1>(detSub);
+        Float4 detC = Splat<2>(detSub);
+        Float4 detD = Splat<3>(detSub);
+
+        Float4 dc = mat2AdjMul(D, C);
+        Float4 ab = mat2AdjMul(A, B);
+
+        // Adjugates of the blocks of the inverse scaled by its determinant
+        Float4 x = Sub(Mul(detD, A), mat2Mul(B, dc));
+        Float4 w = Sub(Mul(detA, D), mat2Mul(C, ab));
+        Float4 y = Sub(Mul(detB, C), mat2MulAdj(D, ab));
+        Float4 z = Sub(Mul(detC, B), mat2MulAdj(A, dc));
+
+        // det = |A||D| + |B||C| - tr(adj(A)B adj(D)C)
+        Float4 tr = Mul(ab, Shuffle<0, 2, 1, 3>(dc, dc));
+        tr = Add(tr, Shuffle<1, 0, 3, 2>(tr, tr));
+        tr = Add(tr, Shuffle<2, 3, 0, 1>(tr, tr));
+        Float4 det = Sub(Add(Mul(detA, detD), Mul(detB, detC)), tr);
+
+        Float4 invDet = Div(Set(1.0f, -1.0f, -1.0f, 1.0f), det);
+        x = Mul(x, invDet);
+        y = Mul(y, invDet);
+        z = Mul(z, invDet);
+        w = Mul(w, invDet);
+
+        // Taking the adjugates back and storing the blocks as rows
+        Mat4 out;
+        StoreUnaligned(out.data[0], Shuffle<3, 1, 3, 1>(x, y));
+        StoreUnaligned(out.data[1], Shuffle<2, 0, 2, 0>(x, y));
+        StoreUnaligned(out.data[2], Shuffle<3, 1, 3, 1>(z, w));
+        StoreUnaligned(out.data[3], Shuffle<2, 0, 2, 0>(z, w));
+        return out;
+    }
+}
@@ -0,0 +1,157 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+// Four wide float vectors for the math types. SSE is used on x86 and NEON on ARM, other targets get a scalar fallback
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define MATH_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define MATH_NEON
+#include <arm_neon.h>
+#endif
+
+namespace GLSLPT
+{
+    namespace Simd
+    {
+#if defined(MATH_SSE)
+        typedef __m128 Float4;
+#elif defined(MATH_NEON)
+        typedef float32x4_t Float4;
+#else
+        struct Float4
+        {
+            float v[4];
+        };
+#endif
+
+        // Load needs a 16 byte aligned address, LoadUnaligned doesn't
+        inline Float4 Load(const float* p);
+        inline Float4 LoadUnaligned(const float* p);
+        inline void Store(float* p, Float4 a);
+        inline void StoreUnaligned(float* p, Float4 a);
+        inline Float4 Set(float x, float y, float z, float w);
+        inline Float4 Set1(float a);
+
+        inline Float4 Add(Float4 a, Float4 b);
+        inline Float4 Sub(Float4 a, Float4 b);
+        inline Float4 Mul(Float4 a, Float4 b);
+        inline Float4 Div(Float4 a, Float4 b);
+
+        // Per lane b < a ? b : a and a < b ? b : a, which is what std::min and std::max return
+        inline Float4 Min(Float4 a, Float4 b);
+        inline Float4 Max(Float4 a, Float4 b);
+
+        // Returns (a[x], a[y], b[z], b[w]) like _mm_shuffle_ps
+        template <int x, int y, int z, int w>
+        inline Float4 Shuffle(Float4 a, Float4 b);
+
+        // Copies lane i to every lane
+        template <int i>
+        inline Float4 Splat(Float4 a) { return Shuffle<i, i, i, i>(a, a); }
+
+#if defined(MATH_SSE)
+
+        inline Float4 Load(const float* p) { return _mm_load_ps(p); }
+        inline Float4 LoadUnaligned(const float* p) { return _mm_loadu_ps(p); }
+        inline void Store(float* p, Float4 a) { _mm_store_ps(p, a); }
+        inline void StoreUnaligned(float* p, Float4 a) { _mm_storeu_ps(p, a); }
+        inline Float4 Set(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+        inline Float4 Set1(float a) { return _mm_set1_ps(a); }
+
+        inline Float4 Add(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+        inline Float4 Sub(Float4 a, Float4 b) { return _mm_sub_ps(a, b); }
+        inline Float4 Mul(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+        inline Float4 Div(Float4 a, Float4 b) { return _mm_div_ps(a, b); }
+
+        // minps and maxps return their second operand unless the first one wins the comparison
+        inline Float4 Min(Float4 a, Float4 b) { return _mm_min_ps(b, a); }
+        inline Float4 Max(Float4 a, Float4 b) { return _mm_max_ps(b, a); }
+
+        template <int x, int y, int z, int w>
+        inline Float4 Shuffle(Float4 a, Float4 b) { return _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x)); }
+
+#elif defined(MATH_NEON)
+
+        inline Float4 Load(const float* p) { return vld1q_f32(p); }
+        inline Float4 LoadUnaligned(const float* p) { return vld1q_f32(p); }
+        inline void Store(float* p, Float4 a) { vst1q_f32(p, a); }
+        inline void StoreUnaligned(float* p, Float4 a) { vst1q_f32(p, a); }
+        inline Float4 Set(float x, float y, float z, float w) { const float v[4] = { x, y, z, w }; return vld1q_f32(v); }
+        inline Float4 Set1(float a) { return vdupq_n_f32(a); }
+
+        inline Float4 Add(Float4 a, Float4 b) { return vaddq_f32(a, b); }
+        inline Float4 Sub(Float4 a, Float4 b) { return vsubq_f32(a, b); }
+        inline Float4 Mul(Float4 a, Float4 b) { return vmulq_f32(a, b); }
+
+        // Division is an estimate refined with two Newton steps on ARMv7, which has no vector divide
+        inline Float4 Div(Float4 a, Float4 b)
+        {
+#if defined(__aarch64__) || defined(_M_ARM64)
+            return vdivq_f32(a, b);
+#else
+            Float4 r = vrecpeq_f32(b);
+            r = vmulq_f32(vrecpsq_f32(b, r), r);
+            r = vmulq_f32(vrecpsq_f32(b, r), r);
+            return vmulq_f32(a, r);
+#endif
+        }
+
+        inline Float4 Min(Float4 a, Float4 b) { return vbslq_f32(vcltq_f32(b, a), b, a); }
+        inline Float4 Max(Float4 a, Float4 b) { return vbslq_f32(vcltq_f32(a, b), b, a); }
+
+        template <int x, int y, int z, int w>
+        inline Float4 Shuffle(Float4 a, Float4 b)
+        {
+            Float4 r = vdupq_n_f32(vgetq_lane_f32(a, x));
+            r = vsetq_lane_f32(vgetq_lane_f32(a, y), r, 1);
+            r = vsetq_lane_f32(vgetq_lane_f32(b, z), r, 2);
+            return vsetq_lane_f32(vgetq_lane_f32(b, w), r, 3);
+        }
+
+#else
+
+        inline Float4 Load(const float* p) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+        inline Float4 LoadUnaligned(const float* p) { return Load(p); }
+        inline void Store(float* p, Float4 a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+        inline void StoreUnaligned(float* p, Float4 a) { Store(p, a); }
+        inline Float4 Set(float x, float y, float z, float w) { Float4 r = { { x, y, z, w } }; return r; }
+        inline Float4 Set1(float a) { return Set(a, a, a, a); }
+
+        inline Float4 Add(Float4 a, Float4 b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+        inline Float4 Sub(Float4 a, Float4 b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+        inline Float4 Mul(Float4 a, Float4 b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+        inline Float4 Div(Float4 a, Float4 b) { for (int i = 0; i < 4; i++) a.v[i] /= b.v[i]; return a; }
+
+        inline Float4 Min(Float4 a, Float4 b) { for (int i = 0; i < 4; i++) a.v[i] = b.v[i] < a.v[i] ? b.v[i] : a.v[i]; return a; }
+        inline Float4 Max(Float4 a, Float4 b) { for (int i = 0; i < 4; i++) a.v[i] = a.v[i] < b.v[i] ? b.v[i] : a.v[i]; return a; }
+
+        template <int x, int y, int z, int w>
+        inline Float4 Shuffle(Float4 a, Float4 b) { return Set(a.v[x], a.v[y], b.v[z], b.v[w]); }
+
+#endif
+    }
+}
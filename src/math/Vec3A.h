@@ -0,0 +1,121 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Simd.h"
+#include "Vec3.h"
+
+namespace GLSLPT
+{
+    // Vec3 padded to 16 bytes and aligned so it loads into one SIMD register. Meant for bounding boxes and other CPU
+    // side data. Vec3 itself stays 12 bytes since arrays of it are uploaded to the GPU as they are
+    struct alignas(16) Vec3A
+    {
+    public:
+        Vec3A();
+        Vec3A(float x, float y, float z);
+        Vec3A(const Vec3& b);
+        explicit Vec3A(Simd::Float4 b);
+
+        operator Vec3() const { return Vec3(x, y, z); }
+        Simd::Float4 Get() const { return Simd::Load(&x); }
+
+        Vec3A operator*(const Vec3A& b) const;
+        Vec3A operator+(const Vec3A& b) const;
+        Vec3A operator-(const Vec3A& b) const;
+        Vec3A operator*(float b) const;
+
+        float operator[](int i) const { return (&x)[i]; }
+        float& operator[](int i) { return (&x)[i]; }
+
+        static Vec3A Min(const Vec3A& a, const Vec3A& b);
+        static Vec3A Max(const Vec3A& a, const Vec3A& b);
+        static float Dot(const Vec3A& a, const Vec3A& b);
+
+        float x, y, z;
+        float w; // Padding, kept at 0
+    };
+
+    inline Vec3A::Vec3A()
+    {
+        x = y = z = w = 0;
+    };
+
+    inline Vec3A::Vec3A(float x, float y, float z)
+    {
+        this->x = x;
+        this->y = y;
+        this->z = z;
+        w = 0;
+    };
+
+    inline Vec3A::Vec3A(const Vec3& b)
+    {
+        x = b.x;
+        y = b.y;
+        z = b.z;
+        w = 0;
+    };
+
+    inline Vec3A::Vec3A(Simd::Float4 b)
+    {
+        Simd::Store(&x, b);
+    };
+
+    inline Vec3A Vec3A::operator*(const Vec3A& b) const
+    {
+        return Vec3A(Simd::Mul(Get(), b.Get()));
+    };
+
+    inline Vec3A Vec3A::operator+(const Vec3A& b) const
+    {
+        return Vec3A(Simd::Add(Get(), b.Get()));
+    };
+
+    inline Vec3A Vec3A::operator-(const Vec3A& b) const
+    {
+        return Vec3A(Simd::Sub(Get(), b.Get()));
+    };
+
+    inline Vec3A Vec3A::operator*(float b) const
+    {
+        return Vec3A(Simd::Mul(Get(), Simd::Set1(b)));
+    };
+
+    inline Vec3A Vec3A::Min(const Vec3A& a, const Vec3A& b)
+    {
+        return Vec3A(Simd::Min(a.Get(), b.Get()));
+    };
+
+    inline Vec3A Vec3A::Max(const Vec3A& a, const Vec3A& b)
+    {
+        return Vec3A(Simd::Max(a.Get(), b.Get()));
+    };
+
+    inline float Vec3A::Dot(const Vec3A& a, const Vec3A& b)
+    {
+        return (a.x * b.x + a.y * b.y + a.z * b.z);
+    };
+}
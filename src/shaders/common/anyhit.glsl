@@ -22,66 +22,152 @@
  * SOFTWARE.
  */
 
+#ifdef OPT_LIGHTS
+bool AnyHitLight(int lightIndex, Ray r, float maxDist)
+{
+    // Fetch light Data
+    vec3 position = texelFetch(lightsTex, ivec2(lightIndex * 5 + 0, 0), 0).xyz;
+    vec3 u        = texelFetch(lightsTex, ivec2(lightIndex * 5 + 2, 0), 0).xyz;
+    vec3 v        = texelFetch(lightsTex, ivec2(lightIndex * 5 + 3, 0), 0).xyz;
+    vec3 params   = texelFetch(lightsTex, ivec2(lightIndex * 5 + 4, 0), 0).xyz;
+    float radius  = params.x;
+    float type    = params.z;
+
+    // Intersect rectangular area light
+    if (type == QUAD_LIGHT)
+    {
+        vec3 normal = normalize(cross(u, v));
+        vec4 plane = vec4(normal, dot(normal, position));
+        u *= 1.0f / dot(u, u);
+        v *= 1.0f / dot(v, v);
+
+        float d = RectIntersect(position, u, v, plane, r);
+        if (d > 0.0 && d < maxDist)
+            return true;
+    }
+
+    // Intersect spherical area light
+    if (type == SPHERE_LIGHT)
+    {
+        float d = SphereIntersect(radius, position, r);
+        if (d > 0.0 && d < maxDist)
+            return true;
+    }
+
+    return false;
+}
+#endif
+
 bool AnyHit(Ray r, float maxDist)
 {
 
 #ifdef OPT_LIGHTS
     // Intersect Emitters
-    for (int i = 0; i < numOfLights; i++)
-    {
-        // Fetch light Data
-        vec3 position = texelFetch(lightsTex, ivec2(i * 5 + 0, 0), 0).xyz;
-        vec3 emission = texelFetch(lightsTex, ivec2(i * 5 + 1, 0), 0).xyz;
-        vec3 u        = texelFetch(lightsTex, ivec2(i * 5 + 2, 0), 0).xyz;
-        vec3 v        = texelFetch(lightsTex, ivec2(i * 5 + 3, 0), 0).xyz;
-        vec3 params   = texelFetch(lightsTex, ivec2(i * 5 + 4, 0), 0).xyz;
-        float radius  = params.x;
-        float area    = params.y;
-        float type    = params.z;
-
-        // Intersect rectangular area light
-        if (type == QUAD_LIGHT)
-        {
-            vec3 normal = normalize(cross(u, v));
-            vec4 plane = vec4(normal, dot(normal, position));
-            u *= 1.0f / dot(u, u);
-            v *= 1.0f / dot(v, v);
+#ifdef OPT_LIGHT_BVH
+    int lightStack[32];
+    int lightPtr = 0;
+    int node = NumAreaLights() > 0 ? 0 : -1;
 
-            float d = RectIntersect(position, u, v, plane, r);
-            if (d > 0.0 && d < maxDist)
-                return true;
-        }
+    while (node != -1)
+    {
+        vec3 boundsMin = texelFetch(lightBVHTex, node * 3 + 0).xyz;
+        vec4 boundsMax = texelFetch(lightBVHTex, node * 3 + 1);
 
-        // Intersect spherical area light
-        if (type == SPHERE_LIGHT)
+        if (AABBOverlapsSegment(boundsMin, boundsMax.xyz, r, maxDist))
         {
-            float d = SphereIntersect(radius, position, r);
-            if (d > 0.0 && d < maxDist)
+            int child = floatBitsToInt(boundsMax.w);
+            if (child >= 0)
+            {
+                lightStack[lightPtr++] = child;
+                node = node + 1;
+                continue;
+            }
+            if (AnyHitLight(-child - 1, r, maxDist))
                 return true;
         }
+
+        node = lightPtr > 0 ? lightStack[--lightPtr] : -1;
+    }
+#else
+    for (int i = 0; i < numOfLights; i++)
+    {
+        if (AnyHitLight(i, r, maxDist))
+            return true;
     }
+#endif
 #endif
 
     // Intersect BVH and tris
+#ifdef OPT_STACKLESS_BVH
+    // Parent links are used to backtrack, so no traversal stack is needed
+    int blasEntry = -1;
+    bool subtreeDone = false;
+#else
     int stack[64];
     int ptr = 0;
     stack[ptr++] = -1;
+#endif
 
     int index = topBVHIndex;
-    float leftHit = 0.0;
-    float rightHit = 0.0;
 
 #if defined(OPT_ALPHA_TEST) && !defined(OPT_MEDIUM)
     int currMatID = 0;
+    bool opaqueInstance = true;
 #endif
     bool BLAS = false;
 
     Ray rTrans;
     rTrans.origin = r.origin;
     rTrans.direction = r.direction;
+#ifdef OPT_SIGNED_AABB
+    vec3 invDir = 1.0 / rTrans.direction;
+    bvec3 dirNeg = lessThan(invDir, vec3(0.0));
+#endif
 
     while (index != -1)
     {
+#ifdef OPT_STACKLESS_BVH
+        if (subtreeDone)
+        {
+            int parent = texelFetch(BVHLinksTex, index).x;
+
+            // If we've traversed the entire BLAS then switch back to the TLAS and continue from the instance leaf
+            if (parent == -1 && BLAS)
+            {
+                BLAS = false;
+                index = blasEntry;
+
+                rTrans.origin = r.origin;
+                rTrans.direction = r.direction;
+#ifdef OPT_SIGNED_AABB
+                invDir = 1.0 / rTrans.direction;
+                dirNeg = lessThan(invDir, vec3(0.0));
+#endif
+                continue;
+            }
+
+            // Visit the right sibling if we came up from the left child, otherwise keep going up
+            ivec2 children = parent == -1 ? ivec2(-1) : ivec2(texelFetch(BVH, parent * 3 + 2).xy);
+            if (index == children.x)
+            {
+                index = children.y;
+                subtreeDone = false;
+            }
+            else
+                index = parent;
+            continue;
+        }
+
+#ifdef OPT_SIGNED_AABB
+        if (!AABBOverlapsSegment(texelFetch(BVH, index * 3 + 0).xyz, texelFetch(BVH, index * 3 + 1).xyz, rTrans.origin, invDir, dirNeg, maxDist))
+#else
+        if (!AABBOverlapsSegment(texelFetch(BVH, index * 3 + 0).xyz, texelFetch(BVH, index * 3 + 1).xyz, rTrans, maxDist))
+#endif
+        {
+            subtreeDone = true;
+            continue;
+        }
+#endif
         ivec3 LRLeaf = ivec3(texelFetch(BVH, index * 3 + 2).xyz);
 
         int leftIndex  = int(LRLeaf.x);
@@ -92,6 +178,12 @@ bool AnyHit(Ray r, float maxDist)
         {
             for (int i = 0; i < rightIndex; i++) // Loop through tris
             {
+#ifdef OPT_TRIANGLE_BUFFER
+                // First vertex and edges are stored next to each other in leaf order
+                vec3 v0 = texelFetch(trianglesTex, (leftIndex + i) * 3 + 0).xyz;
+                vec3 e0 = texelFetch(trianglesTex, (leftIndex + i) * 3 + 1).xyz;
+                vec3 e1 = texelFetch(trianglesTex, (leftIndex + i) * 3 + 2).xyz;
+#else
                 ivec3 vertIndices = ivec3(texelFetch(vertexIndicesTex, leftIndex + i).xyz);
 
                 vec4 v0 = texelFetch(verticesTex, vertIndices.x);
@@ -100,6 +192,7 @@ bool AnyHit(Ray r, float maxDist)
 
                 vec3 e0 = v1.xyz - v0.xyz;
                 vec3 e1 = v2.xyz - v0.xyz;
+#endif
                 vec3 pv = cross(rTrans.direction, e1);
                 float det = dot(e0, pv);
 
@@ -116,6 +209,16 @@ bool AnyHit(Ray r, float maxDist)
                 if (all(greaterThanEqual(uvt, vec4(0.0))) && uvt.z < maxDist)
                 {
 #if defined(OPT_ALPHA_TEST) && !defined(OPT_MEDIUM)
+                    if (opaqueInstance)
+                        return true;
+
+#ifdef OPT_TRIANGLE_BUFFER
+                    ivec3 vertIndices = ivec3(texelFetch(vertexIndicesTex, leftIndex + i).xyz);
+
+                    vec4 v0 = texelFetch(verticesTex, vertIndices.x);
+                    vec4 v1 = texelFetch(verticesTex, vertIndices.y);
+                    vec4 v2 = texelFetch(verticesTex, vertIndices.z);
+#endif
                     vec2 t0 = vec2(v0.w, texelFetch(normalsTex, vertIndices.x).w);
                     vec2 t1 = vec2(v1.w, texelFetch(normalsTex, vertIndices.y).w);
                     vec2 t2 = vec2(v2.w, texelFetch(normalsTex, vertIndices.z).w);
@@ -125,7 +228,8 @@ bool AnyHit(Ray r, float maxDist)
                     vec4 texIDs      = texelFetch(materialsTex, ivec2(currMatID * 8 + 6, 0), 0);
                     vec4 alphaParams = texelFetch(materialsTex, ivec2(currMatID * 8 + 7, 0), 0);
                     
-                    float alpha = texture(textureMapsArrayTex, vec3(texCoord, texIDs.x)).a;
+                    // Shadow rays don't track a ray cone so the full resolution level is used
+                    float alpha = SampleTexture(int(texIDs.x), texCoord, -INF).a;
 
                     float opacity = alphaParams.x;
                     int alphaMode = int(alphaParams.y);
@@ -142,6 +246,10 @@ bool AnyHit(Ray r, float maxDist)
                 }
                     
             }
+#ifdef OPT_STACKLESS_BVH
+            subtreeDone = true;
+            continue;
+#endif
         }
         else if (leaf < 0) // Leaf node of TLAS
         {
@@ -154,50 +262,66 @@ bool AnyHit(Ray r, float maxDist)
 
             rTrans.origin    = vec3(inverse(transform) * vec4(r.origin, 1.0));
             rTrans.direction = vec3(inverse(transform) * vec4(r.direction, 0.0));
+#ifdef OPT_SIGNED_AABB
+            invDir = 1.0 / rTrans.direction;
+            dirNeg = lessThan(invDir, vec3(0.0));
+#endif
 
+#ifdef OPT_STACKLESS_BVH
+            // Remember the instance leaf. We'll return to this spot after we've traversed the entire BLAS
+            blasEntry = index;
+#else
             // Add a marker. We'll return to this spot after we've traversed the entire BLAS
             stack[ptr++] = -1;
+#endif
 
             index = leftIndex;
             BLAS = true;
 #if defined(OPT_ALPHA_TEST) && !defined(OPT_MEDIUM)
             currMatID = rightIndex;
+
+            // Any hit on an instance with an opaque material occludes, so its alpha test can be skipped entirely
+            opaqueInstance = int(texelFetch(materialsTex, ivec2(currMatID * 8 + 7, 0), 0).y) == ALPHA_MODE_OPAQUE;
 #endif
             continue;
         }
         else
         {
-            leftHit =  AABBIntersect(texelFetch(BVH, leftIndex  * 3 + 0).xyz, texelFetch(BVH, leftIndex  * 3 + 1).xyz, rTrans);
-            rightHit = AABBIntersect(texelFetch(BVH, rightIndex * 3 + 0).xyz, texelFetch(BVH, rightIndex * 3 + 1).xyz, rTrans);
+            // Any occluder will do, so children are not sorted by distance and the left child is always visited first
+#ifdef OPT_STACKLESS_BVH
+            index = leftIndex;
+            continue;
+#else
+#ifdef OPT_SIGNED_AABB
+            bvec2 childHits = AABBOverlapsSegmentPair(texelFetch(BVH, leftIndex  * 3 + 0).xyz, texelFetch(BVH, leftIndex  * 3 + 1).xyz,
+                                                      texelFetch(BVH, rightIndex * 3 + 0).xyz, texelFetch(BVH, rightIndex * 3 + 1).xyz,
+                                                      rTrans.origin, invDir, dirNeg, maxDist);
+            bool leftHit  = childHits.x;
+            bool rightHit = childHits.y;
+#else
+            bool leftHit  = AABBOverlapsSegment(texelFetch(BVH, leftIndex  * 3 + 0).xyz, texelFetch(BVH, leftIndex  * 3 + 1).xyz, rTrans, maxDist);
+            bool rightHit = AABBOverlapsSegment(texelFetch(BVH, rightIndex * 3 + 0).xyz, texelFetch(BVH, rightIndex * 3 + 1).xyz, rTrans, maxDist);
+#endif
 
-            if (leftHit > 0.0 && rightHit > 0.0)
+            if (leftHit && rightHit)
             {
-                int deferred = -1;
-                if (leftHit > rightHit)
-                {
-                    index = rightIndex;
-                    deferred = leftIndex;
-                }
-                else
-                {
-                    index = leftIndex;
-                    deferred = rightIndex;
-                }
-
-                stack[ptr++] = deferred;
+                index = leftIndex;
+                stack[ptr++] = rightIndex;
                 continue;
             }
-            else if (leftHit > 0.)
+            else if (leftHit)
             {
                 index = leftIndex;
                 continue;
             }
-            else if (rightHit > 0.)
+            else if (rightHit)
             {
                 index = rightIndex;
                 continue;
             }
+#endif
         }
+#ifndef OPT_STACKLESS_BVH
         index = stack[--ptr];
 
         // If we've traversed the entire BLAS then switch to back to TLAS and resume where we left off
@@ -209,7 +333,12 @@ bool AnyHit(Ray r, float maxDist)
 
             rTrans.origin = r.origin;
             rTrans.direction = r.direction;
+#ifdef OPT_SIGNED_AABB
+            invDir = 1.0 / rTrans.direction;
+            dirNeg = lessThan(invDir, vec3(0.0));
+#endif
         }
+#endif
     }
 
     return false;
@@ -22,6 +22,64 @@
  * SOFTWARE.
  */
 
+#ifdef OPT_LIGHTS
+void IntersectLight(int lightIndex, Ray r, inout float t, inout int hitLight, inout State state, inout LightSampleRec lightSample)
+{
+    float d;
+
+    // Fetch light Data
+    vec3 position = texelFetch(lightsTex, ivec2(lightIndex * 5 + 0, 0), 0).xyz;
+    vec3 emission = texelFetch(lightsTex, ivec2(lightIndex * 5 + 1, 0), 0).xyz;
+    vec3 u        = texelFetch(lightsTex, ivec2(lightIndex * 5 + 2, 0), 0).xyz;
+    vec3 v        = texelFetch(lightsTex, ivec2(lightIndex * 5 + 3, 0), 0).xyz;
+    vec3 params   = texelFetch(lightsTex, ivec2(lightIndex * 5 + 4, 0), 0).xyz;
+    float radius  = params.x;
+    float area    = params.y;
+    float type    = params.z;
+
+    if (type == QUAD_LIGHT)
+    {
+        vec3 normal = normalize(cross(u, v));
+        if (dot(normal, r.direction) > 0.) // Hide backfacing quad light
+            return;
+        vec4 plane = vec4(normal, dot(normal, position));
+        u *= 1.0f / dot(u, u);
+        v *= 1.0f / dot(v, v);
+
+        d = RectIntersect(position, u, v, plane, r);
+        if (d < 0.)
+            d = INF;
+        if (d < t)
+        {
+            t = d;
+            hitLight = lightIndex;
+            float cosTheta = dot(-r.direction, normal);
+            lightSample.pdf = (t * t) / (area * cosTheta);
+            lightSample.emission = emission;
+            state.isEmitter = true;
+        }
+    }
+
+    if (type == SPHERE_LIGHT)
+    {
+        d = SphereIntersect(radius, position, r);
+        if (d < 0.)
+            d = INF;
+        if (d < t)
+        {
+            t = d;
+            hitLight = lightIndex;
+            vec3 hitPt = r.origin + t * r.direction;
+            float cosTheta = dot(-r.direction, normalize(hitPt - position));
+            // TODO: Fix this. Currently assumes the light will be hit only from the outside
+            lightSample.pdf = (t * t) / (area * cosTheta * 0.5);
+            lightSample.emission = emission;
+            state.isEmitter = true;
+        }
+    }
+}
+#endif
+
 bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample)
 {
     float t = INF;
@@ -29,66 +87,57 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample)
 
 #ifdef OPT_LIGHTS
     // Intersect Emitters
+    int hitLight = -1;
 #ifdef OPT_HIDE_EMITTERS
 if(state.depth > 0)
 #endif
-    for (int i = 0; i < numOfLights; i++)
     {
-        // Fetch light Data
-        vec3 position = texelFetch(lightsTex, ivec2(i * 5 + 0, 0), 0).xyz;
-        vec3 emission = texelFetch(lightsTex, ivec2(i * 5 + 1, 0), 0).xyz;
-        vec3 u        = texelFetch(lightsTex, ivec2(i * 5 + 2, 0), 0).xyz;
-        vec3 v        = texelFetch(lightsTex, ivec2(i * 5 + 3, 0), 0).xyz;
-        vec3 params   = texelFetch(lightsTex, ivec2(i * 5 + 4, 0), 0).xyz;
-        float radius  = params.x;
-        float area    = params.y;
-        float type    = params.z;
-
-        if (type == QUAD_LIGHT)
-        {
-            vec3 normal = normalize(cross(u, v));
-            if (dot(normal, r.direction) > 0.) // Hide backfacing quad light
-                continue;
-            vec4 plane = vec4(normal, dot(normal, position));
-            u *= 1.0f / dot(u, u);
-            v *= 1.0f / dot(v, v);
-
-            d = RectIntersect(position, u, v, plane, r);
-            if (d < 0.)
-                d = INF;
-            if (d < t)
-            {
-                t = d;
-                float cosTheta = dot(-r.direction, normal);
-                lightSample.pdf = (t * t) / (area * cosTheta);
-                lightSample.emission = emission;
-                state.isEmitter = true;
-            }
-        }
+#ifdef OPT_LIGHT_BVH
+        // Only lights whose boxes the ray enters before the closest hit so far are tested
+        int lightStack[32];
+        int lightPtr = 0;
+        int node = NumAreaLights() > 0 ? 0 : -1;
 
-        if (type == SPHERE_LIGHT)
+        while (node != -1)
         {
-            d = SphereIntersect(radius, position, r);
-            if (d < 0.)
-                d = INF;
-            if (d < t)
+            vec3 boundsMin = texelFetch(lightBVHTex, node * 3 + 0).xyz;
+            vec4 boundsMax = texelFetch(lightBVHTex, node * 3 + 1);
+
+            if (AABBOverlapsSegment(boundsMin, boundsMax.xyz, r, t))
             {
-                t = d;
-                vec3 hitPt = r.origin + t * r.direction;
-                float cosTheta = dot(-r.direction, normalize(hitPt - position));
-                // TODO: Fix this. Currently assumes the light will be hit only from the outside
-                lightSample.pdf = (t * t) / (area * cosTheta * 0.5);
-                lightSample.emission = emission;
-                state.isEmitter = true;
+                int child = floatBitsToInt(boundsMax.w);
+                if (child >= 0)
+                {
+                    lightStack[lightPtr++] = child;
+                    node = node + 1;
+                    continue;
+                }
+                IntersectLight(-child - 1, r, t, hitLight, state, lightSample);
             }
+
+            node = lightPtr > 0 ? lightStack[--lightPtr] : -1;
         }
+#else
+        for (int i = 0; i < numOfLights; i++)
+            IntersectLight(i, r, t, hitLight, state, lightSample);
+#endif
     }
+
+    // Include the probability of picking the light for next event estimation from where the ray started, for MIS
+    if (hitLight != -1 && state.depth > 0)
+        lightSample.pdf *= LightPmf(r.origin, hitLight);
 #endif
 
     // Intersect BVH and tris
+#ifdef OPT_STACKLESS_BVH
+    // Parent links are used to backtrack, so no traversal stack is needed
+    int blasEntry = -1;
+    bool subtreeDone = false;
+#else
     int stack[64];
     int ptr = 0;
     stack[ptr++] = -1;
+#endif
 
     int index = topBVHIndex;
     float leftHit = 0.0;
@@ -98,6 +147,9 @@ if(state.depth > 0)
     bool BLAS = false;
 
     ivec3 triID = ivec3(-1);
+#ifdef OPT_TRIANGLE_BUFFER
+    int triIndex = -1;
+#endif
     mat4 transMat;
     mat4 transform;
     vec3 bary;
@@ -106,9 +158,55 @@ if(state.depth > 0)
     Ray rTrans;
     rTrans.origin = r.origin;
     rTrans.direction = r.direction;
+#ifdef OPT_SIGNED_AABB
+    vec3 invDir = 1.0 / rTrans.direction;
+    bvec3 dirNeg = lessThan(invDir, vec3(0.0));
+#endif
 
     while (index != -1)
     {
+#ifdef OPT_STACKLESS_BVH
+        if (subtreeDone)
+        {
+            int parent = texelFetch(BVHLinksTex, index).x;
+
+            // If we've traversed the entire BLAS then switch back to the TLAS and continue from the instance leaf
+            if (parent == -1 && BLAS)
+            {
+                BLAS = false;
+                index = blasEntry;
+
+                rTrans.origin = r.origin;
+                rTrans.direction = r.direction;
+#ifdef OPT_SIGNED_AABB
+                invDir = 1.0 / rTrans.direction;
+                dirNeg = lessThan(invDir, vec3(0.0));
+#endif
+                continue;
+            }
+
+            // Visit the far sibling if we came up from the near child, otherwise keep going up
+            ivec2 children = parent == -1 ? ivec2(-1) : OrderChildren(parent, ivec2(texelFetch(BVH, parent * 3 + 2).xy), rTrans.direction);
+            if (index == children.x)
+            {
+                index = children.y;
+                subtreeDone = false;
+            }
+            else
+                index = parent;
+            continue;
+        }
+
+#ifdef OPT_SIGNED_AABB
+        if (AABBIntersect(texelFetch(BVH, index * 3 + 0).xyz, texelFetch(BVH, index * 3 + 1).xyz, rTrans.origin, invDir, dirNeg) <= 0.0)
+#else
+        if (AABBIntersect(texelFetch(BVH, index * 3 + 0).xyz, texelFetch(BVH, index * 3 + 1).xyz, rTrans) <= 0.0)
+#endif
+        {
+            subtreeDone = true;
+            continue;
+        }
+#endif
         ivec3 LRLeaf = ivec3(texelFetch(BVH, index * 3 + 2).xyz);
 
         int leftIndex  = int(LRLeaf.x);
@@ -119,6 +217,12 @@ if(state.depth > 0)
         {
             for (int i = 0; i < rightIndex; i++) // Loop through tris
             {
+#ifdef OPT_TRIANGLE_BUFFER
+                // First vertex and edges are stored next to each other in leaf order
+                vec3 v0 = texelFetch(trianglesTex, (leftIndex + i) * 3 + 0).xyz;
+                vec3 e0 = texelFetch(trianglesTex, (leftIndex + i) * 3 + 1).xyz;
+                vec3 e1 = texelFetch(trianglesTex, (leftIndex + i) * 3 + 2).xyz;
+#else
                 ivec3 vertIndices = ivec3(texelFetch(vertexIndicesTex, leftIndex + i).xyz);
 
                 vec4 v0 = texelFetch(verticesTex, vertIndices.x);
@@ -127,6 +231,7 @@ if(state.depth > 0)
 
                 vec3 e0 = v1.xyz - v0.xyz;
                 vec3 e1 = v2.xyz - v0.xyz;
+#endif
                 vec3 pv = cross(rTrans.direction, e1);
                 float det = dot(e0, pv);
 
@@ -143,13 +248,21 @@ if(state.depth > 0)
                 if (all(greaterThanEqual(uvt, vec4(0.0))) && uvt.z < t)
                 {
                     t = uvt.z;
+#ifdef OPT_TRIANGLE_BUFFER
+                    triIndex = leftIndex + i;
+#else
                     triID = vertIndices;
+                    vert0 = v0, vert1 = v1, vert2 = v2;
+#endif
                     state.matID = currMatID;
                     bary = uvt.wxy;
-                    vert0 = v0, vert1 = v1, vert2 = v2;
                     transform = transMat;
                 }
             }
+#ifdef OPT_STACKLESS_BVH
+            subtreeDone = true;
+            continue;
+#endif
         }
         else if (leaf < 0) // Leaf node of TLAS
         {
@@ -162,9 +275,18 @@ if(state.depth > 0)
 
             rTrans.origin    = vec3(inverse(transMat) * vec4(r.origin, 1.0));
             rTrans.direction = vec3(inverse(transMat) * vec4(r.direction, 0.0));
+#ifdef OPT_SIGNED_AABB
+            invDir = 1.0 / rTrans.direction;
+            dirNeg = lessThan(invDir, vec3(0.0));
+#endif
 
+#ifdef OPT_STACKLESS_BVH
+            // Remember the instance leaf. We'll return to this spot after we've traversed the entire BLAS
+            blasEntry = index;
+#else
             // Add a marker. We'll return to this spot after we've traversed the entire BLAS
             stack[ptr++] = -1;
+#endif
             index = leftIndex;
             BLAS = true;
             currMatID = rightIndex;
@@ -172,8 +294,20 @@ if(state.depth > 0)
         }
         else
         {
+#ifdef OPT_STACKLESS_BVH
+            index = OrderChildren(index, LRLeaf.xy, rTrans.direction).x;
+            continue;
+#else
+#ifdef OPT_SIGNED_AABB
+            vec2 childHits = AABBIntersectPair(texelFetch(BVH, leftIndex  * 3 + 0).xyz, texelFetch(BVH, leftIndex  * 3 + 1).xyz,
+                                               texelFetch(BVH, rightIndex * 3 + 0).xyz, texelFetch(BVH, rightIndex * 3 + 1).xyz,
+                                               rTrans.origin, invDir, dirNeg);
+            leftHit  = childHits.x;
+            rightHit = childHits.y;
+#else
             leftHit  = AABBIntersect(texelFetch(BVH, leftIndex  * 3 + 0).xyz, texelFetch(BVH, leftIndex  * 3 + 1).xyz, rTrans);
             rightHit = AABBIntersect(texelFetch(BVH, rightIndex * 3 + 0).xyz, texelFetch(BVH, rightIndex * 3 + 1).xyz, rTrans);
+#endif
 
             if (leftHit > 0.0 && rightHit > 0.0)
             {
@@ -202,7 +336,9 @@ if(state.depth > 0)
                 index = rightIndex;
                 continue;
             }
+#endif
         }
+#ifndef OPT_STACKLESS_BVH
         index = stack[--ptr];
 
         // If we've traversed the entire BLAS then switch to back to TLAS and resume where we left off
@@ -214,7 +350,12 @@ if(state.depth > 0)
 
             rTrans.origin = r.origin;
             rTrans.direction = r.direction;
+#ifdef OPT_SIGNED_AABB
+            invDir = 1.0 / rTrans.direction;
+            dirNeg = lessThan(invDir, vec3(0.0));
+#endif
         }
+#endif
     }
 
     // No intersections
@@ -224,6 +365,18 @@ if(state.depth > 0)
     state.hitDist = t;
     state.fhp = r.origin + r.direction * t;
 
+#ifdef OPT_TRIANGLE_BUFFER
+    // Vertex data is only needed for shading so fetch it for the closest hit alone
+    if (triIndex != -1)
+    {
+        triID = ivec3(texelFetch(vertexIndicesTex, triIndex).xyz);
+
+        vert0 = texelFetch(verticesTex, triID.x);
+        vert1 = texelFetch(verticesTex, triID.y);
+        vert2 = texelFetch(verticesTex, triID.z);
+    }
+#endif
+
     // Ray hit a triangle and not a light source
     if (triID.x != -1)
     {
@@ -260,6 +413,18 @@ if(state.depth > 0)
 
         state.tangent = normalize(mat3(transform) * state.tangent);
         state.bitangent = normalize(mat3(transform) * state.bitangent);
+
+        // Texture space to world space area ratio of the triangle for picking mip levels
+        vec3 worldNormal = cross(mat3(transform) * deltaPos1, mat3(transform) * deltaPos2);
+        float uvArea = abs(deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
+        float worldArea = length(worldNormal);
+        state.texLOD = 0.5 * log2(uvArea / max(worldArea, 1e-12));
+
+#ifdef OPT_MESH_LIGHTS
+        // Solid angle pdf of sampling the hit point as part of an emissive mesh, for MIS
+        float cosTheta = abs(dot(worldNormal, r.direction)) / max(worldArea, 1e-12);
+        lightSample.pdf = cosTheta > 0.0 ? MeshLightPdf(state.matID) * t * t / cosTheta : 0.0;
+#endif
     }
 
     return true;
@@ -214,7 +214,9 @@ vec3 DisneySample(State state, vec3 V, vec3 N, out vec3 L, out float pdf)
             H = -H;
 
         // TODO: Refactor into metallic BRDF and specular BSDF
-        float fresnel = DisneyFresnel(state.mat, state.eta, dot(L, H), dot(V, H));
+        // L isn't known yet, so the metallic Fresnel takes the angle of the mirrored direction, which is that of V
+        float VDotH = dot(V, H);
+        float fresnel = DisneyFresnel(state.mat, state.eta, VDotH, VDotH);
         float F = 1.0 - ((1.0 - fresnel) * state.mat.specTrans * (1.0 - state.mat.metallic));
 
         if (rand() < F)
@@ -25,61 +25,62 @@
 #ifdef OPT_ENVMAP
 #ifndef OPT_UNIFORM_LIGHT
 
-vec2 BinarySearch(float value)
+// Returns the picked index along with its pdf
+int SampleAliasTable(int offset, int count, out float pdf)
 {
-    ivec2 envMapResInt = ivec2(envMapRes);
-    int lower = 0;
-    int upper = envMapResInt.y - 1;
-    while (lower < upper)
-    {
-        int mid = (lower + upper) >> 1;
-        if (value < texelFetch(envMapCDFTex, ivec2(envMapResInt.x - 1, mid), 0).r)
-            upper = mid;
-        else
-            lower = mid + 1;
-    }
-    int y = clamp(lower, 0, envMapResInt.y - 1);
+    // Pick an entry uniformly, then keep it or take its alias
+    int index = min(int(rand() * float(count)), count - 1);
 
-    lower = 0;
-    upper = envMapResInt.x - 1;
-    while (lower < upper)
+    ivec4 entry = texelFetch(envMapAliasTex, offset + index);
+    if (rand() < intBitsToFloat(entry.x))
     {
-        int mid = (lower + upper) >> 1;
-        if (value < texelFetch(envMapCDFTex, ivec2(mid, y), 0).r)
-            upper = mid;
-        else
-            lower = mid + 1;
+        pdf = intBitsToFloat(entry.z);
+        return index;
     }
-    int x = clamp(lower, 0, envMapResInt.x - 1);
-    return vec2(x, y) / envMapRes;
+
+    pdf = intBitsToFloat(entry.w);
+    return entry.y;
+}
+
+// Cells of the importance map are sampled uniformly within, so converting their pdf with respect to uv
+// to solid angle only needs the sin(theta) of the direction
+float EnvMapPdf(float uvPdf, float sinTheta)
+{
+    if (sinTheta == 0.0)
+        return 0.0;
+
+    return uvPdf / (TWO_PI * PI * sinTheta);
 }
 
 vec4 EvalEnvMap(Ray r)
 {
     float theta = acos(clamp(r.direction.y, -1.0, 1.0));
     vec2 uv = vec2((PI + atan(r.direction.z, r.direction.x)) * INV_TWO_PI, theta * INV_PI) + vec2(envMapRot, 0.0);
-    
+
     vec3 color = texture(envMapTex, uv).rgb;
-    float pdf = Luminance(color) / envMapTotalSum;
-                
-    return vec4(color, (pdf * envMapRes.x * envMapRes.y) / (TWO_PI * PI * sin(theta)));
+    ivec2 cell = min(ivec2(vec2(fract(uv.x), uv.y) * envMapImportanceRes), ivec2(envMapImportanceRes) - 1);
+    float uvPdf = intBitsToFloat(texelFetch(envMapAliasTex, cell.y * int(envMapImportanceRes.x) + cell.x).z);
+
+    return vec4(color, EnvMapPdf(uvPdf, sin(theta)));
 }
 
 vec4 SampleEnvMap(inout vec3 color)
 {
-    vec2 uv = BinarySearch(rand() * envMapTotalSum);
+    // Pick a row from the marginal distribution, then a cell from the row's conditional distribution
+    ivec2 importanceRes = ivec2(envMapImportanceRes);
+    float rowPdf, uvPdf;
+    int y = SampleAliasTable(importanceRes.x * importanceRes.y, importanceRes.y, rowPdf);
+    int x = SampleAliasTable(y * importanceRes.x, importanceRes.x, uvPdf);
 
+    vec2 uv = (vec2(x, y) + vec2(rand(), rand())) / envMapImportanceRes;
     color = texture(envMapTex, uv).rgb;
-    float pdf = Luminance(color) / envMapTotalSum;
 
     uv.x -= envMapRot;
     float phi = uv.x * TWO_PI;
     float theta = uv.y * PI;
+    float sinTheta = sin(theta);
 
-    if (sin(theta) == 0.0)
-        pdf = 0.0;
-
-    return vec4(-sin(theta) * cos(phi), cos(theta), -sin(theta) * sin(phi), (pdf * envMapRes.x * envMapRes.y) / (TWO_PI * PI * sin(theta)));
+    return vec4(-sinTheta * cos(phi), cos(theta), -sinTheta * sin(phi), EnvMapPdf(uvPdf, sinTheta));
 }
 
 #endif
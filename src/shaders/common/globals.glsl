@@ -115,6 +115,8 @@ struct State
     bool isEmitter;
 
     vec2 texCoord;
+    float texLOD;    // Texture independent part of the mip level, from the uv to world area ratio of the hit triangle
+    float coneWidth; // Width of the ray cone at the hit point
     int matID;
     Material mat;
     Medium medium;
@@ -138,16 +140,43 @@ struct LightSampleRec
 
 uniform Camera camera;
 
+// Sampler dimensions of each decision. The camera uses the first four and every bounce gets its own range,
+// with each decision of a bounce at a fixed offset. Ranges are generous since alpha tested shadow rays draw a
+// varying number of values after the decision itself
+#define DIM_CAMERA      0
+#define DIM_BOUNCE      4
+#define DIMS_PER_BOUNCE 64
+#define DIM_MEDIUM      0
+#define DIM_ALPHA       3
+#define DIM_RR          4
+#define DIM_BSDF        8
+#define DIM_ENVMAP      16
+#define DIM_MESH_LIGHT  24
+#define DIM_LIGHT       32
+
 //RNG from code by Moroz Mykhailo (https://www.shadertoy.com/view/wltcRS)
 
 //internal RNG state 
 uvec4 seed;
 ivec2 pixel;
 
+// Dimension the next call to rand() reads
+int sampleDim;
+
+#ifdef OPT_SOBOL
+// 4D Sobol point the current dimension is read from
+int cachedGroup;
+vec4 cachedSample;
+#endif
+
 void InitRNG(vec2 p, int frame)
 {
     pixel = ivec2(p);
     seed = uvec4(p, uint(frame), uint(p.x) + uint(p.y));
+    sampleDim = 0;
+#ifdef OPT_SOBOL
+    cachedGroup = -1;
+#endif
 }
 
 void pcg4d(inout uvec4 v)
@@ -158,11 +187,126 @@ void pcg4d(inout uvec4 v)
     v.x += v.y * v.w; v.y += v.z * v.x; v.z += v.x * v.y; v.w += v.y * v.z;
 }
 
-float rand()
+#ifdef OPT_SOBOL
+
+// Owen scrambled and shuffled Sobol points from "Practical Hash-based Owen Scrambling" by Brent Burley.
+// Dimensions are taken four at a time from the same 4D Sobol point and each group of four gets its own
+// shuffle of the sample index, so groups are decorrelated from each other (padding)
+
+uint ReverseBits(uint x)
+{
+    x = ((x & 0x55555555u) << 1u) | ((x >> 1u) & 0x55555555u);
+    x = ((x & 0x33333333u) << 2u) | ((x >> 2u) & 0x33333333u);
+    x = ((x & 0x0f0f0f0fu) << 4u) | ((x >> 4u) & 0x0f0f0f0fu);
+    x = ((x & 0x00ff00ffu) << 8u) | ((x >> 8u) & 0x00ff00ffu);
+    return (x << 16u) | (x >> 16u);
+}
+
+uint LaineKarrasPermutation(uint x, uint seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint NestedUniformScramble(uint x, uint seed)
 {
+    return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+uint HashCombine(uint seed, uint v)
+{
+    return seed ^ (v + (seed << 6u) + (seed >> 2u));
+}
+
+uint Hash(uint x)
+{
+    x ^= x >> 17u;
+    x *= 0xed5ad4bbu;
+    x ^= x >> 11u;
+    x *= 0xac4c1b51u;
+    x ^= x >> 15u;
+    x *= 0x31848babu;
+    x ^= x >> 14u;
+    return x;
+}
+
+vec4 SobolOwen4D(int group)
+{
+    uint groupSeed = Hash(HashCombine(HashCombine(Hash(uint(pixel.x)), uint(pixel.y)), uint(group)));
+    uint index = NestedUniformScramble(uint(sampleNum), groupSeed);
+
+    uvec4 result = uvec4(0u);
+    for (int bit = 0; index != 0u; bit++, index >>= 1u)
+    {
+        if ((index & 1u) != 0u)
+            result ^= uvec4(sobolDirections[bit], sobolDirections[32 + bit], sobolDirections[64 + bit], sobolDirections[96 + bit]);
+    }
+
+    for (int i = 0; i < 4; i++)
+        result[i] = NestedUniformScramble(result[i], Hash(HashCombine(groupSeed, uint(i))));
+
+    // Keep the top 24 bits so the result stays below 1.0
+    return vec4(result >> 8u) / 16777216.0;
+}
+
+float SamplerRand()
+{
+    int group = sampleDim >> 2;
+    if (group != cachedGroup)
+    {
+        cachedSample = SobolOwen4D(group);
+        cachedGroup = group;
+    }
+    return cachedSample[sampleDim++ & 3];
+}
+
+#else
+
+float SamplerRand()
+{
+    sampleDim++;
     pcg4d(seed); return float(seed.x) / float(0xffffffffu);
 }
 
+#endif
+
+#ifdef OPT_BLUE_NOISE
+
+// Camera and first bounce dimensions are read from a tiled blue noise mask, so the error of neighbouring pixels
+// is anticorrelated and looks like fine grain at low sample counts. The mask is shifted by a random offset for
+// every dimension and sample, which keeps dimensions and samples independent of each other
+#define BLUE_NOISE_SIZE 64
+#define BLUE_NOISE_DIMS (DIM_BOUNCE + DIMS_PER_BOUNCE)
+
+float BlueNoise(int dim)
+{
+    uvec4 offset = uvec4(uint(dim), uint(sampleNum), 0u, 0u);
+    pcg4d(offset);
+    return texelFetch(blueNoiseTex, (pixel + ivec2(offset.xy >> 8u)) & (BLUE_NOISE_SIZE - 1), 0).r;
+}
+
+#endif
+
+// Points the next call to rand() at a fixed dimension, so a decision uses the same dimension in every sample
+// no matter how many numbers were drawn before it
+void SetSampleDimension(int dim)
+{
+    sampleDim = dim;
+}
+
+float rand()
+{
+#ifdef OPT_BLUE_NOISE
+    if (sampleDim < BLUE_NOISE_DIMS)
+        return BlueNoise(sampleDim++);
+#endif
+    return SamplerRand();
+}
+
 vec3 FaceForward(vec3 a, vec3 b)
 {
     return dot(a, b) < 0.0 ? -b : b;
@@ -79,4 +79,92 @@ float AABBIntersect(vec3 minCorner, vec3 maxCorner, Ray r)
     float t0 = max(tmin.x, max(tmin.y, tmin.z));
 
     return (t1 >= t0) ? (t0 > 0.f ? t0 : t1) : -1.0;
-}
\ No newline at end of file
+}
+
+// Returns true if the part of the ray between the origin and maxDist passes through the box
+bool AABBOverlapsSegment(vec3 minCorner, vec3 maxCorner, Ray r, float maxDist)
+{
+    vec3 invDir = 1.0 / r.direction;
+
+    vec3 f = (maxCorner - r.origin) * invDir;
+    vec3 n = (minCorner - r.origin) * invDir;
+
+    vec3 tmax = max(f, n);
+    vec3 tmin = min(f, n);
+
+    float t1 = min(tmax.x, min(tmax.y, tmax.z));
+    float t0 = max(tmin.x, max(tmin.y, tmin.z));
+
+    return t1 >= t0 && t1 > 0.0 && t0 < maxDist;
+}
+
+#ifdef OPT_SIGNED_AABB
+// Box tests that use the inverse direction and its sign computed once per ray.
+// The sign of each direction component decides which plane of the box is entered first,
+// so the near and far distances are found without a min/max per axis
+
+// Returns the near (xy) and far (zw) distances to the boxes of both children of a node in one pass
+vec4 AABBNearFarPair(vec3 leftMin, vec3 leftMax, vec3 rightMin, vec3 rightMax, vec3 origin, vec3 invDir, bvec3 dirNeg)
+{
+    vec3 ln = (mix(leftMin, leftMax, dirNeg) - origin) * invDir;
+    vec3 lf = (mix(leftMax, leftMin, dirNeg) - origin) * invDir;
+    vec3 rn = (mix(rightMin, rightMax, dirNeg) - origin) * invDir;
+    vec3 rf = (mix(rightMax, rightMin, dirNeg) - origin) * invDir;
+
+    vec2 t0 = max(vec2(ln.x, rn.x), max(vec2(ln.y, rn.y), vec2(ln.z, rn.z)));
+    vec2 t1 = min(vec2(lf.x, rf.x), min(vec2(lf.y, rf.y), vec2(lf.z, rf.z)));
+
+    return vec4(t0, t1);
+}
+
+float AABBIntersect(vec3 minCorner, vec3 maxCorner, vec3 origin, vec3 invDir, bvec3 dirNeg)
+{
+    vec3 n = (mix(minCorner, maxCorner, dirNeg) - origin) * invDir;
+    vec3 f = (mix(maxCorner, minCorner, dirNeg) - origin) * invDir;
+
+    float t1 = min(f.x, min(f.y, f.z));
+    float t0 = max(n.x, max(n.y, n.z));
+
+    return (t1 >= t0) ? (t0 > 0.f ? t0 : t1) : -1.0;
+}
+
+vec2 AABBIntersectPair(vec3 leftMin, vec3 leftMax, vec3 rightMin, vec3 rightMax, vec3 origin, vec3 invDir, bvec3 dirNeg)
+{
+    vec4 t = AABBNearFarPair(leftMin, leftMax, rightMin, rightMax, origin, invDir, dirNeg);
+    vec2 t0 = t.xy;
+    vec2 t1 = t.zw;
+
+    vec2 hit = mix(t1, t0, greaterThan(t0, vec2(0.0)));
+    return mix(vec2(-1.0), hit, greaterThanEqual(t1, t0));
+}
+
+bool AABBOverlapsSegment(vec3 minCorner, vec3 maxCorner, vec3 origin, vec3 invDir, bvec3 dirNeg, float maxDist)
+{
+    vec3 n = (mix(minCorner, maxCorner, dirNeg) - origin) * invDir;
+    vec3 f = (mix(maxCorner, minCorner, dirNeg) - origin) * invDir;
+
+    float t1 = min(f.x, min(f.y, f.z));
+    float t0 = max(n.x, max(n.y, n.z));
+
+    return t1 >= t0 && t1 > 0.0 && t0 < maxDist;
+}
+
+bvec2 AABBOverlapsSegmentPair(vec3 leftMin, vec3 leftMax, vec3 rightMin, vec3 rightMax, vec3 origin, vec3 invDir, bvec3 dirNeg, float maxDist)
+{
+    vec4 t = AABBNearFarPair(leftMin, leftMax, rightMin, rightMax, origin, invDir, dirNeg);
+    vec2 t0 = t.xy;
+    vec2 t1 = t.zw;
+
+    return bvec2(t1.x >= t0.x && t1.x > 0.0 && t0.x < maxDist,
+                 t1.y >= t0.y && t1.y > 0.0 && t0.y < maxDist);
+}
+#endif
+
+#ifdef OPT_STACKLESS_BVH
+// Returns the children of a node in the order they should be visited (near child first)
+ivec2 OrderChildren(int index, ivec2 children, vec3 direction)
+{
+    ivec3 link = texelFetch(BVHLinksTex, index).xyz;
+    return direction[link.y] * float(link.z) >= 0.0 ? children : children.yx;
+}
+#endif
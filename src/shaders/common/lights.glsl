@@ -0,0 +1,277 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifdef OPT_LIGHTS
+
+#ifdef OPT_LIGHT_BVH
+
+// Light BVH nodes take three texels each. They are followed by the trail of every light and then the indices
+// of the distant lights, both packed four to a texel
+
+int NumAreaLights()
+{
+    return numOfLights - numOfDistantLights;
+}
+
+int LightTrailsOffset()
+{
+    int numAreaLights = NumAreaLights();
+    return numAreaLights > 0 ? (2 * numAreaLights - 1) * 3 : 0;
+}
+
+// Estimated contribution of the lights below a node at p, from their power, bounds and cone of normals.
+// All lights emit over a hemisphere so the cone of emission is the cone of normals widened by 90 degrees
+float LightNodeImportance(vec3 p, int node)
+{
+    vec4 boundsMinPower = texelFetch(lightBVHTex, node * 3 + 0);
+    vec3 boundsMax = texelFetch(lightBVHTex, node * 3 + 1).xyz;
+    vec4 cone = texelFetch(lightBVHTex, node * 3 + 2);
+
+    vec3 center = (boundsMinPower.xyz + boundsMax) * 0.5;
+    float radiusSq = dot(boundsMax - center, boundsMax - center);
+    vec3 toPoint = p - center;
+    float distSq = dot(toPoint, toPoint);
+
+    // Any light in the node could face a point inside its bounds
+    if (distSq <= radiusSq)
+        return boundsMinPower.w / radiusSq;
+
+    // Angle between the cone axis and the point, less the spread of the cone and the angle subtended by the bounds
+    float cosThetaW = dot(cone.xyz, toPoint) / sqrt(distSq);
+    float cosThetaB = sqrt(1.0 - radiusSq / distSq);
+    float theta = acos(clamp(cosThetaW, -1.0, 1.0)) - acos(clamp(cone.w, -1.0, 1.0)) - acos(cosThetaB);
+
+    if (theta >= PI * 0.5)
+        return 0.0;
+
+    return boundsMinPower.w * cos(max(theta, 0.0)) / distSq;
+}
+
+// Probability of taking the first child of an interior node
+float LightNodeSplit(vec3 p, int node, int child)
+{
+    float left = LightNodeImportance(p, node + 1);
+    float right = LightNodeImportance(p, child);
+
+    if (left + right == 0.0)
+        return -1.0;
+
+    return left / (left + right);
+}
+
+// Walks down the hierarchy picking children in proportion to their importance at p. u is rescaled to [0, 1) after
+// every decision so the whole walk takes one sample dimension however deep the tree is
+int SampleLightBVH(vec3 p, float u, out float pmf)
+{
+    int node = 0;
+    pmf = 1.0;
+
+    while (true)
+    {
+        int child = floatBitsToInt(texelFetch(lightBVHTex, node * 3 + 1).w);
+        if (child < 0)
+            return -child - 1;
+
+        float pLeft = LightNodeSplit(p, node, child);
+        if (pLeft < 0.0)
+        {
+            pmf = 0.0;
+            return -1;
+        }
+
+        if (u < pLeft)
+        {
+            node = node + 1;
+            pmf *= pLeft;
+            u = u / pLeft;
+        }
+        else
+        {
+            node = child;
+            pmf *= 1.0 - pLeft;
+            u = (u - pLeft) / (1.0 - pLeft);
+        }
+        u = min(u, 0.99999994);
+    }
+}
+
+// Follows the trail of a light down the hierarchy, taking the same decisions sampling would have
+float LightBVHPmf(vec3 p, int lightIndex)
+{
+    int trail = floatBitsToInt(texelFetch(lightBVHTex, LightTrailsOffset() + lightIndex / 4)[lightIndex % 4]);
+    int node = 0;
+    float pmf = 1.0;
+
+    for (int depth = 0; ; depth++)
+    {
+        int child = floatBitsToInt(texelFetch(lightBVHTex, node * 3 + 1).w);
+        if (child < 0)
+            return pmf;
+
+        float pLeft = LightNodeSplit(p, node, child);
+        if (pLeft < 0.0)
+            return 0.0;
+
+        if ((trail & (1 << depth)) != 0)
+        {
+            node = child;
+            pmf *= 1.0 - pLeft;
+        }
+        else
+        {
+            node = node + 1;
+            pmf *= pLeft;
+        }
+    }
+}
+
+// Distant lights can't be bounded so they are picked uniformly, with the hierarchy counting as one more light
+float DistantLightsProbability()
+{
+    return float(numOfDistantLights) / float(numOfDistantLights + (NumAreaLights() > 0 ? 1 : 0));
+}
+
+int SampleLight(vec3 p, out float pmf)
+{
+    float pDistant = DistantLightsProbability();
+    float r = rand();
+
+    if (r < pDistant)
+    {
+        int i = min(int(r / pDistant * float(numOfDistantLights)), numOfDistantLights - 1);
+        int offset = LightTrailsOffset() + (numOfLights + 3) / 4;
+        pmf = pDistant / float(numOfDistantLights);
+        return floatBitsToInt(texelFetch(lightBVHTex, offset + i / 4)[i % 4]);
+    }
+
+    int lightIndex = SampleLightBVH(p, min((r - pDistant) / (1.0 - pDistant), 0.99999994), pmf);
+    pmf *= 1.0 - pDistant;
+    return lightIndex;
+}
+
+// Only valid for area lights, as distant lights can't be hit
+float LightPmf(vec3 p, int lightIndex)
+{
+    return (1.0 - DistantLightsProbability()) * LightBVHPmf(p, lightIndex);
+}
+
+#else
+
+// Lights are picked in proportion to their power from an alias table. Each entry holds the probability of its
+// light and of its alias, so the probability of the pick comes from the same fetch
+
+int SampleLight(vec3 p, out float pmf)
+{
+    int i = min(int(rand() * float(numOfLights)), numOfLights - 1);
+    ivec4 entry = texelFetch(lightAliasTex, i);
+
+    if (rand() < intBitsToFloat(entry.x))
+    {
+        pmf = intBitsToFloat(entry.z);
+        return i;
+    }
+
+    pmf = intBitsToFloat(entry.w);
+    return entry.y;
+}
+
+float LightPmf(vec3 p, int lightIndex)
+{
+    return intBitsToFloat(texelFetch(lightAliasTex, lightIndex).z);
+}
+
+#endif
+
+#endif
+
+#ifdef OPT_MESH_LIGHTS
+
+// Emissive triangles take four texels each. An alias table entry whose pdfs are per unit area, then the first
+// vertex and two edges in world space, with the index of the first vertex and the material packed in their w
+
+// Emitted radiance per unit area that triangles are picked by. Must match MeshLightDensity in Scene.cpp
+float MeshLightDensity(int matID)
+{
+    if (texelFetch(materialsTex, ivec2(matID * 8 + 6, 0), 0).w >= 0.0)
+        return 1.0;
+
+    return Luminance(texelFetch(materialsTex, ivec2(matID * 8 + 1, 0), 0).rgb);
+}
+
+// Pdf per unit area of sampling a point on an emissive triangle with the given material
+float MeshLightPdf(int matID)
+{
+    return MeshLightDensity(matID) * invMeshLightsPower;
+}
+
+void SampleMeshLight(in vec3 scatterPos, inout LightSampleRec lightSample)
+{
+    int i = min(int(rand() * float(numOfMeshLights)), numOfMeshLights - 1);
+    vec4 entry = texelFetch(meshLightsTex, i * 4);
+    float areaPdf = entry.z;
+
+    if (rand() >= entry.x)
+    {
+        i = floatBitsToInt(entry.y);
+        areaPdf = entry.w;
+    }
+
+    vec4 v0 = texelFetch(meshLightsTex, i * 4 + 1);
+    vec4 e1 = texelFetch(meshLightsTex, i * 4 + 2);
+    vec3 e2 = texelFetch(meshLightsTex, i * 4 + 3).xyz;
+
+    // Uniform point on the triangle
+    float r1 = sqrt(rand());
+    float r2 = rand();
+    vec3 bary = vec3(1.0 - r1, r1 * (1.0 - r2), r1 * r2);
+    vec3 lightSurfacePos = v0.xyz + e1.xyz * bary.y + e2 * bary.z;
+
+    lightSample.direction = lightSurfacePos - scatterPos;
+    lightSample.dist = length(lightSample.direction);
+    lightSample.direction /= lightSample.dist;
+
+    // Meshes emit from both sides
+    vec3 normal = normalize(cross(e1.xyz, e2));
+    float cosTheta = abs(dot(lightSample.direction, normal));
+    lightSample.normal = FaceForward(-lightSample.direction, normal);
+    lightSample.pdf = cosTheta > 0.0 ? areaPdf * lightSample.dist * lightSample.dist / cosTheta : 0.0;
+
+    int matID = floatBitsToInt(e1.w);
+    int emissionTexID = int(texelFetch(materialsTex, ivec2(matID * 8 + 6, 0), 0).w);
+    if (emissionTexID >= 0)
+    {
+        // Texture coordinates are in the w of vertices and normals. Read at full resolution as no ray cone is tracked here
+        int firstVertex = floatBitsToInt(v0.w);
+        vec2 t0 = vec2(texelFetch(verticesTex, firstVertex + 0).w, texelFetch(normalsTex, firstVertex + 0).w);
+        vec2 t1 = vec2(texelFetch(verticesTex, firstVertex + 1).w, texelFetch(normalsTex, firstVertex + 1).w);
+        vec2 t2 = vec2(texelFetch(verticesTex, firstVertex + 2).w, texelFetch(normalsTex, firstVertex + 2).w);
+        vec2 texCoord = t0 * bary.x + t1 * bary.y + t2 * bary.z;
+        lightSample.emission = pow(SampleTexture(emissionTexID, texCoord, -INF).rgb, vec3(2.2));
+    }
+    else
+        lightSample.emission = texelFetch(materialsTex, ivec2(matID * 8 + 1, 0), 0).rgb;
+}
+
+#endif
\ No newline at end of file
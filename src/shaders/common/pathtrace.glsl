@@ -66,10 +66,13 @@ void GetMaterial(inout State state, in Ray r)
     mat.alphaMode          = int(param8.y);
     mat.alphaCutoff        = param8.z;
 
+    // Mip level from the ray cone footprint projected onto the surface
+    float texLOD = state.texLOD + log2(state.coneWidth / max(abs(dot(state.normal, r.direction)), 0.01));
+
     // Base Color Map
     if (texIDs.x >= 0)
     {
-        vec4 col = texture(textureMapsArrayTex, vec3(state.texCoord, texIDs.x));
+        vec4 col = SampleTexture(texIDs.x, state.texCoord, texLOD);
         mat.baseColor.rgb *= pow(col.rgb, vec3(2.2));
         mat.opacity *= col.a;
     }
@@ -77,7 +80,7 @@ void GetMaterial(inout State state, in Ray r)
     // Metallic Roughness Map
     if (texIDs.y >= 0)
     {
-        vec2 matRgh = texture(textureMapsArrayTex, vec3(state.texCoord, texIDs.y)).bg;
+        vec2 matRgh = SampleTexture(texIDs.y, state.texCoord, texLOD).bg;
         mat.metallic = matRgh.x;
         mat.roughness = max(matRgh.y * matRgh.y, 0.001);
     }
@@ -85,7 +88,13 @@ void GetMaterial(inout State state, in Ray r)
     // Normal Map
     if (texIDs.z >= 0)
     {
-        vec3 texNormal = texture(textureMapsArrayTex, vec3(state.texCoord, texIDs.z)).rgb;
+        vec3 texNormal = SampleTexture(texIDs.z, state.texCoord, texLOD).rgb;
+
+#ifdef OPT_COMPRESSED_NORMALMAP
+        // BC5 normal maps only store x and y
+        vec2 texNormalXY = texNormal.xy * 2.0 - 1.0;
+        texNormal.z = sqrt(clamp(1.0 - dot(texNormalXY, texNormalXY), 0.0, 1.0)) * 0.5 + 0.5;
+#endif
 
 #ifdef OPT_OPENGL_NORMALMAP
         texNormal.y = 1.0 - texNormal.y;
@@ -104,7 +113,7 @@ void GetMaterial(inout State state, in Ray r)
 
     // Emission Map
     if (texIDs.w >= 0)
-        mat.emission = pow(texture(textureMapsArrayTex, vec3(state.texCoord, texIDs.w)).rgb, vec3(2.2));
+        mat.emission = pow(SampleTexture(texIDs.w, state.texCoord, texLOD).rgb, vec3(2.2));
 
     // Commented out the following as anisotropic param is temporarily unused.
     // float aspect = sqrt(1.0 - mat.anisotropic * 0.9);
@@ -117,18 +126,21 @@ void GetMaterial(inout State state, in Ray r)
 
 // TODO: Recheck all of this
 #if defined(OPT_MEDIUM) && defined(OPT_VOL_MIS)
-vec3 EvalTransmittance(Ray r)
+vec3 EvalTransmittance(Ray r, float maxDist)
 {
     LightSampleRec lightSample;
     State state;
     vec3 transmittance = vec3(1.0);
 
+    // No ray cone is tracked here, so textures are read at full resolution
+    state.coneWidth = 0.0;
+
     for (int depth = 0; depth < maxDepth; depth++)
     {
         bool hit = ClosestHit(r, state, lightSample);
 
         // If no hit (environment map) or if ray hit a light source then return transmittance
-        if (!hit || state.isEmitter)
+        if (!hit || state.isEmitter || state.hitDist >= maxDist)
             break;
 
         // TODO: Get only parameters that are needed to calculate transmittance
@@ -150,12 +162,16 @@ vec3 EvalTransmittance(Ray r)
 
         // Move ray origin to hit point
         r.origin = state.fhp + r.direction * EPS;
+        maxDist -= state.hitDist + EPS;
     }
 
     return transmittance;
 }
 #endif
 
+// First sampler dimension of the current bounce
+int bounceDim;
+
 vec3 DirectLight(in Ray r, in State state, bool isSurface)
 {
     vec3 Ld = vec3(0.0);
@@ -169,6 +185,7 @@ vec3 DirectLight(in Ray r, in State state, bool isSurface)
 #ifndef OPT_UNIFORM_LIGHT
     {
         vec3 color;
+        SetSampleDimension(bounceDim + DIM_ENVMAP);
         vec4 dirPdf = SampleEnvMap(Li);
         vec3 lightDir = dirPdf.xyz;
         float lightPdf = dirPdf.w;
@@ -177,7 +194,7 @@ vec3 DirectLight(in Ray r, in State state, bool isSurface)
 
 #if defined(OPT_MEDIUM) && defined(OPT_VOL_MIS)
         // If there are volumes in the scene then evaluate transmittance rather than a binary anyhit test
-        Li *= EvalTransmittance(shadowRay);
+        Li *= EvalTransmittance(shadowRay, INF);
 
         if (isSurface)
             scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightDir, scatterSample.pdf);
@@ -221,7 +238,11 @@ vec3 DirectLight(in Ray r, in State state, bool isSurface)
         Light light;
 
         //Pick a light to sample
-        int index = int(rand() * float(numOfLights)) * 5;
+        // The pmf is zero if no light can reach the point
+        float lightPmf;
+        // The pick comes after the two dimensions of the light sample
+        SetSampleDimension(bounceDim + DIM_LIGHT + 2);
+        int index = max(SampleLight(scatterPos, lightPmf), 0) * 5;
 
         // Fetch light Data
         vec3 position = texelFetch(lightsTex, ivec2(index + 0, 0), 0).xyz;
@@ -234,16 +255,18 @@ vec3 DirectLight(in Ray r, in State state, bool isSurface)
         float type    = params.z; // 0->Rect, 1->Sphere, 2->Distant
 
         light = Light(position, emission, u, v, radius, area, type);
+        SetSampleDimension(bounceDim + DIM_LIGHT);
         SampleOneLight(light, scatterPos, lightSample);
+        lightSample.pdf *= lightPmf;
         Li = lightSample.emission;
 
-        if (dot(lightSample.direction, lightSample.normal) < 0.0) // Required for quad lights with single sided emission
+        if (lightPmf > 0.0 && dot(lightSample.direction, lightSample.normal) < 0.0) // Required for quad lights with single sided emission
         {
             Ray shadowRay = Ray(scatterPos, lightSample.direction);
 
             // If there are volumes in the scene then evaluate transmittance rather than a binary anyhit test
 #if defined(OPT_MEDIUM) && defined(OPT_VOL_MIS)
-            Li *= EvalTransmittance(shadowRay);
+            Li *= EvalTransmittance(shadowRay, lightSample.dist);
 
             if (isSurface)
                 scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightSample.direction, scatterSample.pdf);
@@ -280,9 +303,56 @@ vec3 DirectLight(in Ray r, in State state, bool isSurface)
     }
 #endif
 
+    // Emissive meshes
+#ifdef OPT_MESH_LIGHTS
+    {
+        LightSampleRec lightSample;
+        SetSampleDimension(bounceDim + DIM_MESH_LIGHT);
+        SampleMeshLight(scatterPos, lightSample);
+        Li = lightSample.emission;
+
+        if (lightSample.pdf > 0.0)
+        {
+            Ray shadowRay = Ray(scatterPos, lightSample.direction);
+
+            // The emitter is part of the scene geometry, so the shadow ray stops short of it
+#if defined(OPT_MEDIUM) && defined(OPT_VOL_MIS)
+            Li *= EvalTransmittance(shadowRay, lightSample.dist - EPS);
+
+            if (isSurface)
+                scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightSample.direction, scatterSample.pdf);
+            else
+            {
+                float p = PhaseHG(dot(-r.direction, lightSample.direction), state.medium.anisotropy);
+                scatterSample.f = vec3(p);
+                scatterSample.pdf = p;
+            }
+
+            if (scatterSample.pdf > 0.0)
+                Ld += PowerHeuristic(lightSample.pdf, scatterSample.pdf) * scatterSample.f * Li / lightSample.pdf;
+#else
+            bool inShadow = AnyHit(shadowRay, lightSample.dist - EPS);
+
+            if (!inShadow)
+            {
+                scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightSample.direction, scatterSample.pdf);
+
+                if (scatterSample.pdf > 0.0)
+                    Ld += PowerHeuristic(lightSample.pdf, scatterSample.pdf) * Li * scatterSample.f / lightSample.pdf;
+            }
+#endif
+        }
+    }
+#endif
+
     return Ld;
 }
 
+#ifdef OPT_TEMPORAL_REPROJECTION
+// Distance to the first hit of the camera ray. Used to reproject the preview
+float firstHitDist;
+#endif
+
 vec4 PathTrace(Ray r)
 {
     vec3 radiance = vec3(0.0);
@@ -299,10 +369,23 @@ vec4 PathTrace(Ray r)
     bool mediumSampled = false;
     bool surfaceScatter = false;
 
-    for (state.depth = 0;; state.depth++)
+    // Ray cone for texture filtering. Starts at the angle covered by a pixel and
+    // secondary rays keep that spread, which errs on the side of sharper textures. fov is horizontal
+    float coneSpread = 2.0 * tan(camera.fov * 0.5) / resolution.x;
+    state.coneWidth = 0.0;
+    state.depth = 0;
+
+    for (int bounce = 0;; state.depth++, bounce++)
     {
+        bounceDim = DIM_BOUNCE + bounce * DIMS_PER_BOUNCE;
+
         bool hit = ClosestHit(r, state, lightSample);
 
+#ifdef OPT_TEMPORAL_REPROJECTION
+        if (state.depth == 0)
+            firstHitDist = hit ? state.hitDist : INF;
+#endif
+
         if (!hit)
         {
 #if defined(OPT_BACKGROUND) || defined(OPT_TRANSPARENT_BACKGROUND)
@@ -339,10 +422,28 @@ vec4 PathTrace(Ray r)
              break;
         }
 
+        state.coneWidth += coneSpread * state.hitDist;
         GetMaterial(state, r);
 
-        // Gather radiance from emissive objects. Emission from meshes is not importance sampled
+        // Gather radiance from emissive objects
+#ifdef OPT_MESH_LIGHTS
+        // Emissive meshes are also reached by next event estimation, so use scatterSample.pdf from previous bounce for MIS
+        {
+            float misWeight = 1.0;
+
+            if (state.depth > 0 && !state.isEmitter)
+                misWeight = PowerHeuristic(scatterSample.pdf, lightSample.pdf);
+
+#if defined(OPT_MEDIUM) && !defined(OPT_VOL_MIS)
+            if(!surfaceScatter)
+                misWeight = 1.0f;
+#endif
+
+            radiance += misWeight * state.mat.emission * throughput;
+        }
+#else
         radiance += state.mat.emission * throughput;
+#endif
         
 #ifdef OPT_LIGHTS
 
@@ -388,6 +489,7 @@ vec4 PathTrace(Ray r)
             else
             {
                 // Sample a distance in the medium
+                SetSampleDimension(bounceDim + DIM_MEDIUM);
                 float scatterDist = min(-log(rand()) / state.medium.density, state.hitDist);
                 mediumSampled = scatterDist < state.hitDist;
 
@@ -403,6 +505,7 @@ vec4 PathTrace(Ray r)
                     radiance += DirectLight(r, state, false) * throughput;
 
                     // Pick a new direction based on the phase function
+                    SetSampleDimension(bounceDim + DIM_MEDIUM + 1);
                     vec3 scatterDir = SampleHG(-r.direction, state.medium.anisotropy, rand(), rand());
                     scatterSample.pdf = PhaseHG(dot(-r.direction, scatterDir), state.medium.anisotropy);
                     r.direction = scatterDir;
@@ -417,6 +520,7 @@ vec4 PathTrace(Ray r)
 #ifdef OPT_ALPHA_TEST
 
             // Ignore intersection and continue ray based on alpha test
+            SetSampleDimension(bounceDim + DIM_ALPHA);
             if ((state.mat.alphaMode == ALPHA_MODE_MASK && state.mat.opacity < state.mat.alphaCutoff) ||
                 (state.mat.alphaMode == ALPHA_MODE_BLEND && rand() > state.mat.opacity))
             {
@@ -432,6 +536,7 @@ vec4 PathTrace(Ray r)
                 radiance += DirectLight(r, state, true) * throughput;
 
                 // Sample BSDF for color and outgoing direction
+                SetSampleDimension(bounceDim + DIM_BSDF);
                 scatterSample.f = DisneySample(state, -r.direction, state.ffnormal, scatterSample.L, scatterSample.pdf);
                 if (scatterSample.pdf > 0.0)
                     throughput *= scatterSample.f / scatterSample.pdf;
@@ -465,6 +570,7 @@ vec4 PathTrace(Ray r)
         if (state.depth >= OPT_RR_DEPTH)
         {
             float q = min(max(throughput.x, max(throughput.y, throughput.z)) + 0.001, 0.95);
+            SetSampleDimension(bounceDim + DIM_RR);
             if (rand() > q)
                 break;
             throughput /= q;
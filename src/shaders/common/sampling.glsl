@@ -207,7 +207,7 @@ void SampleSphereLight(in Light light, in vec3 scatterPos, inout LightSampleRec
 
     lightSample.direction /= lightSample.dist;
     lightSample.normal = normalize(lightSurfacePos - light.position);
-    lightSample.emission = light.emission * float(numOfLights);
+    lightSample.emission = light.emission;
     lightSample.pdf = distSq / (light.area * 0.5 * abs(dot(lightSample.normal, lightSample.direction)));
 }
 
@@ -222,7 +222,7 @@ void SampleRectLight(in Light light, in vec3 scatterPos, inout LightSampleRec li
     float distSq = lightSample.dist * lightSample.dist;
     lightSample.direction /= lightSample.dist;
     lightSample.normal = normalize(cross(light.u, light.v));
-    lightSample.emission = light.emission * float(numOfLights);
+    lightSample.emission = light.emission;
     lightSample.pdf = distSq / (light.area * abs(dot(lightSample.normal, lightSample.direction)));
 }
 
@@ -230,7 +230,7 @@ void SampleDistantLight(in Light light, in vec3 scatterPos, inout LightSampleRec
 {
     lightSample.direction = normalize(light.position - vec3(0.0));
     lightSample.normal = normalize(scatterPos - light.position);
-    lightSample.emission = light.emission * float(numOfLights);
+    lightSample.emission = light.emission;
     lightSample.dist = INF;
     lightSample.pdf = 1.0;
 }
@@ -274,4 +274,28 @@ float PhaseHG(float cosTheta, float g)
 {
     float denom = 1 + g * g + 2 * g * cosTheta;
     return INV_4_PI * (1 - g * g) / (denom * sqrt(denom));
+}
+
+// Samples a texture array with lod given for a 1x1 texture, offset by the size of the array
+vec4 SampleTextureArray(sampler2DArray tex, vec3 texCoord, float lod)
+{
+    ivec3 size = textureSize(tex, 0);
+    return textureLod(tex, texCoord, lod + 0.5 * log2(float(size.x * size.y)));
+}
+
+// Samples a scene texture from the texture array of its size bucket
+vec4 SampleTexture(int texID, vec2 texCoord, float lod)
+{
+    ivec2 location = texelFetch(textureInfoTex, texID).xy;
+    vec3 coord = vec3(texCoord, location.y);
+
+    // Sampler arrays can only be indexed with constant expressions
+    if (location.x == 0)
+        return SampleTextureArray(textureMapsArrayTex[0], coord, lod);
+    else if (location.x == 1)
+        return SampleTextureArray(textureMapsArrayTex[1], coord, lod);
+    else if (location.x == 2)
+        return SampleTextureArray(textureMapsArrayTex[2], coord, lod);
+    else
+        return SampleTextureArray(textureMapsArrayTex[3], coord, lod);
 }
\ No newline at end of file
@@ -30,24 +30,38 @@ uniform vec2 invNumTiles;
 
 uniform sampler2D accumTexture;
 uniform samplerBuffer BVH;
+uniform isamplerBuffer BVHLinksTex;
+uniform samplerBuffer trianglesTex;
 uniform isamplerBuffer vertexIndicesTex;
 uniform samplerBuffer verticesTex;
 uniform samplerBuffer normalsTex;
 uniform sampler2D materialsTex;
 uniform sampler2D transformsTex;
 uniform sampler2D lightsTex;
-uniform sampler2DArray textureMapsArrayTex;
+uniform samplerBuffer lightBVHTex;
+uniform isamplerBuffer lightAliasTex;
+uniform samplerBuffer meshLightsTex;
+uniform isamplerBuffer textureInfoTex;
+
+#define MAX_TEXTURE_BUCKETS 4
+uniform sampler2DArray textureMapsArrayTex[MAX_TEXTURE_BUCKETS];
 
 uniform sampler2D envMapTex;
-uniform sampler2D envMapCDFTex;
+uniform isamplerBuffer envMapAliasTex;
+
+uniform sampler2D blueNoiseTex;
 
-uniform vec2 envMapRes;
-uniform float envMapTotalSum;
+uniform vec2 envMapImportanceRes;
 uniform float envMapIntensity;
 uniform float envMapRot;
 uniform vec3 uniformLightCol;
 uniform int numOfLights;
+uniform int numOfDistantLights;
+uniform int numOfMeshLights;
+uniform float invMeshLightsPower;
 uniform int maxDepth;
 uniform int topBVHIndex;
 uniform int frameNum;
+uniform int sampleNum;
+uniform uint sobolDirections[128];
 uniform float roughnessMollificationAmt;
\ No newline at end of file
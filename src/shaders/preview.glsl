@@ -24,7 +24,12 @@
 
 #version 330
 
+#ifdef OPT_TEMPORAL_REPROJECTION
+layout(location = 0) out vec4 color;
+layout(location = 1) out float firstHit;
+#else
 out vec4 color;
+#endif
 in vec2 TexCoords;
 
 #include common/uniforms.glsl
@@ -32,6 +37,7 @@ in vec2 TexCoords;
 #include common/intersection.glsl
 #include common/sampling.glsl
 #include common/envmap.glsl
+#include common/lights.glsl
 #include common/anyhit.glsl
 #include common/closest_hit.glsl
 #include common/disney.glsl
@@ -40,7 +46,12 @@ in vec2 TexCoords;
 
 void main(void)
 {
+#ifdef OPT_TEMPORAL_REPROJECTION
+    // Each preview frame needs new samples for the history to converge
+    InitRNG(gl_FragCoord.xy, frameNum);
+#else
     InitRNG(gl_FragCoord.xy, 1);
+#endif
 
     float r1 = 2.0 * rand();
     float r2 = 2.0 * rand();
@@ -68,4 +79,7 @@ void main(void)
     vec4 pixelColor = PathTrace(ray);
 
     color = pixelColor;
+#ifdef OPT_TEMPORAL_REPROJECTION
+    firstHit = firstHitDist;
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,169 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#version 330
+
+layout(location = 0) out vec4 outCol;
+layout(location = 1) out vec4 outPos;
+in vec2 TexCoords;
+
+struct Camera
+{
+    vec3 position;
+    vec3 right;
+    vec3 up;
+    vec3 forward;
+    float fov;
+};
+
+uniform sampler2D previewTexture;
+uniform sampler2D previewDepthTexture;
+uniform sampler2D historyTexture;
+uniform sampler2D historyPositionTexture;
+uniform sampler2D accumTexture;
+uniform sampler2D tileSamplesTex;
+
+uniform Camera camera;
+uniform Camera prevCamera; // Camera the history was rendered from
+
+uniform vec2 resolution;
+uniform bool reuseHistory;
+uniform bool resolveAccum;
+uniform ivec2 tileSize;
+uniform int maxHistorySamples;
+
+// A history sample whose distance to the camera differs by more than this fraction belongs to another surface
+#define DISOCCLUSION_THRESHOLD 0.05
+
+void ResolveAccumulation()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 hist = texelFetch(historyTexture, pixel, 0);
+    vec4 histPos = texelFetch(historyPositionTexture, pixel, 0);
+
+    float n = texelFetch(tileSamplesTex, pixel / tileSize, 0).r;
+
+    // The history was last written from the same view, so both are estimates of the same pixel
+    float count = histPos.w + n;
+    outCol = (hist * histPos.w + texelFetch(accumTexture, pixel, 0)) / max(count, 1.0);
+    outPos = vec4(histPos.xyz, min(count, float(maxHistorySamples)));
+}
+
+// The preview has a lower resolution than the history, so its samples are filtered to keep blocks out of the history
+vec4 FilteredPreview(vec2 uv)
+{
+    ivec2 size = textureSize(previewTexture, 0);
+    vec2 p = uv * vec2(size) - 0.5;
+    ivec2 i = ivec2(floor(p));
+    vec2 f = p - vec2(i);
+
+    ivec2 i0 = clamp(i, ivec2(0), size - 1);
+    ivec2 i1 = clamp(i + 1, ivec2(0), size - 1);
+    vec4 a = mix(texelFetch(previewTexture, i0, 0), texelFetch(previewTexture, ivec2(i1.x, i0.y), 0), f.x);
+    vec4 b = mix(texelFetch(previewTexture, ivec2(i0.x, i1.y), 0), texelFetch(previewTexture, i1, 0), f.x);
+    return mix(a, b, f.y);
+}
+
+// Catmull-Rom filtered history from nine bilinear taps. A bilinear fetch alone would blur the history a bit more every frame
+vec4 SampleHistory(vec2 uv)
+{
+    vec2 size = vec2(textureSize(historyTexture, 0));
+    vec2 samplePos = uv * size;
+    vec2 texPos1 = floor(samplePos - 0.5) + 0.5;
+    vec2 f = samplePos - texPos1;
+
+    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+    vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+    vec2 w3 = f * f * (-0.5 + 0.5 * f);
+
+    vec2 w12 = w1 + w2;
+    vec2 texPos0 = (texPos1 - 1.0) / size;
+    vec2 texPos3 = (texPos1 + 2.0) / size;
+    vec2 texPos12 = (texPos1 + w2 / w12) / size;
+
+    vec4 result = vec4(0.0);
+    result += texture(historyTexture, vec2(texPos0.x, texPos0.y)) * w0.x * w0.y;
+    result += texture(historyTexture, vec2(texPos12.x, texPos0.y)) * w12.x * w0.y;
+    result += texture(historyTexture, vec2(texPos3.x, texPos0.y)) * w3.x * w0.y;
+    result += texture(historyTexture, vec2(texPos0.x, texPos12.y)) * w0.x * w12.y;
+    result += texture(historyTexture, vec2(texPos12.x, texPos12.y)) * w12.x * w12.y;
+    result += texture(historyTexture, vec2(texPos3.x, texPos12.y)) * w3.x * w12.y;
+    result += texture(historyTexture, vec2(texPos0.x, texPos3.y)) * w0.x * w3.y;
+    result += texture(historyTexture, vec2(texPos12.x, texPos3.y)) * w12.x * w3.y;
+    result += texture(historyTexture, vec2(texPos3.x, texPos3.y)) * w3.x * w3.y;
+
+    // The negative lobes can overshoot below zero next to bright pixels
+    return max(result, vec4(0.0));
+}
+
+void main()
+{
+    if (resolveAccum)
+    {
+        ResolveAccumulation();
+        return;
+    }
+
+    // The first hit of this pixel, from its camera ray and the depth the preview found nearby
+    vec2 d = 2.0 * TexCoords - 1.0;
+    float scale = tan(camera.fov * 0.5);
+    d.y *= resolution.y / resolution.x * scale;
+    d.x *= scale;
+    vec3 rayDir = normalize(d.x * camera.right + d.y * camera.up + camera.forward);
+    vec3 pos = camera.position + rayDir * texture(previewDepthTexture, TexCoords).r;
+
+    vec4 col = FilteredPreview(TexCoords);
+    float count = 1.0;
+
+    if (reuseHistory)
+    {
+        // Project the first hit into the previous camera to find where it was in the history
+        vec3 v = pos - prevCamera.position;
+        float z = dot(v, prevCamera.forward);
+        if (z > 0.0)
+        {
+            float prevScale = tan(prevCamera.fov * 0.5);
+            vec2 prevD = vec2(dot(v, prevCamera.right), dot(v, prevCamera.up)) / (z * prevScale);
+            prevD.y *= resolution.x / resolution.y;
+            vec2 uv = prevD * 0.5 + 0.5;
+
+            if (all(greaterThanEqual(uv, vec2(0.0))) && all(lessThanEqual(uv, vec2(1.0))))
+            {
+                vec4 histPos = texture(historyPositionTexture, uv);
+                float dist = length(v);
+
+                // Reject disocclusions, where the history saw another surface
+                if (abs(length(histPos.xyz - prevCamera.position) - dist) < DISOCCLUSION_THRESHOLD * dist)
+                {
+                    count = min(histPos.w + 1.0, float(maxHistorySamples));
+                    col = mix(SampleHistory(uv), col, 1.0 / count);
+                }
+            }
+        }
+    }
+
+    outCol = col;
+    outPos = vec4(pos, count);
+}
@@ -32,6 +32,7 @@ in vec2 TexCoords;
 #include common/intersection.glsl
 #include common/sampling.glsl
 #include common/envmap.glsl
+#include common/lights.glsl
 #include common/anyhit.glsl
 #include common/closest_hit.glsl
 #include common/disney.glsl
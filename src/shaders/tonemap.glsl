@@ -28,7 +28,9 @@ out vec4 outCol;
 in vec2 TexCoords;
 
 uniform sampler2D pathTraceTexture;
-uniform float invSampleCounter;
+uniform sampler2D tileSamplesTex;
+uniform bool perTileSamples;
+uniform ivec2 tileSize;
 uniform bool enableTonemap;
 uniform bool enableAces;
 uniform bool simpleAcesFit;
@@ -96,7 +98,11 @@ vec3 Tonemap(in vec3 c, float limit)
 
 void main()
 {
-    vec4 col = texture(pathTraceTexture, TexCoords) * invSampleCounter;
+    vec4 col = texture(pathTraceTexture, TexCoords);
+
+    // Tiles of the accumulation can have different numbers of samples. Other inputs are averages already
+    if (perTileSamples)
+        col /= max(texelFetch(tileSamplesTex, ivec2(gl_FragCoord.xy) / tileSize, 0).r, 1.0);
     vec3 color = col.rgb;
     float alpha = col.a;
 
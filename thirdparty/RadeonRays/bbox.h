@@ -31,6 +31,7 @@ THE SOFTWARE.
 #include "Mat4.h"
 #include "Vec2.h"
 #include "Vec3.h"
+#include "Vec3A.h"
 #include "Vec4.h"
 
 using namespace GLSLPT;
@@ -41,35 +42,35 @@ namespace RadeonRays
     {
     public:
         bbox()
-            : pmin(Vec3(std::numeric_limits<float>::max(),
-                        std::numeric_limits<float>::max(),
-                        std::numeric_limits<float>::max()))
-            , pmax(Vec3(-std::numeric_limits<float>::max(),
-                        -std::numeric_limits<float>::max(),
-                        -std::numeric_limits<float>::max()))
+            : pmin(Vec3A(std::numeric_limits<float>::max(),
+                         std::numeric_limits<float>::max(),
+                         std::numeric_limits<float>::max()))
+            , pmax(Vec3A(-std::numeric_limits<float>::max(),
+                         -std::numeric_limits<float>::max(),
+                         -std::numeric_limits<float>::max()))
         {
         }
 
-        bbox(Vec3 const& p)
+        bbox(Vec3A const& p)
             : pmin(p)
             , pmax(p)
         {
         }
 
-        bbox(Vec3 const& p1, Vec3 const& p2)
-            : pmin(Vec3::Min(p1, p2))
-            , pmax(Vec3::Max(p1, p2))
+        bbox(Vec3A const& p1, Vec3A const& p2)
+            : pmin(Vec3A::Min(p1, p2))
+            , pmax(Vec3A::Max(p1, p2))
         {
         }
 
-		Vec3 center()  const;
-		Vec3 extents() const;
+		Vec3A center()  const;
+		Vec3A extents() const;
 
-        bool contains(Vec3 const& p) const;
+        bool contains(Vec3A const& p) const;
 
 		inline int maxdim() const
 		{
-			Vec3 ext = extents();
+			Vec3A ext = extents();
 
 			if (ext.x >= ext.y && ext.x >= ext.z)
 				return 0;
@@ -84,17 +85,39 @@ namespace RadeonRays
 		float surface_area() const;
 
         // TODO: this is non-portable, optimization trial for fast intersection test
-        Vec3 const& operator [] (int i) const { return *(&pmin + i); }
+        Vec3A const& operator [] (int i) const { return *(&pmin + i); }
 
         // Grow the bounding box by a point
-		void grow(Vec3 const& p);
+		void grow(Vec3A const& p);
         // Grow the bounding box by a box
 		void grow(bbox const& b);
 
-        Vec3 pmin;
-        Vec3 pmax;
+        Vec3A pmin;
+        Vec3A pmax;
     };
 
+	// The builders call these for every primitive, so they are inlined
+	inline Vec3A bbox::center()  const { return (pmax + pmin) * 0.5f; }
+	inline Vec3A bbox::extents() const { return pmax - pmin; }
+
+	inline float bbox::surface_area() const
+	{
+		Vec3A ext = extents();
+		return 2.f * (ext.x * ext.y + ext.x * ext.z + ext.y * ext.z);
+	}
+
+	inline void bbox::grow(Vec3A const& p)
+	{
+		pmin = Vec3A::Min(pmin, p);
+		pmax = Vec3A::Max(pmax, p);
+	}
+
+	inline void bbox::grow(bbox const& b)
+	{
+		pmin = Vec3A::Min(pmin, b.pmin);
+		pmax = Vec3A::Max(pmax, b.pmax);
+	}
+
 	bbox bboxunion(bbox const& box1, bbox const& box2);
 	bbox intersection(bbox const& box1, bbox const& box2);
 	void intersection(bbox const& box1, bbox const& box2, bbox& box);
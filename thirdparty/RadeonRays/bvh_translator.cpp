@@ -24,6 +24,8 @@ THE SOFTWARE.
 
 #include <cassert>
 #include <stack>
+#include <queue>
+#include <unordered_map>
 #include <iostream>
 #include "bvh_translator.h"
 
@@ -55,6 +57,86 @@ namespace RadeonRays
         return index;
     }
 
+    // Number of nodes packed together in a treelet. Children are placed in sibling pairs, so it is even.
+    // A node takes 36 bytes on the GPU so a treelet spans a few cache lines
+    static const int kTreeletSize = 16;
+
+    int BvhTranslator::ProcessBLASNodesTreelet(const Bvh::Node* root)
+    {
+        typedef std::pair<float, const Bvh::Node*> Candidate;
+
+        // Layout order of the nodes. The two children of a node are always placed next to each other
+        std::vector<const Bvh::Node*> order;
+        order.push_back(root);
+
+        // Interior nodes whose children have not been placed yet, largest surface area first.
+        // The probability of a ray hitting a node is proportional to its surface area,
+        // so the treelets holding the most frequently visited nodes end up at the start of the array
+        std::priority_queue<Candidate> frontier;
+        if (root->type == Bvh::NodeType::kInternal)
+            frontier.push(Candidate(root->bounds.surface_area(), root));
+
+        while (!frontier.empty())
+        {
+            std::priority_queue<Candidate> treelet;
+            treelet.push(frontier.top());
+            frontier.pop();
+
+            int treeletNodes = 0;
+            while (!treelet.empty() && treeletNodes < kTreeletSize)
+            {
+                const Bvh::Node* node = treelet.top().second;
+                treelet.pop();
+
+                order.push_back(node->lc);
+                order.push_back(node->rc);
+                treeletNodes += 2;
+
+                if (node->lc->type == Bvh::NodeType::kInternal)
+                    treelet.push(Candidate(node->lc->bounds.surface_area(), node->lc));
+                if (node->rc->type == Bvh::NodeType::kInternal)
+                    treelet.push(Candidate(node->rc->bounds.surface_area(), node->rc));
+            }
+
+            // Nodes that did not fit become the roots of later treelets
+            while (!treelet.empty())
+            {
+                frontier.push(treelet.top());
+                treelet.pop();
+            }
+        }
+
+        std::unordered_map<const Bvh::Node*, int> nodeIndices;
+        for (int i = 0; i < order.size(); i++)
+            nodeIndices[order[i]] = curNode + i;
+
+        for (int i = 0; i < order.size(); i++)
+        {
+            const Bvh::Node* node = order[i];
+            Node& flatNode = nodes[curNode + i];
+
+            flatNode.bboxmin = node->bounds.pmin;
+            flatNode.bboxmax = node->bounds.pmax;
+
+            if (node->type == RadeonRays::Bvh::NodeType::kLeaf)
+            {
+                flatNode.LRLeaf.x = curTriIndex + node->startidx;
+                flatNode.LRLeaf.y = node->numprims;
+                flatNode.LRLeaf.z = 1;
+            }
+            else
+            {
+                flatNode.LRLeaf.x = nodeIndices[node->lc];
+                flatNode.LRLeaf.y = nodeIndices[node->rc];
+                flatNode.LRLeaf.z = 0;
+            }
+        }
+
+        int index = curNode;
+        curNode += order.size() - 1;
+        return index;
+    }
+
     int BvhTranslator::ProcessTLASNodes(const Bvh::Node* node)
     {
         RadeonRays::bbox bbox = node->bounds;
@@ -85,6 +167,38 @@ namespace RadeonRays
         return index;
     }
 
+    void BvhTranslator::ProcessLinks(int startIndex, int endIndex)
+    {
+        for (int i = startIndex; i < endIndex; i++)
+            links[i].parent = -1;
+
+        for (int i = startIndex; i < endIndex; i++)
+        {
+            // Only interior nodes have children. Leaves of the TLAS point to BLAS roots which have no unique parent
+            if (nodes[i].LRLeaf.z != 0)
+                continue;
+
+            int leftIndex = (int)nodes[i].LRLeaf.x;
+            int rightIndex = (int)nodes[i].LRLeaf.y;
+
+            links[leftIndex].parent = i;
+            links[rightIndex].parent = i;
+
+            Vec3 leftCenter = (nodes[leftIndex].bboxmin + nodes[leftIndex].bboxmax) * 0.5f;
+            Vec3 rightCenter = (nodes[rightIndex].bboxmin + nodes[rightIndex].bboxmax) * 0.5f;
+            Vec3 diff = rightCenter - leftCenter;
+
+            int axis = 0;
+            if (fabsf(diff.y) > fabsf(diff[axis]))
+                axis = 1;
+            if (fabsf(diff.z) > fabsf(diff[axis]))
+                axis = 2;
+
+            links[i].axis = axis;
+            links[i].order = diff[axis] >= 0.0f ? 1 : -1;
+        }
+    }
+
     void BvhTranslator::ProcessBLAS()
     {
         int nodeCnt = 0;
@@ -96,6 +210,7 @@ namespace RadeonRays
         // reserve space for top level nodes
         nodeCnt += 2 * meshInstances.size();
         nodes.resize(nodeCnt);
+        links.resize(nodeCnt, NodeLink{ -1, 0, 1 });
 
         int bvhRootIndex = 0;
         curTriIndex = 0;
@@ -108,23 +223,28 @@ namespace RadeonRays
             bvhRootStartIndices.push_back(bvhRootIndex);
             bvhRootIndex += mesh->bvh->m_nodecnt;
 
-            ProcessBLASNodes(mesh->bvh->m_root);
+            if (treeletLayout)
+                ProcessBLASNodesTreelet(mesh->bvh->m_root);
+            else
+                ProcessBLASNodes(mesh->bvh->m_root);
             curTriIndex += mesh->bvh->GetNumIndices();
         }
+
+        ProcessLinks(0, topLevelIndex);
     }
 
     void BvhTranslator::ProcessTLAS()
     {
         curNode = topLevelIndex;
         ProcessTLASNodes(topLevelBvh->m_root);
+        ProcessLinks(topLevelIndex, topLevelIndex + topLevelBvh->m_nodecnt);
     }
 
     void BvhTranslator::UpdateTLAS(const Bvh* topLevelBvh, const std::vector<GLSLPT::MeshInstance>& sceneInstances)
     {
         this->topLevelBvh = topLevelBvh;
         meshInstances = sceneInstances;
-        curNode = topLevelIndex;
-        ProcessTLASNodes(topLevelBvh->m_root);
+        ProcessTLAS();
     }
 
     void BvhTranslator::Process(const Bvh* topLevelBvh, const std::vector<GLSLPT::Mesh*>& sceneMeshes, const std::vector<GLSLPT::MeshInstance>& sceneInstances)
@@ -49,20 +49,34 @@ namespace RadeonRays
             Vec3 LRLeaf;
         };
 
+        // Used by the stackless traversal to backtrack without a stack
+        struct NodeLink
+        {
+            int parent; // -1 for the roots of the TLAS and of each BLAS
+            int axis;   // Axis along which the children are separated
+            int order;  // 1 if the left child comes before the right child along axis, -1 otherwise
+        };
+
         void ProcessBLAS();
         void ProcessTLAS();
         void UpdateTLAS(const Bvh* topLevelBvh, const std::vector<GLSLPT::MeshInstance>& instances);
         void Process(const Bvh* topLevelBvh, const std::vector<GLSLPT::Mesh*>& meshes, const std::vector<GLSLPT::MeshInstance>& instances);
         int topLevelIndex = 0;
         std::vector<Node> nodes;
+        std::vector<NodeLink> links;
         int nodeTexWidth;
 
+        // Lay out BLAS nodes in treelets ordered by surface area instead of plain depth first order
+        bool treeletLayout = false;
+
     private:
         int curNode = 0;
         int curTriIndex = 0;
         std::vector<int> bvhRootStartIndices;
         int ProcessBLASNodes(const Bvh::Node* root);
+        int ProcessBLASNodesTreelet(const Bvh::Node* root);
         int ProcessTLASNodes(const Bvh::Node* root);
+        void ProcessLinks(int startIndex, int endIndex);
         std::vector<GLSLPT::MeshInstance> meshInstances;
         std::vector<GLSLPT::Mesh*> meshes;
         const Bvh* topLevelBvh;